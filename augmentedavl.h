@@ -0,0 +1,837 @@
+#ifndef AUGMENTEDAVL_H
+#define AUGMENTEDAVL_H
+
+#include <algorithm>
+#include <cstddef>
+#include <limits>
+#include <stdexcept>
+#include <type_traits>
+#include "avlbst.h"
+
+/*
+ * Summary policies for AugmentedAVLTree. A policy provides:
+ *   value_type          the type of the per-subtree summary
+ *   identity()          the neutral element of combine
+ *   lift(key, value)    the summary of a single item
+ *   combine(a, b)       an associative merge, where a covers smaller keys
+ * combine does not need to be commutative; summaries are always merged
+ * in key order.
+ */
+
+/**
+* Sum of the values.
+*/
+template <typename Value>
+struct SumSummary
+{
+    typedef Value value_type;
+    static Value identity() { return Value(); }
+    template<typename Key>
+    static Value lift(const Key&, const Value& value) { return value; }
+    static Value combine(const Value& a, const Value& b) { return a + b; }
+};
+
+/**
+* Smallest value. The identity is numeric_limits<Value>::max(), so Value
+* must be a type numeric_limits is specialized for.
+*/
+template <typename Value>
+struct MinSummary
+{
+    static_assert(std::numeric_limits<Value>::is_specialized,
+                  "MinSummary needs a Value with a numeric_limits specialization");
+    typedef Value value_type;
+    static Value identity() { return std::numeric_limits<Value>::max(); }
+    template<typename Key>
+    static Value lift(const Key&, const Value& value) { return value; }
+    static Value combine(const Value& a, const Value& b) { return b < a ? b : a; }
+};
+
+/**
+* Largest value. The identity is numeric_limits<Value>::lowest(), so
+* Value must be a type numeric_limits is specialized for.
+*/
+template <typename Value>
+struct MaxSummary
+{
+    static_assert(std::numeric_limits<Value>::is_specialized,
+                  "MaxSummary needs a Value with a numeric_limits specialization");
+    typedef Value value_type;
+    static Value identity() { return std::numeric_limits<Value>::lowest(); }
+    template<typename Key>
+    static Value lift(const Key&, const Value& value) { return value; }
+    static Value combine(const Value& a, const Value& b) { return a < b ? b : a; }
+};
+
+/**
+* Number of items.
+*/
+struct CountSummary
+{
+    typedef size_t value_type;
+    static size_t identity() { return 0; }
+    template<typename Key, typename Value>
+    static size_t lift(const Key&, const Value&) { return 1; }
+    static size_t combine(size_t a, size_t b) { return a + b; }
+};
+
+/**
+* An AVLNode that also stores the summary of its subtree.
+*/
+template <typename Key, typename Value, typename Summary>
+class AugmentedAVLNode : public AVLNode<Key, Value>
+{
+public:
+    AugmentedAVLNode(const Key& key, const Value& value, AugmentedAVLNode<Key, Value, Summary>* parent);
+    AugmentedAVLNode(Key&& key, Value&& value, AugmentedAVLNode<Key, Value, Summary>* parent);
+
+    const typename Summary::value_type& getSummary() const;
+    void setSummary(const typename Summary::value_type& summary);
+
+protected:
+    typename Summary::value_type summary_;
+};
+
+/*
+  -----------------------------------------------------
+  Begin implementations for the AugmentedAVLNode class.
+  -----------------------------------------------------
+*/
+
+/**
+* Constructor, which starts out with the summary of the single item.
+*/
+template<class Key, class Value, class Summary>
+AugmentedAVLNode<Key, Value, Summary>::AugmentedAVLNode(const Key& key, const Value& value, AugmentedAVLNode<Key, Value, Summary>* parent) :
+    AVLNode<Key, Value>(key, value, parent),
+    summary_(Summary::lift(this->getKey(), this->getValue()))
+{
+
+}
+
+/**
+* Same as above, moving the key and value into the node.
+*/
+template<class Key, class Value, class Summary>
+AugmentedAVLNode<Key, Value, Summary>::AugmentedAVLNode(Key&& key, Value&& value, AugmentedAVLNode<Key, Value, Summary>* parent) :
+    AVLNode<Key, Value>(std::move(key), std::move(value), parent),
+    summary_(Summary::lift(this->getKey(), this->getValue()))
+{
+
+}
+
+/**
+* A getter for the summary of the node's subtree.
+*/
+template<class Key, class Value, class Summary>
+const typename Summary::value_type& AugmentedAVLNode<Key, Value, Summary>::getSummary() const
+{
+    return summary_;
+}
+
+/**
+* A setter for the summary of the node's subtree.
+*/
+template<class Key, class Value, class Summary>
+void AugmentedAVLNode<Key, Value, Summary>::setSummary(const typename Summary::value_type& summary)
+{
+    summary_ = summary;
+}
+
+/*
+  ---------------------------------------------------
+  End implementations for the AugmentedAVLNode class.
+  ---------------------------------------------------
+*/
+
+/**
+* An AVL tree that maintains Summary over every subtree, through inserts,
+* removes and rotations, so that the summary of any key range can be
+* computed in O(log n).
+* Values can only be changed through the tree (insert, emplace,
+* insert_or_assign, ...), which keeps the summaries up to date: the
+* iterators, operator[] and the parallel scans of this class hand out
+* const items. Writing through an AVLTree reference or iterator to this
+* tree bypasses that and leaves the summaries stale.
+*/
+template <typename Key, typename Value, typename Summary>
+class AugmentedAVLTree : public AVLTree<Key, Value>
+{
+public:
+    typedef typename Summary::value_type summary_type;
+
+    virtual ~AugmentedAVLTree();
+
+    summary_type aggregate(const Key& low, const Key& high) const;
+    summary_type total() const;
+
+    /**
+    * The AVL iterator with read-only items.
+    */
+    class iterator
+    {
+    public:
+        iterator();
+
+        const std::pair<const Key, Value>& operator*() const;
+        const std::pair<const Key, Value>* operator->() const;
+
+        bool operator==(const iterator& rhs) const;
+        bool operator!=(const iterator& rhs) const;
+
+        iterator& operator++();
+        iterator operator+(std::ptrdiff_t k) const;
+        iterator operator-(std::ptrdiff_t k) const;
+        iterator& operator+=(std::ptrdiff_t k);
+        iterator& operator-=(std::ptrdiff_t k);
+
+    protected:
+        friend class AugmentedAVLTree<Key, Value, Summary>;
+        explicit iterator(const typename AVLTree<Key, Value>::iterator& it);
+
+        typename AVLTree<Key, Value>::iterator it_;
+    };
+
+    /**
+    * A pair of read-only iterators over a key range.
+    */
+    class range_view
+    {
+    public:
+        range_view(iterator first, iterator last);
+
+        iterator begin() const;
+        iterator end() const;
+        bool empty() const;
+
+    private:
+        iterator first_;
+        iterator last_;
+    };
+
+    // the lookups of AVLTree, with read-only items
+    iterator begin() const;
+    iterator end() const;
+    iterator find(const Key& key) const;
+    iterator lower_bound(const Key& key) const;
+    iterator upper_bound(const Key& key) const;
+    std::pair<iterator, iterator> equal_range(const Key& key) const;
+    range_view range(const Key& low, const Key& high) const;
+    iterator select(size_t index) const;
+    void findBatch(const Key* keys, size_t n, iterator* out) const;
+    Value const & operator[](const Key& key) const;
+
+    // the insertions of AVLTree, returning read-only iterators
+    template<typename P>
+    typename std::enable_if<std::is_constructible<std::pair<Key, Value>, P&&>::value, std::pair<iterator, bool> >::type
+    insert(P&& keyValuePair);
+    iterator insert(iterator hint, const std::pair<const Key, Value>& keyValuePair);
+    template<typename... Args>
+    std::pair<iterator, bool> emplace(Args&&... args);
+    template<typename... Args>
+    iterator emplace_hint(iterator hint, Args&&... args);
+    template<typename K, typename... Args>
+    std::pair<iterator, bool> try_emplace(K&& key, Args&&... args);
+    template<typename K, typename M>
+    std::pair<iterator, bool> insert_or_assign(K&& key, M&& value);
+
+    // the parallel scans of AVLTree, passing read-only items
+    template<typename Function>
+    void parallel_for_each(Function fn, unsigned threads = 0) const;
+    template<typename T, typename Map, typename Combine>
+    T parallel_reduce(T init, Map map, Combine combine, unsigned threads = 0) const;
+
+protected:
+    typedef AugmentedAVLNode<Key, Value, Summary> AugmentedNode;
+    typedef typename AVLTree<Key, Value>::iterator BaseIterator;
+
+    iterator wrap(const typename BinarySearchTree<Key, Value>::iterator& it) const;
+
+    static summary_type summaryOf(AVLNode<Key, Value>* node);
+    static summary_type suffixFrom(AVLNode<Key, Value>* node, const Key& low);
+    static summary_type prefixUntil(AVLNode<Key, Value>* node, const Key& high);
+
+    virtual Node<Key, Value>* createNode(const Key& key, const Value& value, Node<Key, Value>* parent);
+    virtual Node<Key, Value>* createNode(Key&& key, Value&& value, Node<Key, Value>* parent);
+    virtual void destroyNode(Node<Key, Value>* node);
+    virtual void deferClear(Node<Key, Value>* root);
+    virtual bool trivialNodeDestruction() const;
+    virtual void pull(AVLNode<Key, Value>* node);
+    virtual void valueChanged(Node<Key, Value>* node);
+};
+
+/*
+  ---------------------------------------------------------------
+  Begin implementations for the AugmentedAVLTree::iterator class.
+  ---------------------------------------------------------------
+*/
+
+/**
+* A default constructor that initializes the iterator to NULL.
+*/
+template<class Key, class Value, class Summary>
+AugmentedAVLTree<Key, Value, Summary>::iterator::iterator()
+{
+
+}
+
+/**
+* Wraps an AVL iterator.
+*/
+template<class Key, class Value, class Summary>
+AugmentedAVLTree<Key, Value, Summary>::iterator::iterator(const typename AVLTree<Key, Value>::iterator& it) :
+    it_(it)
+{
+
+}
+
+/**
+* Returns the item, which cannot be changed through the iterator.
+*/
+template<class Key, class Value, class Summary>
+const std::pair<const Key, Value>& AugmentedAVLTree<Key, Value, Summary>::iterator::operator*() const
+{
+    return *it_;
+}
+
+/**
+* Returns a pointer to the item.
+*/
+template<class Key, class Value, class Summary>
+const std::pair<const Key, Value>* AugmentedAVLTree<Key, Value, Summary>::iterator::operator->() const
+{
+    return &*it_;
+}
+
+/**
+* Checks if 'this' iterator's internals have the same value
+* as 'rhs'
+*/
+template<class Key, class Value, class Summary>
+bool AugmentedAVLTree<Key, Value, Summary>::iterator::operator==(const iterator& rhs) const
+{
+    return it_ == rhs.it_;
+}
+
+/**
+* Checks if 'this' iterator's internals have a different value
+* as 'rhs'
+*/
+template<class Key, class Value, class Summary>
+bool AugmentedAVLTree<Key, Value, Summary>::iterator::operator!=(const iterator& rhs) const
+{
+    return it_ != rhs.it_;
+}
+
+/**
+* Advances the iterator's location using an in-order sequencing
+*/
+template<class Key, class Value, class Summary>
+typename AugmentedAVLTree<Key, Value, Summary>::iterator&
+AugmentedAVLTree<Key, Value, Summary>::iterator::operator++()
+{
+    ++it_;
+    return *this;
+}
+
+/**
+* Returns an iterator k items further on; see AVLTree::iterator.
+*/
+template<class Key, class Value, class Summary>
+typename AugmentedAVLTree<Key, Value, Summary>::iterator
+AugmentedAVLTree<Key, Value, Summary>::iterator::operator+(std::ptrdiff_t k) const
+{
+    return iterator(it_ + k);
+}
+
+/**
+* Returns an iterator k items back.
+*/
+template<class Key, class Value, class Summary>
+typename AugmentedAVLTree<Key, Value, Summary>::iterator
+AugmentedAVLTree<Key, Value, Summary>::iterator::operator-(std::ptrdiff_t k) const
+{
+    return iterator(it_ - k);
+}
+
+/**
+* Moves the iterator k items forward.
+*/
+template<class Key, class Value, class Summary>
+typename AugmentedAVLTree<Key, Value, Summary>::iterator&
+AugmentedAVLTree<Key, Value, Summary>::iterator::operator+=(std::ptrdiff_t k)
+{
+    it_ += k;
+    return *this;
+}
+
+/**
+* Moves the iterator k items back.
+*/
+template<class Key, class Value, class Summary>
+typename AugmentedAVLTree<Key, Value, Summary>::iterator&
+AugmentedAVLTree<Key, Value, Summary>::iterator::operator-=(std::ptrdiff_t k)
+{
+    it_ -= k;
+    return *this;
+}
+
+/*
+  -------------------------------------------------------------
+  End implementations for the AugmentedAVLTree::iterator class.
+  -------------------------------------------------------------
+*/
+
+/**
+* Makes a view of [first, last).
+*/
+template<class Key, class Value, class Summary>
+AugmentedAVLTree<Key, Value, Summary>::range_view::range_view(iterator first, iterator last) :
+    first_(first),
+    last_(last)
+{
+
+}
+
+/**
+* Returns an iterator to the first item of the range.
+*/
+template<class Key, class Value, class Summary>
+typename AugmentedAVLTree<Key, Value, Summary>::iterator
+AugmentedAVLTree<Key, Value, Summary>::range_view::begin() const
+{
+    return first_;
+}
+
+/**
+* Returns an iterator just past the last item of the range.
+*/
+template<class Key, class Value, class Summary>
+typename AugmentedAVLTree<Key, Value, Summary>::iterator
+AugmentedAVLTree<Key, Value, Summary>::range_view::end() const
+{
+    return last_;
+}
+
+/**
+* Returns true if the range holds no items.
+*/
+template<class Key, class Value, class Summary>
+bool AugmentedAVLTree<Key, Value, Summary>::range_view::empty() const
+{
+    return first_ == last_;
+}
+
+/*
+  -----------------------------------------------------
+  Begin implementations for the AugmentedAVLTree class.
+  -----------------------------------------------------
+*/
+
+/**
+* Destructor, which frees the nodes while destroyNode() still
+* resolves to the AugmentedAVLNode version.
+*/
+template<class Key, class Value, class Summary>
+AugmentedAVLTree<Key, Value, Summary>::~AugmentedAVLTree()
+{
+    this->clear();
+}
+
+/**
+* Returns the summary of all items with low <= key < high, combined in
+* key order. O(log n): below the node where the searches for low and
+* high part ways, whole subtrees are taken from their stored summaries.
+*/
+template<class Key, class Value, class Summary>
+typename AugmentedAVLTree<Key, Value, Summary>::summary_type
+AugmentedAVLTree<Key, Value, Summary>::aggregate(const Key& low, const Key& high) const
+{
+    AVLNode<Key, Value>* current = static_cast<AVLNode<Key, Value>*>(this->root_);
+
+    // find the node where the searches for low and high part ways
+    while(current != nullptr) {
+        if(current->getKey() < low) {
+            current = current->getRight();
+        }
+        else if(!(current->getKey() < high)) {
+            current = current->getLeft();
+        }
+        else {
+            break;
+        }
+    }
+    if(current == nullptr) {
+        return Summary::identity();
+    }
+
+    summary_type item = Summary::lift(current->getKey(), current->getValue());
+    return Summary::combine(suffixFrom(current->getLeft(), low),
+                            Summary::combine(item, prefixUntil(current->getRight(), high)));
+}
+
+/**
+* Returns the summary of the whole tree in O(1).
+*/
+template<class Key, class Value, class Summary>
+typename AugmentedAVLTree<Key, Value, Summary>::summary_type
+AugmentedAVLTree<Key, Value, Summary>::total() const
+{
+    return summaryOf(static_cast<AVLNode<Key, Value>*>(this->root_));
+}
+
+/**
+* Returns an iterator to the smallest item.
+*/
+template<class Key, class Value, class Summary>
+typename AugmentedAVLTree<Key, Value, Summary>::iterator
+AugmentedAVLTree<Key, Value, Summary>::begin() const
+{
+    return iterator(AVLTree<Key, Value>::begin());
+}
+
+/**
+* Returns an iterator past the largest item.
+*/
+template<class Key, class Value, class Summary>
+typename AugmentedAVLTree<Key, Value, Summary>::iterator
+AugmentedAVLTree<Key, Value, Summary>::end() const
+{
+    return iterator(AVLTree<Key, Value>::end());
+}
+
+/**
+* Returns an iterator to the item with key, or end().
+*/
+template<class Key, class Value, class Summary>
+typename AugmentedAVLTree<Key, Value, Summary>::iterator
+AugmentedAVLTree<Key, Value, Summary>::find(const Key& key) const
+{
+    return iterator(AVLTree<Key, Value>::find(key));
+}
+
+/**
+* Returns an iterator to the first item whose key is not less than key.
+*/
+template<class Key, class Value, class Summary>
+typename AugmentedAVLTree<Key, Value, Summary>::iterator
+AugmentedAVLTree<Key, Value, Summary>::lower_bound(const Key& key) const
+{
+    return iterator(AVLTree<Key, Value>::lower_bound(key));
+}
+
+/**
+* Returns an iterator to the first item whose key is greater than key.
+*/
+template<class Key, class Value, class Summary>
+typename AugmentedAVLTree<Key, Value, Summary>::iterator
+AugmentedAVLTree<Key, Value, Summary>::upper_bound(const Key& key) const
+{
+    return iterator(AVLTree<Key, Value>::upper_bound(key));
+}
+
+/**
+* Returns the range of items with key: empty, or the one item.
+*/
+template<class Key, class Value, class Summary>
+std::pair<typename AugmentedAVLTree<Key, Value, Summary>::iterator, typename AugmentedAVLTree<Key, Value, Summary>::iterator>
+AugmentedAVLTree<Key, Value, Summary>::equal_range(const Key& key) const
+{
+    std::pair<typename BinarySearchTree<Key, Value>::iterator, typename BinarySearchTree<Key, Value>::iterator> found =
+        AVLTree<Key, Value>::equal_range(key);
+    return std::make_pair(wrap(found.first), wrap(found.second));
+}
+
+/**
+* Returns the items with low <= key < high.
+*/
+template<class Key, class Value, class Summary>
+typename AugmentedAVLTree<Key, Value, Summary>::range_view
+AugmentedAVLTree<Key, Value, Summary>::range(const Key& low, const Key& high) const
+{
+    if(!(low < high)) {
+        return range_view(end(), end());
+    }
+    return range_view(lower_bound(low), lower_bound(high));
+}
+
+/**
+* Returns an iterator to the item at 0-based position index, or end().
+*/
+template<class Key, class Value, class Summary>
+typename AugmentedAVLTree<Key, Value, Summary>::iterator
+AugmentedAVLTree<Key, Value, Summary>::select(size_t index) const
+{
+    return iterator(AVLTree<Key, Value>::select(index));
+}
+
+/**
+* findBatch() of AVLTree, a chunk at a time.
+*/
+template<class Key, class Value, class Summary>
+void AugmentedAVLTree<Key, Value, Summary>::findBatch(const Key* keys, size_t n, iterator* out) const
+{
+    BaseIterator found[BinarySearchTree<Key, Value>::batchWidth];
+    for(size_t base = 0; base < n; base += BinarySearchTree<Key, Value>::batchWidth) {
+        size_t width = std::min(n - base, BinarySearchTree<Key, Value>::batchWidth);
+        AVLTree<Key, Value>::findBatch(keys + base, width, found);
+        for(size_t i = 0; i < width; ++i) {
+            out[base + i] = iterator(found[i]);
+        }
+    }
+}
+
+/**
+ * @precondition The key exists in the map
+ * Returns the value associated with the key, read-only; change it with
+ * insert_or_assign(). Missing keys throw std::out_of_range whatever
+ * setInsertOnMissing() says.
+*/
+template<class Key, class Value, class Summary>
+Value const & AugmentedAVLTree<Key, Value, Summary>::operator[](const Key& key) const
+{
+    Node<Key, Value>* node = this->internalFind(key);
+    if(node == nullptr) throw std::out_of_range("Invalid key");
+    return node->getValue();
+}
+
+/**
+* insert() of AVLTree: an existing key has its value overwritten.
+*/
+template<class Key, class Value, class Summary>
+template<typename P>
+typename std::enable_if<std::is_constructible<std::pair<Key, Value>, P&&>::value,
+                        std::pair<typename AugmentedAVLTree<Key, Value, Summary>::iterator, bool> >::type
+AugmentedAVLTree<Key, Value, Summary>::insert(P&& keyValuePair)
+{
+    std::pair<typename BinarySearchTree<Key, Value>::iterator, bool> placed = AVLTree<Key, Value>::insert(std::forward<P>(keyValuePair));
+    return std::make_pair(wrap(placed.first), placed.second);
+}
+
+/**
+* Hinted insert() of AVLTree.
+*/
+template<class Key, class Value, class Summary>
+typename AugmentedAVLTree<Key, Value, Summary>::iterator
+AugmentedAVLTree<Key, Value, Summary>::insert(iterator hint, const std::pair<const Key, Value>& keyValuePair)
+{
+    return wrap(AVLTree<Key, Value>::insert(hint.it_, keyValuePair));
+}
+
+/**
+* emplace() of AVLTree.
+*/
+template<class Key, class Value, class Summary>
+template<typename... Args>
+std::pair<typename AugmentedAVLTree<Key, Value, Summary>::iterator, bool>
+AugmentedAVLTree<Key, Value, Summary>::emplace(Args&&... args)
+{
+    std::pair<typename BinarySearchTree<Key, Value>::iterator, bool> placed = AVLTree<Key, Value>::emplace(std::forward<Args>(args)...);
+    return std::make_pair(wrap(placed.first), placed.second);
+}
+
+/**
+* emplace_hint() of AVLTree.
+*/
+template<class Key, class Value, class Summary>
+template<typename... Args>
+typename AugmentedAVLTree<Key, Value, Summary>::iterator
+AugmentedAVLTree<Key, Value, Summary>::emplace_hint(iterator hint, Args&&... args)
+{
+    return wrap(AVLTree<Key, Value>::emplace_hint(hint.it_, std::forward<Args>(args)...));
+}
+
+/**
+* try_emplace() of AVLTree.
+*/
+template<class Key, class Value, class Summary>
+template<typename K, typename... Args>
+std::pair<typename AugmentedAVLTree<Key, Value, Summary>::iterator, bool>
+AugmentedAVLTree<Key, Value, Summary>::try_emplace(K&& key, Args&&... args)
+{
+    std::pair<typename BinarySearchTree<Key, Value>::iterator, bool> placed =
+        AVLTree<Key, Value>::try_emplace(std::forward<K>(key), std::forward<Args>(args)...);
+    return std::make_pair(wrap(placed.first), placed.second);
+}
+
+/**
+* insert_or_assign() of AVLTree, the way to change a value in place.
+*/
+template<class Key, class Value, class Summary>
+template<typename K, typename M>
+std::pair<typename AugmentedAVLTree<Key, Value, Summary>::iterator, bool>
+AugmentedAVLTree<Key, Value, Summary>::insert_or_assign(K&& key, M&& value)
+{
+    std::pair<typename BinarySearchTree<Key, Value>::iterator, bool> placed =
+        AVLTree<Key, Value>::insert_or_assign(std::forward<K>(key), std::forward<M>(value));
+    return std::make_pair(wrap(placed.first), placed.second);
+}
+
+/**
+* parallel_for_each() of AVLTree, calling fn with const items.
+*/
+template<class Key, class Value, class Summary>
+template<typename Function>
+void AugmentedAVLTree<Key, Value, Summary>::parallel_for_each(Function fn, unsigned threads) const
+{
+    AVLTree<Key, Value>::parallel_for_each([&fn](std::pair<const Key, Value>& item) {
+        fn(static_cast<const std::pair<const Key, Value>&>(item));
+    }, threads);
+}
+
+/**
+* parallel_reduce() of AVLTree, calling map with const items.
+*/
+template<class Key, class Value, class Summary>
+template<typename T, typename Map, typename Combine>
+T AugmentedAVLTree<Key, Value, Summary>::parallel_reduce(T init, Map map, Combine combine, unsigned threads) const
+{
+    return AVLTree<Key, Value>::parallel_reduce(init, [&map](std::pair<const Key, Value>& item) {
+        return map(static_cast<const std::pair<const Key, Value>&>(item));
+    }, combine, threads);
+}
+
+/**
+* Wraps an iterator from the BST layer.
+*/
+template<class Key, class Value, class Summary>
+typename AugmentedAVLTree<Key, Value, Summary>::iterator
+AugmentedAVLTree<Key, Value, Summary>::wrap(const typename BinarySearchTree<Key, Value>::iterator& it) const
+{
+    return iterator(this->makeIterator(it));
+}
+
+/**
+* The stored summary of a subtree, identity for NULL.
+*/
+template<class Key, class Value, class Summary>
+typename AugmentedAVLTree<Key, Value, Summary>::summary_type
+AugmentedAVLTree<Key, Value, Summary>::summaryOf(AVLNode<Key, Value>* node)
+{
+    return node == nullptr ? Summary::identity() : static_cast<AugmentedNode*>(node)->getSummary();
+}
+
+/**
+* Summary of the keys >= low in the subtree at node. Walks one path,
+* collecting from right to left.
+*/
+template<class Key, class Value, class Summary>
+typename AugmentedAVLTree<Key, Value, Summary>::summary_type
+AugmentedAVLTree<Key, Value, Summary>::suffixFrom(AVLNode<Key, Value>* node, const Key& low)
+{
+    summary_type result = Summary::identity();
+    while(node != nullptr) {
+        if(node->getKey() < low) {
+            node = node->getRight();
+        }
+        else {
+            // node and its right subtree are in, and come before result
+            summary_type item = Summary::lift(node->getKey(), node->getValue());
+            result = Summary::combine(item, Summary::combine(summaryOf(node->getRight()), result));
+            node = node->getLeft();
+        }
+    }
+    return result;
+}
+
+/**
+* Summary of the keys < high in the subtree at node. Walks one path,
+* collecting from left to right.
+*/
+template<class Key, class Value, class Summary>
+typename AugmentedAVLTree<Key, Value, Summary>::summary_type
+AugmentedAVLTree<Key, Value, Summary>::prefixUntil(AVLNode<Key, Value>* node, const Key& high)
+{
+    summary_type result = Summary::identity();
+    while(node != nullptr) {
+        if(node->getKey() < high) {
+            // node and its left subtree are in, and come after result
+            summary_type item = Summary::lift(node->getKey(), node->getValue());
+            result = Summary::combine(Summary::combine(result, summaryOf(node->getLeft())), item);
+            node = node->getRight();
+        }
+        else {
+            node = node->getLeft();
+        }
+    }
+    return result;
+}
+
+/**
+* Creates an AugmentedAVLNode, through the node pool when one is enabled.
+*/
+template<class Key, class Value, class Summary>
+Node<Key, Value>* AugmentedAVLTree<Key, Value, Summary>::createNode(const Key& key, const Value& value, Node<Key, Value>* parent)
+{
+    return this->template allocNode<AugmentedNode>(key, value, static_cast<AugmentedNode*>(parent));
+}
+
+/**
+* Same as above, moving the key and value into the node.
+*/
+template<class Key, class Value, class Summary>
+Node<Key, Value>* AugmentedAVLTree<Key, Value, Summary>::createNode(Key&& key, Value&& value, Node<Key, Value>* parent)
+{
+    return this->template allocNode<AugmentedNode>(std::move(key), std::move(value), static_cast<AugmentedNode*>(parent));
+}
+
+/**
+* Destroys an AugmentedAVLNode.
+*/
+template<class Key, class Value, class Summary>
+void AugmentedAVLTree<Key, Value, Summary>::destroyNode(Node<Key, Value>* node)
+{
+    AugmentedNode* augmented = static_cast<AugmentedNode*>(node);
+    augmented->~AugmentedNode();
+    this->freeNodeMemory(augmented);
+}
+
+/**
+* Hands a detached subtree of AugmentedAVLNodes to the reclaimer.
+*/
+template<class Key, class Value, class Summary>
+void AugmentedAVLTree<Key, Value, Summary>::deferClear(Node<Key, Value>* root)
+{
+    this->template deferSubtree<AugmentedNode>(root);
+}
+
+/**
+* Nodes also hold a summary, which may need destructing.
+*/
+template<class Key, class Value, class Summary>
+bool AugmentedAVLTree<Key, Value, Summary>::trivialNodeDestruction() const
+{
+    return AVLTree<Key, Value>::trivialNodeDestruction() && std::is_trivially_destructible<summary_type>::value;
+}
+
+/**
+* Recomputes node's summary from its item and its children's summaries.
+*/
+template<class Key, class Value, class Summary>
+void AugmentedAVLTree<Key, Value, Summary>::pull(AVLNode<Key, Value>* node)
+{
+    summary_type item = Summary::lift(node->getKey(), node->getValue());
+    static_cast<AugmentedNode*>(node)->setSummary(
+        Summary::combine(Summary::combine(summaryOf(node->getLeft()), item), summaryOf(node->getRight())));
+}
+
+/**
+* An overwritten value changes the summaries on the path to the root.
+*/
+template<class Key, class Value, class Summary>
+void AugmentedAVLTree<Key, Value, Summary>::valueChanged(Node<Key, Value>* node)
+{
+    AVLNode<Key, Value>* current = static_cast<AVLNode<Key, Value>*>(node);
+    while(current != nullptr) {
+        pull(current);
+        current = current->getParent();
+    }
+}
+
+/*
+  ---------------------------------------------------
+  End implementations for the AugmentedAVLTree class.
+  ---------------------------------------------------
+*/
+
+#endif
@@ -6,14 +6,23 @@
 #include <cstdlib>
 #include <cstdint>
 #include <algorithm>
+#include <cstddef>
+#include <iterator>
+#include <stdexcept>
+#include <string>
+#include <typeinfo>
+#include <future>
+#include <thread>
+#include <vector>
 #include "bst.h"
+#include "frozenavl.h"
 
 struct KeyError { };
 
 /**
-* A special kind of node for an AVL tree, which adds the balance as a data member, plus
-* other additional helper functions. You do NOT need to implement any functionality or
-* add additional data members or helper functions.
+* A special kind of node for an AVL tree, which adds the balance and the size of the
+* subtree rooted at the node as data members, plus other additional helper functions.
+* The subtree sizes let the tree answer order-statistic queries in O(log n).
 */
 template <typename Key, typename Value>
 class AVLNode : public Node<Key, Value>
@@ -21,22 +30,29 @@ class AVLNode : public Node<Key, Value>
 public:
     // Constructor/destructor.
     AVLNode(const Key& key, const Value& value, AVLNode<Key, Value>* parent);
-    virtual ~AVLNode();
+    AVLNode(Key&& key, Value&& value, AVLNode<Key, Value>* parent);
+    ~AVLNode();
 
     // Getter/setter for the node's height.
     int8_t getBalance () const;
     void setBalance (int8_t balance);
     void updateBalance(int8_t diff);
 
+    // Getter/setter for the number of nodes in this node's subtree.
+    size_t getSize() const;
+    void setSize(size_t size);
+
     // Getters for parent, left, and right. These need to be redefined since they
-    // return pointers to AVLNodes - not plain Nodes. See the Node class in bst.h
-    // for more information.
-    virtual AVLNode<Key, Value>* getParent() const override;
-    virtual AVLNode<Key, Value>* getLeft() const override;
-    virtual AVLNode<Key, Value>* getRight() const override;
+    // return pointers to AVLNodes - not plain Nodes. They hide (rather than
+    // override) the Node versions, so the call is bound at compile time.
+    // See the Node class in bst.h for more information.
+    AVLNode<Key, Value>* getParent() const;
+    AVLNode<Key, Value>* getLeft() const;
+    AVLNode<Key, Value>* getRight() const;
 
 protected:
     int8_t balance_;    // effectively a signed char
+    size_t size_;
 };
 
 /*
@@ -50,7 +66,17 @@ protected:
 */
 template<class Key, class Value>
 AVLNode<Key, Value>::AVLNode(const Key& key, const Value& value, AVLNode<Key, Value> *parent) :
-    Node<Key, Value>(key, value, parent), balance_(0)
+    Node<Key, Value>(key, value, parent), balance_(0), size_(1)
+{
+
+}
+
+/**
+* Same as above, moving the key and value into the base class item.
+*/
+template<class Key, class Value>
+AVLNode<Key, Value>::AVLNode(Key&& key, Value&& value, AVLNode<Key, Value> *parent) :
+    Node<Key, Value>(std::move(key), std::move(value), parent), balance_(0), size_(1)
 {
 
 }
@@ -92,7 +118,25 @@ void AVLNode<Key, Value>::updateBalance(int8_t diff)
 }
 
 /**
-* An overridden function for getting the parent since a static_cast is necessary to make sure
+* A getter for the subtree size of a AVLNode.
+*/
+template<class Key, class Value>
+size_t AVLNode<Key, Value>::getSize() const
+{
+    return size_;
+}
+
+/**
+* A setter for the subtree size of a AVLNode.
+*/
+template<class Key, class Value>
+void AVLNode<Key, Value>::setSize(size_t size)
+{
+    size_ = size;
+}
+
+/**
+* A redefined getter for the parent since a static_cast is necessary to make sure
 * that our node is a AVLNode.
 */
 template<class Key, class Value>
@@ -102,7 +146,7 @@ AVLNode<Key, Value> *AVLNode<Key, Value>::getParent() const
 }
 
 /**
-* Overridden for the same reasons as above.
+* Redefined for the same reasons as above.
 */
 template<class Key, class Value>
 AVLNode<Key, Value> *AVLNode<Key, Value>::getLeft() const
@@ -111,7 +155,7 @@ AVLNode<Key, Value> *AVLNode<Key, Value>::getLeft() const
 }
 
 /**
-* Overridden for the same reasons as above.
+* Redefined for the same reasons as above.
 */
 template<class Key, class Value>
 AVLNode<Key, Value> *AVLNode<Key, Value>::getRight() const
@@ -131,8 +175,70 @@ template <class Key, class Value>
 class AVLTree : public BinarySearchTree<Key, Value>
 {
 public:
-    virtual void insert (const std::pair<const Key, Value> &new_item); // TODO
+    AVLTree();
+    template<typename ForwardIt>
+    AVLTree(ForwardIt first, ForwardIt last);
+    virtual ~AVLTree();
+
     virtual void remove(const Key& key);  // TODO
+    template<typename ForwardIt>
+    void assignSorted(ForwardIt first, ForwardIt last);
+
+    /**
+    * The BST iterator plus O(log n) random steps, which use the subtree
+    * sizes kept in every AVLNode. Iterators handed out by the tree also
+    * know the tree, so that end() - k reaches the k-th item from the back.
+    */
+    class iterator : public BinarySearchTree<Key, Value>::iterator
+    {
+    public:
+        iterator();
+        iterator(const typename BinarySearchTree<Key, Value>::iterator& it);
+
+        iterator operator+(std::ptrdiff_t k) const;
+        iterator operator-(std::ptrdiff_t k) const;
+        iterator& operator+=(std::ptrdiff_t k);
+        iterator& operator-=(std::ptrdiff_t k);
+
+    protected:
+        friend class AVLTree<Key, Value>;
+        iterator(AVLNode<Key, Value>* ptr, const AVLTree<Key, Value>* tree);
+        iterator(const typename BinarySearchTree<Key, Value>::iterator& it, const AVLTree<Key, Value>* tree);
+
+        const AVLTree<Key, Value>* tree_;
+    };
+
+    // these return the AVL iterator so that it + k works on the result
+    iterator begin() const;
+    iterator end() const;
+    iterator find(const Key& key) const;
+    iterator lower_bound(const Key& key) const;
+    iterator upper_bound(const Key& key) const;
+    void findBatch(const Key* keys, size_t n, iterator* out) const;
+
+    // order statistics
+    size_t rank(const Key& key) const;
+    iterator select(size_t index) const;
+
+    // O(log n) partitioning and concatenation
+    void split(const Key& key, AVLTree<Key, Value>& upper);
+    void join(AVLTree<Key, Value>& right);
+    void join(const Key& key, const Value& value, AVLTree<Key, Value>& right);
+
+    // set operations in O(m log(n/m + 1)) work, m <= n the smaller size;
+    // other is left empty. threads == 0 uses every hardware thread.
+    void unionWith(AVLTree<Key, Value>& other, unsigned threads = 0);
+    void intersect(AVLTree<Key, Value>& other, unsigned threads = 0);
+    void difference(AVLTree<Key, Value>& other, unsigned threads = 0);
+
+    // unsorted batch load: parallel sort, O(m) build, then a union
+    template<typename InputIt>
+    void bulkInsert(InputIt first, InputIt last, unsigned threads = 0);
+
+    // immutable copy in a contiguous, search-friendly layout, and back;
+    // avlimage.h saves and maps these as files
+    FrozenAVLTree<Key, Value> freeze() const;
+    void thaw(const FrozenAVLTree<Key, Value>& frozen);
 protected:
     virtual void nodeSwap( AVLNode<Key,Value>* n1, AVLNode<Key,Value>* n2);
 
@@ -147,68 +253,503 @@ protected:
 
     // removefix
     void fixRemove(AVLNode<Key, Value>* node, int8_t diff);
+    void detachNode(AVLNode<Key, Value>* removeNode);
+
+    // insertfix, run by the shared insert paths
+    virtual void insertFix(Node<Key, Value>* node);
+
+    // subtree sizes
+    static size_t subtreeSize(AVLNode<Key, Value>* node);
+    static void updateSize(AVLNode<Key, Value>* node);
+    void adjustPath(AVLNode<Key, Value>* node, int diff);
+    static AVLNode<Key, Value>* selectNode(AVLNode<Key, Value>* root, size_t index);
+    static AVLNode<Key, Value>* advanceNode(AVLNode<Key, Value>* node, std::ptrdiff_t k);
+
+    // split/join
+    static int heightOf(AVLNode<Key, Value>* node);
+    AVLNode<Key, Value>* joinWith(AVLNode<Key, Value>* left, int leftHeight, AVLNode<Key, Value>* mid,
+                                  AVLNode<Key, Value>* right, int rightHeight, int& height);
+    void splitNode(AVLNode<Key, Value>* node, int height, const Key& key,
+                   AVLNode<Key, Value>*& low, int& lowHeight, AVLNode<Key, Value>*& high, int& highHeight,
+                   AVLNode<Key, Value>** match = nullptr);
+    AVLNode<Key, Value>* splitLast(AVLNode<Key, Value>* node, int height, AVLNode<Key, Value>*& rest, int& restHeight);
+    AVLNode<Key, Value>* joinPair(AVLNode<Key, Value>* left, int leftHeight,
+                                  AVLNode<Key, Value>* right, int rightHeight, int& height);
+    void checkCompatible(const AVLTree<Key, Value>& other) const;
+    bool sameAllocator(const AVLTree<Key, Value>& other) const;
+    void shareAllocator(const AVLTree<Key, Value>& other);
+    void unifyAllocator(AVLTree<Key, Value>& other);
+    void reallocateFrom(AVLTree<Key, Value>& other);
+    void appendWith(AVLNode<Key, Value>* mid, AVLTree<Key, Value>& right);
+
+    // set operations
+    enum SetOp { SET_UNION, SET_INTERSECT, SET_DIFFERENCE };
+    void runSetOp(SetOp op, AVLTree<Key, Value>& other, unsigned threads);
+    void combineWith(SetOp op, AVLNode<Key, Value>* b, int bHeight, unsigned threads);
+    static int forkDepthFor(unsigned threads);
+    template<typename RandomIt>
+    static void sortByKey(RandomIt first, RandomIt last, int forkDepth);
+    AVLNode<Key, Value>* setOpNode(SetOp op, AVLNode<Key, Value>* a, int aHeight, AVLNode<Key, Value>* b, int bHeight,
+                                   int& height, std::vector<AVLNode<Key, Value>*>& discarded, int forkDepth);
+
+    // bulk load
+    template<typename ForwardIt>
+    AVLNode<Key, Value>* buildSorted(ForwardIt& it, size_t count, int& height);
+
+    // allocates/frees AVLNodes instead of plain Nodes
+    virtual Node<Key, Value>* createNode(const Key& key, const Value& value, Node<Key, Value>* parent);
+    virtual Node<Key, Value>* createNode(Key&& key, Value&& value, Node<Key, Value>* parent);
+    virtual void destroyNode(Node<Key, Value>* node);
+    virtual void deferClear(Node<Key, Value>* root);
+    virtual void checkNode(Node<Key, Value>* node, int leftHeight, int rightHeight, TreeValidation& report) const;
+
+    // wraps an iterator from the BST layer so it knows this tree
+    iterator makeIterator(const typename BinarySearchTree<Key, Value>::iterator& it) const;
+
+    // augmentation hook for derived trees
+    virtual void pull(AVLNode<Key, Value>* node);
 
 };
 
 /*
- * Recall: If key is already in the tree, you should 
- * overwrite the current value with the updated value.
- */
+-------------------------------------------------
+Begin implementations for the AVLTree::iterator class.
+-------------------------------------------------
+*/
+
+/**
+* A default constructor that initializes the iterator to NULL.
+*/
 template<class Key, class Value>
-void AVLTree<Key, Value>::insert (const std::pair<const Key, Value> &new_item)
+AVLTree<Key, Value>::iterator::iterator() :
+    tree_(nullptr)
 {
-    // TODO
 
-    // tree empty
-    if(this->root_ == nullptr) {
+}
 
-        // create new root
-        AVLNode<Key, Value>* newRoot = new AVLNode<Key, Value>(new_item.first, new_item.second, nullptr);
-        newRoot->setBalance(0);
-        this->root_ = newRoot;
-        return;
+/**
+* Converts a BST iterator over an AVLTree into an AVL iterator. It does
+* not know its tree, so stepping back from end() leaves it at end().
+*/
+template<class Key, class Value>
+AVLTree<Key, Value>::iterator::iterator(const typename BinarySearchTree<Key, Value>::iterator& it) :
+    BinarySearchTree<Key, Value>::iterator(it),
+    tree_(nullptr)
+{
+
+}
+
+/**
+* Constructor that initializes an iterator with a given node pointer and
+* the tree it belongs to.
+*/
+template<class Key, class Value>
+AVLTree<Key, Value>::iterator::iterator(AVLNode<Key, Value>* ptr, const AVLTree<Key, Value>* tree) :
+    tree_(tree)
+{
+    this->current_ = ptr;
+}
+
+/**
+* Converts a BST iterator handed out by tree.
+*/
+template<class Key, class Value>
+AVLTree<Key, Value>::iterator::iterator(const typename BinarySearchTree<Key, Value>::iterator& it, const AVLTree<Key, Value>* tree) :
+    BinarySearchTree<Key, Value>::iterator(it),
+    tree_(tree)
+{
+
+}
+
+/**
+* Returns an iterator k items further on (or back, for negative k), or
+* end() when that runs off the tree. O(log n). From end(), k < 0 selects
+* item size() + k, so end() - 1 is the last item; that needs an iterator
+* the tree handed out.
+*/
+template<class Key, class Value>
+typename AVLTree<Key, Value>::iterator
+AVLTree<Key, Value>::iterator::operator+(std::ptrdiff_t k) const
+{
+    if(this->current_ == nullptr) {
+        if(tree_ == nullptr || k >= 0 || static_cast<size_t>(-k) > tree_->size()) {
+            return *this;
+        }
+        return tree_->select(tree_->size() - static_cast<size_t>(-k));
     }
+    return iterator(advanceNode(static_cast<AVLNode<Key, Value>*>(this->current_), k), tree_);
+}
 
-    // bst isnertion
-    AVLNode<Key, Value>* parent = nullptr;
-    AVLNode<Key, Value>* current = static_cast<AVLNode<Key, Value>*>(this->root_);
+/**
+* Returns an iterator k items back.
+*/
+template<class Key, class Value>
+typename AVLTree<Key, Value>::iterator
+AVLTree<Key, Value>::iterator::operator-(std::ptrdiff_t k) const
+{
+    return *this + (-k);
+}
+
+/**
+* Moves the iterator k items forward.
+*/
+template<class Key, class Value>
+typename AVLTree<Key, Value>::iterator&
+AVLTree<Key, Value>::iterator::operator+=(std::ptrdiff_t k)
+{
+    *this = *this + k;
+    return *this;
+}
+
+/**
+* Moves the iterator k items back.
+*/
+template<class Key, class Value>
+typename AVLTree<Key, Value>::iterator&
+AVLTree<Key, Value>::iterator::operator-=(std::ptrdiff_t k)
+{
+    *this = *this + (-k);
+    return *this;
+}
+
+/*
+-------------------------------------------------
+End implementations for the AVLTree::iterator class.
+-------------------------------------------------
+*/
+
+/**
+* Default constructor, which creates an empty tree.
+*/
+template<class Key, class Value>
+AVLTree<Key, Value>::AVLTree()
+{
+
+}
+
+/**
+* Destructor, which frees the nodes while destroyNode() still
+* resolves to the AVLNode version.
+*/
+template<class Key, class Value>
+AVLTree<Key, Value>::~AVLTree()
+{
+    this->clear();
+}
+
+/**
+* Builds a perfectly balanced tree from a range of pairs sorted by
+* strictly increasing key, in O(n). See assignSorted().
+*/
+template<class Key, class Value>
+template<typename ForwardIt>
+AVLTree<Key, Value>::AVLTree(ForwardIt first, ForwardIt last)
+{
+    assignSorted(first, last);
+}
+
+/**
+* Replaces the contents of the tree with the pairs in [first, last),
+* which must be sorted by strictly increasing key. The tree is built
+* bottom-up in O(n) with its balance factors set directly, so no
+* comparisons beyond the order check and no rotations are needed.
+* Throws std::invalid_argument (leaving the tree empty) if the range
+* is not strictly increasing.
+*/
+template<class Key, class Value>
+template<typename ForwardIt>
+void AVLTree<Key, Value>::assignSorted(ForwardIt first, ForwardIt last)
+{
+    this->clear();
+
+    // check the order up front so a bad range never leaves a half-built tree
+    if(first != last) {
+        ForwardIt prev = first;
+        for(ForwardIt it = std::next(first); it != last; ++it, ++prev) {
+            if(!(prev->first < it->first)) {
+                throw std::invalid_argument("assignSorted requires strictly increasing keys");
+            }
+        }
+    }
+
+    int height = 0;
+    ForwardIt it = first;
+    size_t count = static_cast<size_t>(std::distance(first, last));
+    this->root_ = buildSorted(it, count, height);
+    this->rightmost_ = this->getLargestNode();
+    this->count_ = count;
+}
+
+/**
+* Builds a balanced subtree out of the next count pairs of it and
+* returns its root (with a NULL parent). height is set to the height
+* of the new subtree. The right half gets the extra node when count
+* is even, so every balance factor is 0 or +1.
+*/
+template<class Key, class Value>
+template<typename ForwardIt>
+AVLNode<Key, Value>* AVLTree<Key, Value>::buildSorted(ForwardIt& it, size_t count, int& height)
+{
+    if(count == 0) {
+        height = 0;
+        return nullptr;
+    }
+
+    size_t leftCount = (count - 1) / 2;
+    int leftHeight = 0;
+    int rightHeight = 0;
+
+    // in-order: left subtree, then this node, then the right subtree
+    AVLNode<Key, Value>* left = buildSorted(it, leftCount, leftHeight);
+    AVLNode<Key, Value>* node = nullptr;
+    AVLNode<Key, Value>* right = nullptr;
+    try {
+        node = static_cast<AVLNode<Key, Value>*>(this->createNode(it->first, it->second, nullptr));
+        ++it;
+        right = buildSorted(it, count - 1 - leftCount, rightHeight);
+    }
+    catch(...) {
+        if(node != nullptr) {
+            this->destroyNode(node);
+        }
+        this->clearContents(left);
+        throw;
+    }
+
+    node->setLeft(left);
+    node->setRight(right);
+    if(left != nullptr) {
+        left->setParent(node);
+    }
+    if(right != nullptr) {
+        right->setParent(node);
+    }
+    node->setBalance(static_cast<int8_t>(rightHeight - leftHeight));
+    node->setSize(count);
+    pull(node);
+
+    height = 1 + std::max(leftHeight, rightHeight);
+    return node;
+}
+
+/**
+* Returns an iterator to the smallest item.
+*/
+template<class Key, class Value>
+typename AVLTree<Key, Value>::iterator AVLTree<Key, Value>::begin() const
+{
+    return iterator(BinarySearchTree<Key, Value>::begin(), this);
+}
+
+/**
+* Returns the end iterator.
+*/
+template<class Key, class Value>
+typename AVLTree<Key, Value>::iterator AVLTree<Key, Value>::end() const
+{
+    return iterator(BinarySearchTree<Key, Value>::end(), this);
+}
+
+/**
+* Returns an iterator to key, or end() if it is not in the tree.
+*/
+template<class Key, class Value>
+typename AVLTree<Key, Value>::iterator AVLTree<Key, Value>::find(const Key& key) const
+{
+    return iterator(BinarySearchTree<Key, Value>::find(key), this);
+}
+
+/**
+* Returns an iterator to the first item not less than key.
+*/
+template<class Key, class Value>
+typename AVLTree<Key, Value>::iterator AVLTree<Key, Value>::lower_bound(const Key& key) const
+{
+    return iterator(BinarySearchTree<Key, Value>::lower_bound(key), this);
+}
+
+/**
+* Returns an iterator to the first item greater than key.
+*/
+template<class Key, class Value>
+typename AVLTree<Key, Value>::iterator AVLTree<Key, Value>::upper_bound(const Key& key) const
+{
+    return iterator(BinarySearchTree<Key, Value>::upper_bound(key), this);
+}
+
+/**
+* Looks up keys[0..n) in lock-step and stores find(keys[i]) in out[i].
+*/
+template<class Key, class Value>
+void AVLTree<Key, Value>::findBatch(const Key* keys, size_t n, iterator* out) const
+{
+    Node<Key, Value>* found[BinarySearchTree<Key, Value>::batchWidth];
+    for(size_t base = 0; base < n; base += BinarySearchTree<Key, Value>::batchWidth) {
+        size_t width = std::min(BinarySearchTree<Key, Value>::batchWidth, n - base);
+        this->findNodes(keys + base, width, found);
+        for(size_t i = 0; i < width; ++i) {
+            out[base + i] = iterator(static_cast<AVLNode<Key, Value>*>(found[i]), this);
+        }
+    }
+}
 
+/**
+* Turns an iterator from the BST layer into an AVL iterator that knows
+* this tree, for derived trees that wrap the iterator.
+*/
+template<class Key, class Value>
+typename AVLTree<Key, Value>::iterator
+AVLTree<Key, Value>::makeIterator(const typename BinarySearchTree<Key, Value>::iterator& it) const
+{
+    return iterator(it, this);
+}
 
+/**
+* Returns the number of keys less than key, which is key's 0-based
+* position when it is in the tree. O(log n).
+*/
+template<class Key, class Value>
+size_t AVLTree<Key, Value>::rank(const Key& key) const
+{
+    size_t less = 0;
+    AVLNode<Key, Value>* current = static_cast<AVLNode<Key, Value>*>(this->root_);
     while(current != nullptr) {
-        
-        // set 
-        parent = current;
-        
-        if(new_item.first < current->getKey()){
+        if(current->getKey() < key) {
+            // everything on the left and the node itself are smaller
+            less += subtreeSize(current->getLeft()) + 1;
+            current = current->getRight();
+        }
+        else {
             current = current->getLeft();
         }
+    }
+    return less;
+}
+
+/**
+* Returns an iterator to the item at 0-based position index in key
+* order, or end() if index >= size(). O(log n).
+*/
+template<class Key, class Value>
+typename AVLTree<Key, Value>::iterator AVLTree<Key, Value>::select(size_t index) const
+{
+    return iterator(selectNode(static_cast<AVLNode<Key, Value>*>(this->root_), index), this);
+}
+
+/**
+* Size of the subtree at node, 0 for NULL.
+*/
+template<class Key, class Value>
+size_t AVLTree<Key, Value>::subtreeSize(AVLNode<Key, Value>* node)
+{
+    return node == nullptr ? 0 : node->getSize();
+}
+
+/**
+* Recomputes node's subtree size from its children.
+*/
+template<class Key, class Value>
+void AVLTree<Key, Value>::updateSize(AVLNode<Key, Value>* node)
+{
+    node->setSize(1 + subtreeSize(node->getLeft()) + subtreeSize(node->getRight()));
+}
+
+/**
+* Adds diff to the subtree size of node and all of its ancestors, and
+* refreshes any augmented data along the way.
+*/
+template<class Key, class Value>
+void AVLTree<Key, Value>::adjustPath(AVLNode<Key, Value>* node, int diff)
+{
+    while(node != nullptr) {
+        node->setSize(node->getSize() + diff);
+        pull(node);
+        node = node->getParent();
+    }
+}
+
+/**
+* Recomputes per-subtree data kept by derived trees from node's children.
+* Called whenever a subtree's contents or shape change. A plain AVLTree
+* keeps nothing beyond the sizes, so there is nothing to do.
+*/
+template<class Key, class Value>
+void AVLTree<Key, Value>::pull(AVLNode<Key, Value>* node)
+{
+
+}
 
-        else if(new_item.first > current->getKey()){
+/**
+* Returns the node at 0-based position index within the subtree at root.
+*/
+template<class Key, class Value>
+AVLNode<Key, Value>* AVLTree<Key, Value>::selectNode(AVLNode<Key, Value>* root, size_t index)
+{
+    AVLNode<Key, Value>* current = root;
+    while(current != nullptr) {
+        size_t leftSize = subtreeSize(current->getLeft());
+        if(index < leftSize) {
+            current = current->getLeft();
+        }
+        else if(index == leftSize) {
+            return current;
+        }
+        else {
+            index -= leftSize + 1;
             current = current->getRight();
         }
+    }
+    return nullptr;
+}
 
-        else { 
-            // key exists
-            current->setValue(new_item.second);
-            return;
-        }
+/**
+* Returns the node k positions after node (before, for negative k), or
+* NULL if that is outside the tree. Climbs to the root to find node's
+* position, then selects the target from there.
+*/
+template<class Key, class Value>
+AVLNode<Key, Value>* AVLTree<Key, Value>::advanceNode(AVLNode<Key, Value>* node, std::ptrdiff_t k)
+{
+    if(node == nullptr) {
+        return nullptr;
     }
 
-    // make node child of parent
-    AVLNode<Key, Value>* newChild = new AVLNode<Key, Value>(new_item.first, new_item.second, parent);
-    if(new_item.first < parent->getKey()){
-        parent->setLeft(newChild);
+    size_t position = subtreeSize(node->getLeft());
+    AVLNode<Key, Value>* root = node;
+    while(root->getParent() != nullptr) {
+        AVLNode<Key, Value>* parent = root->getParent();
+        if(root == parent->getRight()) {
+            position += subtreeSize(parent->getLeft()) + 1;
+        }
+        root = parent;
     }
-    else{
-        parent->setRight(newChild);
+
+    if(k < 0 && static_cast<size_t>(-k) > position) {
+        return nullptr;
     }
-    newChild->setBalance(0);
+    return selectNode(root, position + k);
+}
+
+/*
+ * Called by the shared insert paths once the new leaf is linked in.
+ * Walks up updating balances and does at most one (single or double)
+ * rotation. Recall: If key is already in the tree, insert overwrites
+ * the current value and never gets here.
+ */
+template<class Key, class Value>
+void AVLTree<Key, Value>::insertFix(Node<Key, Value>* node)
+{
+    AVLNode<Key, Value>* child = static_cast<AVLNode<Key, Value>*>(node);
+    child->setBalance(0);
+    child->setSize(1);
+    pull(child);
+    adjustPath(child->getParent(), 1);
 
     // update balance
-    AVLNode<Key, Value>* balanceNode = parent;
+    AVLNode<Key, Value>* balanceNode = child->getParent();
 
     while(balanceNode != nullptr) {
-        if(new_item.first < balanceNode->getKey()){
+        if(child == balanceNode->getLeft()){
             balanceNode->updateBalance(-1);
         }
 
@@ -233,7 +774,8 @@ void AVLTree<Key, Value>::insert (const std::pair<const Key, Value> &new_item)
             break;
         }
        
-        balanceNode = static_cast<AVLNode<Key, Value>*>(balanceNode->getParent());
+        child = balanceNode;
+        balanceNode = balanceNode->getParent();
     }
 
 }
@@ -253,13 +795,23 @@ void AVLTree<Key, Value>:: remove(const Key& key)
     if(removeNode == nullptr){
         return;
     }
+    detachNode(removeNode);
+    this->destroyNode(removeNode);
+}
 
+/**
+* Unlinks removeNode from the tree and rebalances, without freeing it.
+*/
+template<class Key, class Value>
+void AVLTree<Key, Value>::detachNode(AVLNode<Key, Value>* removeNode)
+{
     // 2 children case
     if(removeNode->getLeft() != nullptr && removeNode->getRight() != nullptr) {
         // swap the node w predeccesor 
         Node<Key, Value>* pred = BinarySearchTree<Key, Value>::predecessor(removeNode);
         this->nodeSwap(removeNode, static_cast<AVLNode<Key, Value>*>(pred));
     }
+    this->unlinkBookkeeping(removeNode);
 
     // balance after removal
     int8_t change = 0;
@@ -279,7 +831,6 @@ void AVLTree<Key, Value>:: remove(const Key& key)
     // remove node
     if(removeNode->getLeft() == nullptr && removeNode->getRight() == nullptr) {
         if(removeNode == this->root_) {
-            delete this->root_;
             this->root_ = nullptr;
         } 
         else {
@@ -289,8 +840,6 @@ void AVLTree<Key, Value>:: remove(const Key& key)
             else{
                 parent->setRight(nullptr);
             }
-            
-            delete removeNode;
         }
     } 
     else if(removeNode->getLeft() == nullptr) {
@@ -310,7 +859,6 @@ void AVLTree<Key, Value>:: remove(const Key& key)
             }
             child->setParent(parent);
         }
-        delete removeNode;
     } 
     else if(removeNode->getRight() == nullptr) {
         // if only left child exist
@@ -330,29 +878,757 @@ void AVLTree<Key, Value>:: remove(const Key& key)
 
             child->setParent(parent);
         }
-        delete removeNode;
     }
 
     // removal path call for fixing
+    adjustPath(parent, -1);
     fixRemove(parent, change);
 }
 
+/**
+* Moves every item with a key >= key into upper, which must be empty,
+* keeping the smaller keys here. O(log n): the search path for key is cut
+* out and the subtrees hanging off it are joined back together on either
+* side.
+* If this tree has a node pool, upper gets a pool of its own over the same
+* slabs (NodePool::share()), so the two halves can then be used from
+* different threads like any two trees. The slabs are handed back once
+* both trees are cleared or gone; until then clear() on either one only
+* frees nodes one by one.
+*/
 template<class Key, class Value>
-void AVLTree<Key, Value>::nodeSwap( AVLNode<Key,Value>* n1, AVLNode<Key,Value>* n2)
+void AVLTree<Key, Value>::split(const Key& key, AVLTree<Key, Value>& upper)
 {
-    BinarySearchTree<Key, Value>::nodeSwap(n1, n2);
-    int8_t tempB = n1->getBalance();
-    n1->setBalance(n2->getBalance());
-    n2->setBalance(tempB);
+    if(&upper == this || !upper.empty()) {
+        throw std::logic_error("split needs a separate, empty tree");
+    }
+    checkCompatible(upper);
+    upper.shareAllocator(*this);
+
+    AVLNode<Key, Value>* root = static_cast<AVLNode<Key, Value>*>(this->root_);
+    AVLNode<Key, Value>* low = nullptr;
+    AVLNode<Key, Value>* high = nullptr;
+    int lowHeight = 0;
+    int highHeight = 0;
+    splitNode(root, heightOf(root), key, low, lowHeight, high, highHeight);
+
+    this->root_ = low;
+    this->count_ = subtreeSize(low);
+    this->rightmost_ = this->getLargestNode();
+    upper.root_ = high;
+    upper.count_ = subtreeSize(high);
+    upper.rightmost_ = upper.getLargestNode();
 }
 
-// rotate left helper
+/**
+* Appends every item of right, whose keys must all be larger than the keys
+* here, and leaves right empty. O(log n), or O(log n + size of right) if
+* right allocates its nodes elsewhere and they have to be copied over.
+* Throws std::invalid_argument if the key ranges overlap.
+*/
 template<class Key, class Value>
-AVLNode<Key, Value>* AVLTree<Key, Value>::leftRot(AVLNode<Key, Value>* node) {
-    
-    // left rotation
-    AVLNode<Key, Value>* pivot = node->getRight();
-    node->setRight(pivot->getLeft());
+void AVLTree<Key, Value>::join(AVLTree<Key, Value>& right)
+{
+    if(&right == this) {
+        throw std::logic_error("cannot join a tree with itself");
+    }
+    checkCompatible(right);
+    if(right.empty()) {
+        return;
+    }
+    if(!this->empty() && !(this->rightmost_->getKey() < right.getSmallestNode()->getKey())) {
+        throw std::invalid_argument("join needs every key on the left to be smaller than every key on the right");
+    }
+
+    unifyAllocator(right);
+
+    // right's smallest node becomes the separator
+    AVLNode<Key, Value>* mid = static_cast<AVLNode<Key, Value>*>(right.getSmallestNode());
+    right.detachNode(mid);
+    appendWith(mid, right);
+}
+
+/**
+* Appends a new item (key, value) followed by every item of right, and
+* leaves right empty. Needs every key here < key < every key in right,
+* otherwise throws std::invalid_argument. O(log n), plus the size of
+* right if its nodes have to be copied over as for join(right).
+*/
+template<class Key, class Value>
+void AVLTree<Key, Value>::join(const Key& key, const Value& value, AVLTree<Key, Value>& right)
+{
+    if(&right == this) {
+        throw std::logic_error("cannot join a tree with itself");
+    }
+    checkCompatible(right);
+    if((!this->empty() && !(this->rightmost_->getKey() < key)) ||
+       (!right.empty() && !(key < right.getSmallestNode()->getKey()))) {
+        throw std::invalid_argument("join needs left keys < key < right keys");
+    }
+    unifyAllocator(right);
+
+    appendWith(static_cast<AVLNode<Key, Value>*>(this->createNode(key, value, nullptr)), right);
+}
+
+/**
+* Trees can only trade nodes if they build the same node type. Trees with
+* different allocators are brought onto one by unifyAllocator().
+*/
+template<class Key, class Value>
+void AVLTree<Key, Value>::checkCompatible(const AVLTree<Key, Value>& other) const
+{
+    if(typeid(*this) != typeid(other)) {
+        throw std::logic_error("split/join needs trees of the same type");
+    }
+}
+
+/**
+* Gets other onto this tree's allocator before its nodes move here: an
+* empty tree adopts other's allocator instead, and if the two differ
+* other's nodes are rebuilt with reallocateFrom(), which is O(n) in the
+* size of other rather than O(log n).
+*/
+template<class Key, class Value>
+void AVLTree<Key, Value>::unifyAllocator(AVLTree<Key, Value>& other)
+{
+    if(other.empty()) {
+        return;
+    }
+    if(this->empty()) {
+        shareAllocator(other);
+    }
+    else if(!sameAllocator(other)) {
+        reallocateFrom(other);
+    }
+}
+
+/**
+* Copies other's items into a balanced tree of nodes made by this tree's
+* createNode(), frees the originals on other's own allocator with clear(),
+* and hangs the copies under other, switched over to this tree's
+* allocator. other is unchanged if a copy cannot be made.
+*/
+template<class Key, class Value>
+void AVLTree<Key, Value>::reallocateFrom(AVLTree<Key, Value>& other)
+{
+    int height = 0;
+    size_t count = other.size();
+    iterator it = other.begin();
+    AVLNode<Key, Value>* copy = buildSorted(it, count, height);
+
+    other.clear();
+    other.shareAllocator(*this);
+    other.root_ = copy;
+    other.count_ = count;
+    other.rightmost_ = other.getLargestNode();
+}
+
+/**
+* True if nodes can move between this tree and other: neither uses a node
+* pool, or their pools share slabs.
+*/
+template<class Key, class Value>
+bool AVLTree<Key, Value>::sameAllocator(const AVLTree<Key, Value>& other) const
+{
+    if(this->pool_ == nullptr || other.pool_ == nullptr) {
+        return this->pool_ == other.pool_;
+    }
+    return this->pool_->sharesSlabsWith(*other.pool_);
+}
+
+/**
+* Switches this empty tree over to allocating from other's slabs, through
+* a pool of its own, or to plain new/delete if other has no pool.
+*/
+template<class Key, class Value>
+void AVLTree<Key, Value>::shareAllocator(const AVLTree<Key, Value>& other)
+{
+    if(other.pool_ == nullptr) {
+        this->pool_.reset();
+    }
+    else if(this->pool_ == nullptr || !this->pool_->sharesSlabsWith(*other.pool_)) {
+        this->pool_ = other.pool_->share();
+    }
+}
+
+/**
+* Makes this tree (this) + mid + right, and empties right.
+*/
+template<class Key, class Value>
+void AVLTree<Key, Value>::appendWith(AVLNode<Key, Value>* mid, AVLTree<Key, Value>& right)
+{
+    AVLNode<Key, Value>* leftRoot = static_cast<AVLNode<Key, Value>*>(this->root_);
+    AVLNode<Key, Value>* rightRoot = static_cast<AVLNode<Key, Value>*>(right.root_);
+    int height = 0;
+    AVLNode<Key, Value>* root = joinWith(leftRoot, heightOf(leftRoot), mid, rightRoot, heightOf(rightRoot), height);
+    root->setParent(nullptr);
+
+    this->root_ = root;
+    this->rightmost_ = right.rightmost_ != nullptr ? right.rightmost_ : mid;
+    this->count_ = subtreeSize(root);
+    right.root_ = nullptr;
+    right.rightmost_ = nullptr;
+    right.count_ = 0;
+}
+
+/**
+* Height of the subtree at node, read off the balance factors along one
+* path in O(log n).
+*/
+template<class Key, class Value>
+int AVLTree<Key, Value>::heightOf(AVLNode<Key, Value>* node)
+{
+    int height = 0;
+    while(node != nullptr) {
+        ++height;
+        node = node->getBalance() < 0 ? node->getLeft() : node->getRight();
+    }
+    return height;
+}
+
+/**
+* Joins the subtrees left and right (all keys smaller and larger than
+* mid's, respectively) with the single node mid between them, and returns
+* the new root with its height in height. Walks down the spine of the
+* taller side until the heights are within one, hangs mid there, and
+* rebalances on the way back up, so it costs O(|leftHeight - rightHeight|).
+* The roots of left and right must have no parent.
+*/
+template<class Key, class Value>
+AVLNode<Key, Value>* AVLTree<Key, Value>::joinWith(AVLNode<Key, Value>* left, int leftHeight, AVLNode<Key, Value>* mid,
+                                                   AVLNode<Key, Value>* right, int rightHeight, int& height)
+{
+    if(leftHeight > rightHeight + 1) {
+        // go down the right spine of left
+        int outerHeight = leftHeight - (left->getBalance() <= 0 ? 1 : 2);
+        int innerHeight = leftHeight - (left->getBalance() >= 0 ? 1 : 2);
+        int subHeight = 0;
+        AVLNode<Key, Value>* sub = joinWith(left->getRight(), innerHeight, mid, right, rightHeight, subHeight);
+        left->setRight(sub);
+        sub->setParent(left);
+        left->setBalance(subHeight - outerHeight);
+        updateSize(left);
+        pull(left);
+        if(left->getBalance() < 2) {
+            height = 1 + std::max(outerHeight, subHeight);
+            return left;
+        }
+        // sub grew to outerHeight + 2; a rotation brings the total back
+        // to outerHeight + 2, or + 3 if the new root is left leaning
+        AVLNode<Key, Value>* top = rebalance(left);
+        height = outerHeight + 2 + (top->getBalance() != 0 ? 1 : 0);
+        return top;
+    }
+    if(rightHeight > leftHeight + 1) {
+        // go down the left spine of right
+        int outerHeight = rightHeight - (right->getBalance() >= 0 ? 1 : 2);
+        int innerHeight = rightHeight - (right->getBalance() <= 0 ? 1 : 2);
+        int subHeight = 0;
+        AVLNode<Key, Value>* sub = joinWith(left, leftHeight, mid, right->getLeft(), innerHeight, subHeight);
+        right->setLeft(sub);
+        sub->setParent(right);
+        right->setBalance(outerHeight - subHeight);
+        updateSize(right);
+        pull(right);
+        if(right->getBalance() > -2) {
+            height = 1 + std::max(outerHeight, subHeight);
+            return right;
+        }
+        AVLNode<Key, Value>* top = rebalance(right);
+        height = outerHeight + 2 + (top->getBalance() != 0 ? 1 : 0);
+        return top;
+    }
+
+    // close enough in height, mid becomes their parent
+    mid->setParent(nullptr);
+    mid->setLeft(left);
+    mid->setRight(right);
+    if(left != nullptr) {
+        left->setParent(mid);
+    }
+    if(right != nullptr) {
+        right->setParent(mid);
+    }
+    mid->setBalance(rightHeight - leftHeight);
+    updateSize(mid);
+    pull(mid);
+    height = 1 + std::max(leftHeight, rightHeight);
+    return mid;
+}
+
+/**
+* Splits the subtree at node (of the given height) into the keys < key,
+* returned in low, and the keys >= key, returned in high. Each node on the
+* search path is joined with the subtrees on its side of the cut. The
+* joins get taller as the recursion unwinds, so their costs add up to
+* O(log n) overall. If match is given, a node with key itself is left out
+* of both halves and returned there instead.
+*/
+template<class Key, class Value>
+void AVLTree<Key, Value>::splitNode(AVLNode<Key, Value>* node, int height, const Key& key,
+                                    AVLNode<Key, Value>*& low, int& lowHeight, AVLNode<Key, Value>*& high, int& highHeight,
+                                    AVLNode<Key, Value>** match)
+{
+    if(node == nullptr) {
+        low = high = nullptr;
+        lowHeight = highHeight = 0;
+        return;
+    }
+
+    int leftHeight = height - (node->getBalance() <= 0 ? 1 : 2);
+    int rightHeight = height - (node->getBalance() >= 0 ? 1 : 2);
+    AVLNode<Key, Value>* left = node->getLeft();
+    AVLNode<Key, Value>* right = node->getRight();
+    if(left != nullptr) {
+        left->setParent(nullptr);
+    }
+    if(right != nullptr) {
+        right->setParent(nullptr);
+    }
+
+    if(node->getKey() < key) {
+        // node and its left subtree stay low
+        AVLNode<Key, Value>* rightLow = nullptr;
+        int rightLowHeight = 0;
+        splitNode(right, rightHeight, key, rightLow, rightLowHeight, high, highHeight, match);
+        low = joinWith(left, leftHeight, node, rightLow, rightLowHeight, lowHeight);
+        low->setParent(nullptr);
+    }
+    else if(match != nullptr && !(key < node->getKey())) {
+        // node holds key, its subtrees already are the two halves
+        node->setLeft(nullptr);
+        node->setRight(nullptr);
+        *match = node;
+        low = left;
+        lowHeight = leftHeight;
+        high = right;
+        highHeight = rightHeight;
+    }
+    else {
+        // node and its right subtree go high
+        AVLNode<Key, Value>* leftHigh = nullptr;
+        int leftHighHeight = 0;
+        splitNode(left, leftHeight, key, low, lowHeight, leftHigh, leftHighHeight, match);
+        high = joinWith(leftHigh, leftHighHeight, node, right, rightHeight, highHeight);
+        high->setParent(nullptr);
+    }
+}
+
+/**
+* Removes the largest node from the subtree at node (of the given height)
+* and returns it, with what is left in rest. O(log n).
+*/
+template<class Key, class Value>
+AVLNode<Key, Value>* AVLTree<Key, Value>::splitLast(AVLNode<Key, Value>* node, int height,
+                                                    AVLNode<Key, Value>*& rest, int& restHeight)
+{
+    int leftHeight = height - (node->getBalance() <= 0 ? 1 : 2);
+    int rightHeight = height - (node->getBalance() >= 0 ? 1 : 2);
+    AVLNode<Key, Value>* left = node->getLeft();
+    AVLNode<Key, Value>* right = node->getRight();
+    if(left != nullptr) {
+        left->setParent(nullptr);
+    }
+    if(right == nullptr) {
+        rest = left;
+        restHeight = leftHeight;
+        return node;
+    }
+
+    right->setParent(nullptr);
+    AVLNode<Key, Value>* rightRest = nullptr;
+    int rightRestHeight = 0;
+    AVLNode<Key, Value>* last = splitLast(right, rightHeight, rightRest, rightRestHeight);
+    rest = joinWith(left, leftHeight, node, rightRest, rightRestHeight, restHeight);
+    rest->setParent(nullptr);
+    return last;
+}
+
+/**
+* joinWith() without a separator: the largest node of left takes its place.
+*/
+template<class Key, class Value>
+AVLNode<Key, Value>* AVLTree<Key, Value>::joinPair(AVLNode<Key, Value>* left, int leftHeight,
+                                                   AVLNode<Key, Value>* right, int rightHeight, int& height)
+{
+    if(left == nullptr) {
+        height = rightHeight;
+        return right;
+    }
+    if(right == nullptr) {
+        height = leftHeight;
+        return left;
+    }
+    AVLNode<Key, Value>* rest = nullptr;
+    int restHeight = 0;
+    AVLNode<Key, Value>* last = splitLast(left, leftHeight, rest, restHeight);
+    return joinWith(rest, restHeight, last, right, rightHeight, height);
+}
+
+/**
+* Adds every item of other, taking other's value for keys in both trees.
+*/
+template<class Key, class Value>
+void AVLTree<Key, Value>::unionWith(AVLTree<Key, Value>& other, unsigned threads)
+{
+    runSetOp(SET_UNION, other, threads);
+}
+
+/**
+* Keeps only the items whose keys are also in other.
+*/
+template<class Key, class Value>
+void AVLTree<Key, Value>::intersect(AVLTree<Key, Value>& other, unsigned threads)
+{
+    runSetOp(SET_INTERSECT, other, threads);
+}
+
+/**
+* Removes every item whose key is in other.
+*/
+template<class Key, class Value>
+void AVLTree<Key, Value>::difference(AVLTree<Key, Value>& other, unsigned threads)
+{
+    runSetOp(SET_DIFFERENCE, other, threads);
+}
+
+/**
+* Takes other apart and combines it into this tree with combineWith().
+*/
+template<class Key, class Value>
+void AVLTree<Key, Value>::runSetOp(SetOp op, AVLTree<Key, Value>& other, unsigned threads)
+{
+    if(&other == this) {
+        throw std::logic_error("set operations need two different trees");
+    }
+    checkCompatible(other);
+    unifyAllocator(other);
+
+    AVLNode<Key, Value>* b = static_cast<AVLNode<Key, Value>*>(other.root_);
+    other.root_ = nullptr;
+    other.rightmost_ = nullptr;
+    other.count_ = 0;
+    combineWith(op, b, heightOf(b), threads);
+}
+
+/**
+* Combines the detached subtree b (built from this tree's allocator) into
+* this tree with setOpNode() and frees the nodes that did not make it
+* into the result. The recursion forks onto new threads for the first
+* log2(threads) levels.
+*/
+template<class Key, class Value>
+void AVLTree<Key, Value>::combineWith(SetOp op, AVLNode<Key, Value>* b, int bHeight, unsigned threads)
+{
+    // the root is cleared first, so rotations on the pieces never
+    // mistake one for the tree's root while the recursion runs
+    AVLNode<Key, Value>* a = static_cast<AVLNode<Key, Value>*>(this->root_);
+    int aHeight = heightOf(a);
+    this->root_ = nullptr;
+
+    std::vector<AVLNode<Key, Value>*> discarded;
+    int height = 0;
+    AVLNode<Key, Value>* root = setOpNode(op, a, aHeight, b, bHeight, height, discarded, forkDepthFor(threads));
+    if(root != nullptr) {
+        root->setParent(nullptr);
+    }
+    this->root_ = root;
+    this->count_ = subtreeSize(root);
+    this->rightmost_ = this->getLargestNode();
+
+    for(size_t i = 0; i < discarded.size(); ++i) {
+        this->clearContents(discarded[i]);
+    }
+}
+
+/**
+* How many levels of a fork-join recursion to run in parallel so that
+* about threads tasks are busy. threads == 0 means every hardware thread.
+*/
+template<class Key, class Value>
+int AVLTree<Key, Value>::forkDepthFor(unsigned threads)
+{
+    if(threads == 0) {
+        threads = std::max(1u, std::thread::hardware_concurrency());
+    }
+    int forkDepth = 0;
+    while((1u << forkDepth) < threads) {
+        ++forkDepth;
+    }
+    return forkDepth;
+}
+
+/**
+* Inserts every pair of [first, last), in any order, overwriting the
+* values of keys already in the tree. When a key shows up more than
+* once in the range the last pair wins, as with a loop of insert() calls.
+* The batch is stably sorted in parallel and deduplicated, built into a
+* balanced subtree in O(m), and merged in with the union step of
+* unionWith(): O(m log(n/m + 1)) instead of m separate inserts.
+*/
+template<class Key, class Value>
+template<typename InputIt>
+void AVLTree<Key, Value>::bulkInsert(InputIt first, InputIt last, unsigned threads)
+{
+    std::vector<std::pair<Key, Value> > items(first, last);
+    if(items.empty()) {
+        return;
+    }
+    sortByKey(items.begin(), items.end(), forkDepthFor(threads));
+
+    // keep only the last pair of every run of equal keys
+    size_t kept = 0;
+    for(size_t i = 0; i < items.size(); ++i) {
+        if(i + 1 < items.size() && !(items[i].first < items[i + 1].first)) {
+            continue;
+        }
+        if(kept != i) {
+            items[kept] = std::move(items[i]);
+        }
+        ++kept;
+    }
+    items.erase(items.begin() + kept, items.end());
+
+    int height = 0;
+    typename std::vector<std::pair<Key, Value> >::iterator it = items.begin();
+    AVLNode<Key, Value>* batch = buildSorted(it, items.size(), height);
+    combineWith(SET_UNION, batch, height, threads);
+}
+
+/**
+* Returns a read-only copy of the tree whose keys are stored in
+* Eytzinger order, built in O(n) from one in-order walk. Later changes
+* to this tree do not show up in the copy.
+*/
+template<class Key, class Value>
+FrozenAVLTree<Key, Value> AVLTree<Key, Value>::freeze() const
+{
+    return FrozenAVLTree<Key, Value>(begin(), this->size());
+}
+
+/**
+* Replaces the contents with the items of frozen, which come out of it
+* in key order, built into a balanced tree in O(n) with no comparisons
+* or rotations.
+*/
+template<class Key, class Value>
+void AVLTree<Key, Value>::thaw(const FrozenAVLTree<Key, Value>& frozen)
+{
+    this->clear();
+    int height = 0;
+    typename FrozenAVLTree<Key, Value>::iterator it = frozen.begin();
+    this->root_ = buildSorted(it, frozen.size(), height);
+    this->rightmost_ = this->getLargestNode();
+    this->count_ = frozen.size();
+}
+
+/**
+* Stable merge sort of [first, last) by key. The two halves are sorted
+* in parallel for the first forkDepth levels, then merged in place.
+*/
+template<class Key, class Value>
+template<typename RandomIt>
+void AVLTree<Key, Value>::sortByKey(RandomIt first, RandomIt last, int forkDepth)
+{
+    // below this many items a new thread costs more than it saves
+    const std::ptrdiff_t parallelGrain = 65536;
+
+    typedef typename std::iterator_traits<RandomIt>::value_type Item;
+    struct KeyLess
+    {
+        bool operator()(const Item& a, const Item& b) const
+        {
+            return a.first < b.first;
+        }
+    };
+
+    if(forkDepth == 0 || last - first < parallelGrain) {
+        std::stable_sort(first, last, KeyLess());
+        return;
+    }
+    RandomIt middle = first + (last - first) / 2;
+    std::future<void> leftTask = std::async(std::launch::async, [=]() {
+        sortByKey(first, middle, forkDepth - 1);
+    });
+    sortByKey(middle, last, forkDepth - 1);
+    leftTask.get();
+    std::inplace_merge(first, middle, last, KeyLess());
+}
+
+/**
+* The recursive step shared by the set operations: splits a by the root
+* of b, combines the matching halves (in parallel while forkDepth > 0 and
+* the subtrees are big enough), and joins the two results back together.
+* Subtrees and nodes that drop out are collected in discarded, to be
+* freed afterwards by the calling thread.
+*/
+template<class Key, class Value>
+AVLNode<Key, Value>* AVLTree<Key, Value>::setOpNode(SetOp op, AVLNode<Key, Value>* a, int aHeight, AVLNode<Key, Value>* b, int bHeight,
+                                                    int& height, std::vector<AVLNode<Key, Value>*>& discarded, int forkDepth)
+{
+    // below this many items a new thread costs more than it saves
+    const size_t parallelGrain = 4096;
+
+    if(a == nullptr || b == nullptr) {
+        if(op == SET_UNION) {
+            height = a != nullptr ? aHeight : bHeight;
+            return a != nullptr ? a : b;
+        }
+        if(b != nullptr) {
+            discarded.push_back(b);
+        }
+        if(op == SET_DIFFERENCE) {
+            height = aHeight;
+            return a;
+        }
+        if(a != nullptr) {
+            discarded.push_back(a);
+        }
+        height = 0;
+        return nullptr;
+    }
+
+    bool fork = forkDepth > 0 && subtreeSize(a) + subtreeSize(b) >= parallelGrain;
+
+    // take b apart at its root and cut a at the same key
+    int bLeftHeight = bHeight - (b->getBalance() <= 0 ? 1 : 2);
+    int bRightHeight = bHeight - (b->getBalance() >= 0 ? 1 : 2);
+    AVLNode<Key, Value>* bLeft = b->getLeft();
+    AVLNode<Key, Value>* bRight = b->getRight();
+    if(bLeft != nullptr) {
+        bLeft->setParent(nullptr);
+    }
+    if(bRight != nullptr) {
+        bRight->setParent(nullptr);
+    }
+    b->setLeft(nullptr);
+    b->setRight(nullptr);
+
+    AVLNode<Key, Value>* aLeft = nullptr;
+    AVLNode<Key, Value>* aRight = nullptr;
+    AVLNode<Key, Value>* match = nullptr;
+    int aLeftHeight = 0;
+    int aRightHeight = 0;
+    splitNode(a, aHeight, b->getKey(), aLeft, aLeftHeight, aRight, aRightHeight, &match);
+
+    AVLNode<Key, Value>* left = nullptr;
+    AVLNode<Key, Value>* right = nullptr;
+    int leftHeight = 0;
+    int rightHeight = 0;
+    if(fork) {
+        std::vector<AVLNode<Key, Value>*> leftDiscarded;
+        std::future<AVLNode<Key, Value>*> leftTask = std::async(std::launch::async, [&]() {
+            return this->setOpNode(op, aLeft, aLeftHeight, bLeft, bLeftHeight, leftHeight, leftDiscarded, forkDepth - 1);
+        });
+        right = setOpNode(op, aRight, aRightHeight, bRight, bRightHeight, rightHeight, discarded, forkDepth - 1);
+        left = leftTask.get();
+        discarded.insert(discarded.end(), leftDiscarded.begin(), leftDiscarded.end());
+    }
+    else {
+        left = setOpNode(op, aLeft, aLeftHeight, bLeft, bLeftHeight, leftHeight, discarded, 0);
+        right = setOpNode(op, aRight, aRightHeight, bRight, bRightHeight, rightHeight, discarded, 0);
+    }
+
+    AVLNode<Key, Value>* root = nullptr;
+    if(op == SET_UNION) {
+        // b's item wins over a's
+        if(match != nullptr) {
+            discarded.push_back(match);
+        }
+        root = joinWith(left, leftHeight, b, right, rightHeight, height);
+    }
+    else {
+        discarded.push_back(b);
+        if(op == SET_INTERSECT && match != nullptr) {
+            root = joinWith(left, leftHeight, match, right, rightHeight, height);
+        }
+        else {
+            if(match != nullptr) {
+                discarded.push_back(match);
+            }
+            root = joinPair(left, leftHeight, right, rightHeight, height);
+        }
+    }
+    if(root != nullptr) {
+        root->setParent(nullptr);
+    }
+    return root;
+}
+
+template<class Key, class Value>
+void AVLTree<Key, Value>::nodeSwap( AVLNode<Key,Value>* n1, AVLNode<Key,Value>* n2)
+{
+    BinarySearchTree<Key, Value>::nodeSwap(n1, n2);
+    int8_t tempB = n1->getBalance();
+    n1->setBalance(n2->getBalance());
+    n2->setBalance(tempB);
+    size_t tempS = n1->getSize();
+    n1->setSize(n2->getSize());
+    n2->setSize(tempS);
+}
+
+/**
+* Creates an AVLNode, through the node pool when one is enabled.
+*/
+template<class Key, class Value>
+Node<Key, Value>* AVLTree<Key, Value>::createNode(const Key& key, const Value& value, Node<Key, Value>* parent)
+{
+    return this->template allocNode<AVLNode<Key, Value> >(key, value, static_cast<AVLNode<Key, Value>*>(parent));
+}
+
+/**
+* Same as above, moving the key and value into the node.
+*/
+template<class Key, class Value>
+Node<Key, Value>* AVLTree<Key, Value>::createNode(Key&& key, Value&& value, Node<Key, Value>* parent)
+{
+    return this->template allocNode<AVLNode<Key, Value> >(std::move(key), std::move(value), static_cast<AVLNode<Key, Value>*>(parent));
+}
+
+/**
+* Destroys an AVLNode. Nodes have no virtual destructor, so the
+* static type has to be restored here.
+*/
+template<class Key, class Value>
+void AVLTree<Key, Value>::destroyNode(Node<Key, Value>* node)
+{
+    AVLNode<Key, Value>* avlNode = static_cast<AVLNode<Key, Value>*>(node);
+    avlNode->~AVLNode();
+    this->freeNodeMemory(avlNode);
+}
+
+/**
+* validate() hook: the stored balance must be the right height minus the
+* left height, and the stored size one more than the children's sizes.
+*/
+template<class Key, class Value>
+void AVLTree<Key, Value>::checkNode(Node<Key, Value>* node, int leftHeight, int rightHeight, TreeValidation& report) const
+{
+    AVLNode<Key, Value>* avlNode = static_cast<AVLNode<Key, Value>*>(node);
+    if(avlNode->getBalance() != rightHeight - leftHeight){
+        ++report.balanceMismatches;
+    }
+    if(avlNode->getSize() != 1 + subtreeSize(avlNode->getLeft()) + subtreeSize(avlNode->getRight())){
+        ++report.sizeMismatches;
+    }
+}
+
+/**
+* Hands a detached subtree of AVLNodes to the reclaimer.
+*/
+template<class Key, class Value>
+void AVLTree<Key, Value>::deferClear(Node<Key, Value>* root)
+{
+    this->template deferSubtree<AVLNode<Key, Value> >(root);
+}
+
+// rotate left helper
+template<class Key, class Value>
+AVLNode<Key, Value>* AVLTree<Key, Value>::leftRot(AVLNode<Key, Value>* node) {
+    
+    // left rotation
+    AVLNode<Key, Value>* pivot = node->getRight();
+    node->setRight(pivot->getLeft());
 
 
     if(pivot->getLeft() != nullptr){
@@ -360,8 +1636,11 @@ AVLNode<Key, Value>* AVLTree<Key, Value>::leftRot(AVLNode<Key, Value>* node) {
     }
     pivot->setParent(node->getParent());
 
+    // detached subtrees (split/join) have no parent either, but are not the root
     if(node->getParent() == nullptr){
-        this->root_ = pivot;
+        if(node == this->root_){
+            this->root_ = pivot;
+        }
     }
     else if(node == node->getParent()->getLeft()){
         node->getParent()->setLeft(pivot);
@@ -373,9 +1652,14 @@ AVLNode<Key, Value>* AVLTree<Key, Value>::leftRot(AVLNode<Key, Value>* node) {
     pivot->setLeft(node);
     node->setParent(pivot);
     
-    // fix
-    balanceCheck(node);
-    balanceCheck(pivot);
+    // fix balances in O(1) from the old ones
+    int8_t nodeBalance = node->getBalance() - 1 - std::max<int8_t>(pivot->getBalance(), 0);
+    node->setBalance(nodeBalance);
+    pivot->setBalance(pivot->getBalance() - 1 + std::min<int8_t>(nodeBalance, 0));
+    updateSize(node);
+    updateSize(pivot);
+    pull(node);
+    pull(pivot);
 
     return pivot;
 }
@@ -395,7 +1679,9 @@ AVLNode<Key, Value>* AVLTree<Key, Value>::rightRot(AVLNode<Key, Value>* node) {
     pivot->setParent(node->getParent());
     
     if(node->getParent() == nullptr){
-        this->root_ = pivot;
+        if(node == this->root_){
+            this->root_ = pivot;
+        }
     }
 
     else if(node == node->getParent()->getRight()){
@@ -411,9 +1697,14 @@ AVLNode<Key, Value>* AVLTree<Key, Value>::rightRot(AVLNode<Key, Value>* node) {
     // parent
     node->setParent(pivot);
     
-    // resest balances
-    balanceCheck(node);
-    balanceCheck(pivot);
+    // resest balances in O(1) from the old ones
+    int8_t nodeBalance = node->getBalance() + 1 - std::min<int8_t>(pivot->getBalance(), 0);
+    node->setBalance(nodeBalance);
+    pivot->setBalance(pivot->getBalance() + 1 + std::max<int8_t>(nodeBalance, 0));
+    updateSize(node);
+    updateSize(pivot);
+    pull(node);
+    pull(pivot);
    
     return pivot;
 }
@@ -492,31 +1783,4 @@ void AVLTree<Key, Value>::fixRemove(AVLNode<Key, Value>* node, int8_t diff) {
 }
 
 
-// bug fixing, more helpers
-template<class Key, class Value>
-int avlHeight(AVLNode<Key, Value>* node) {
-
-    // null check
-    if(node == nullptr){
-        return 0;
-    } 
-
-    // add 1
-    return 1 + std::max(avlHeight(node->getLeft()), avlHeight(node->getRight()));
-}
-
-template<class Key, class Value>
-void balanceCheck(AVLNode<Key, Value>* node) {
-    
-    // null check
-    if(node == nullptr){
-        return;
-    } 
-
-    int heightLeft= avlHeight(node->getLeft());
-    int heightRight = avlHeight(node->getRight());
-
-    node->setBalance(static_cast<int8_t>(heightRight - heightLeft));
-}
-
 #endif
@@ -0,0 +1,226 @@
+#ifndef AVLIMAGE_H
+#define AVLIMAGE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "avlbst.h"
+#include "frozenavl.h"
+
+/*
+* Binary images of AVLTree and FrozenAVLTree, for trivially copyable keys
+* and values, kept out of avlbst.h and frozenavl.h because they need
+* POSIX file mapping.
+*
+* An image holds the arrays of a FrozenAVLTree as they are: a 64-byte
+* header followed by the key array and the value array, each starting on
+* a 64-byte boundary. So openMappedImage() can search an image straight
+* from a read-only mapping, with no parsing or copying, and loadImage()
+* rebuilds an AVLTree from it in O(n). The header records a format
+* version, the byte order, the key and value sizes and a checksum of
+* everything after it, so a stale, foreign or damaged image is rejected
+* instead of misread.
+*/
+
+/**
+* The first 64 bytes of an image file.
+*/
+struct AVLImageHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t byteOrder;
+    uint64_t count;
+    uint32_t keySize;
+    uint32_t valueSize;
+    uint64_t keysOffset;
+    uint64_t valuesOffset;
+    uint64_t fileSize;
+    uint64_t checksum;
+};
+
+/**
+* Unmaps an image once the last tree viewing it is gone.
+*/
+struct AVLImageUnmapper
+{
+    size_t bytes;
+    void operator()(const void* addr) const { munmap(const_cast<void*>(addr), bytes); }
+};
+
+/**
+* A 64-bit FNV-style checksum taken a word at a time, fast enough to
+* verify an image at close to memory speed. It catches damage, not
+* tampering.
+*/
+inline uint64_t imageChecksum(const unsigned char* data, size_t bytes)
+{
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    size_t i = 0;
+    for(; i + 8 <= bytes; i += 8) {
+        uint64_t word;
+        std::memcpy(&word, data + i, 8);
+        hash = (hash ^ word) * 0x100000001b3ULL;
+        hash ^= hash >> 29;
+    }
+    for(; i < bytes; ++i) {
+        hash = (hash ^ data[i]) * 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+/**
+* Fills in everything but the checksum of the header for an image of
+* count items with keys and values of the given sizes.
+*/
+inline void layoutImage(size_t count, size_t keySize, size_t valueSize, AVLImageHeader& header)
+{
+    static_assert(sizeof(AVLImageHeader) == 64, "the image header is 64 bytes");
+    std::memset(&header, 0, sizeof(header));
+    std::memcpy(header.magic, "AVLIMAGE", sizeof(header.magic));
+    header.version = 1;
+    header.byteOrder = 0x01020304;
+    header.count = count;
+    header.keySize = static_cast<uint32_t>(keySize);
+    header.valueSize = static_cast<uint32_t>(valueSize);
+    header.keysOffset = sizeof(AVLImageHeader);
+    uint64_t keysEnd = header.keysOffset + (count + 1) * static_cast<uint64_t>(keySize);
+    header.valuesOffset = (keysEnd + 63) / 64 * 64;
+    header.fileSize = header.valuesOffset + (count + 1) * static_cast<uint64_t>(valueSize);
+}
+
+/**
+* Writes count items, in increasing key order, from first to path as an
+* image. The arrays are filled in place in a mapping of a temporary file,
+* which is synced and then renamed over path, so a crash never leaves a
+* half-written image under that name.
+*/
+template<class Key, class Value, typename InputIt>
+void writeImage(const std::string& path, InputIt first, size_t count)
+{
+    static_assert(std::is_trivially_copyable<Key>::value && std::is_trivially_copyable<Value>::value,
+                  "tree images need trivially copyable keys and values");
+
+    AVLImageHeader header;
+    layoutImage(count, sizeof(Key), sizeof(Value), header);
+    size_t bytes = static_cast<size_t>(header.fileSize);
+    std::string temporary = path + ".tmp";
+
+    int fd = open(temporary.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if(fd < 0) throw std::runtime_error("cannot create " + temporary);
+    // the file starts out zero-filled, padding included
+    void* addr = ftruncate(fd, static_cast<off_t>(bytes)) == 0
+        ? mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0) : MAP_FAILED;
+    close(fd);
+    if(addr == MAP_FAILED) {
+        unlink(temporary.c_str());
+        throw std::runtime_error("cannot write " + temporary);
+    }
+
+    unsigned char* base = static_cast<unsigned char*>(addr);
+    bool synced = false;
+    try {
+        FrozenAVLTree<Key, Value>::fillArrays(first, count, reinterpret_cast<Key*>(base + header.keysOffset),
+                                              reinterpret_cast<Value*>(base + header.valuesOffset));
+        header.checksum = imageChecksum(base + sizeof(header), bytes - sizeof(header));
+        std::memcpy(base, &header, sizeof(header));
+        synced = msync(addr, bytes, MS_SYNC) == 0;
+    }
+    catch(...) {
+        munmap(addr, bytes);
+        unlink(temporary.c_str());
+        throw;
+    }
+    munmap(addr, bytes);
+    if(!synced || std::rename(temporary.c_str(), path.c_str()) != 0) {
+        unlink(temporary.c_str());
+        throw std::runtime_error("cannot write " + path);
+    }
+}
+
+/**
+* Writes the items of tree to path as an image, straight from one
+* in-order walk.
+*/
+template<class Key, class Value>
+void saveImage(const AVLTree<Key, Value>& tree, const std::string& path)
+{
+    writeImage<Key, Value>(path, tree.begin(), tree.size());
+}
+
+/**
+* Writes the items of a frozen tree to path as an image.
+*/
+template<class Key, class Value>
+void saveImage(const FrozenAVLTree<Key, Value>& tree, const std::string& path)
+{
+    writeImage<Key, Value>(path, tree.begin(), tree.size());
+}
+
+/**
+* Maps the image at path read-only and returns a tree that searches it
+* in place. Pages are read in as lookups touch them, so opening costs
+* little beyond checking the header and, when verify is set, reading the
+* file once for the checksum. Throws std::runtime_error if the file
+* cannot be read or is not a valid image for these Key and Value types.
+*/
+template<class Key, class Value>
+FrozenAVLTree<Key, Value> openMappedImage(const std::string& path, bool verify = true)
+{
+    static_assert(std::is_trivially_copyable<Key>::value && std::is_trivially_copyable<Value>::value,
+                  "mapped images need trivially copyable keys and values");
+
+    int fd = open(path.c_str(), O_RDONLY);
+    if(fd < 0) throw std::runtime_error("cannot open " + path);
+    struct stat info;
+    if(fstat(fd, &info) != 0 || static_cast<size_t>(info.st_size) < sizeof(AVLImageHeader)) {
+        close(fd);
+        throw std::runtime_error(path + " is not a tree image");
+    }
+    size_t bytes = static_cast<size_t>(info.st_size);
+    void* addr = mmap(nullptr, bytes, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if(addr == MAP_FAILED) throw std::runtime_error("cannot map " + path);
+    std::shared_ptr<const void> mapping(addr, AVLImageUnmapper{bytes});
+
+    const unsigned char* base = static_cast<const unsigned char*>(addr);
+    AVLImageHeader header;
+    std::memcpy(&header, base, sizeof(header));
+    AVLImageHeader expected;
+    layoutImage(static_cast<size_t>(header.count), sizeof(Key), sizeof(Value), expected);
+    if(std::memcmp(header.magic, expected.magic, sizeof(header.magic)) != 0 ||
+       header.version != expected.version || header.byteOrder != expected.byteOrder ||
+       header.keySize != expected.keySize || header.valueSize != expected.valueSize ||
+       header.keysOffset != expected.keysOffset || header.valuesOffset != expected.valuesOffset ||
+       header.fileSize != expected.fileSize || header.fileSize != bytes) {
+        throw std::runtime_error(path + " is not a tree image for these key and value types");
+    }
+    if(verify && imageChecksum(base + sizeof(header), bytes - sizeof(header)) != header.checksum) {
+        throw std::runtime_error(path + " is corrupt (checksum mismatch)");
+    }
+
+    return FrozenAVLTree<Key, Value>(mapping, reinterpret_cast<const Key*>(base + header.keysOffset),
+                                     reinterpret_cast<const Value*>(base + header.valuesOffset),
+                                     static_cast<size_t>(header.count));
+}
+
+/**
+* Replaces the contents of tree with the image at path. The image is
+* validated before the tree is touched, then built into it with thaw().
+*/
+template<class Key, class Value>
+void loadImage(AVLTree<Key, Value>& tree, const std::string& path)
+{
+    tree.thaw(openMappedImage<Key, Value>(path));
+}
+
+#endif
@@ -0,0 +1,835 @@
+#ifndef BPLUSTREE_H
+#define BPLUSTREE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <stdexcept>
+#include <utility>
+#include "keysearch.h"
+
+/**
+* A B+ tree with the same interface as BinarySearchTree, so that code can
+* switch engines by changing the type.
+*
+* Nodes are sized to about NodeBytes bytes: inner nodes hold a sorted
+* array of separator keys and the child pointers between them, leaves
+* hold sorted key and value arrays and are chained left to right for
+* iteration. A lookup touches one node per level, and a level holds
+* dozens of keys instead of one, so searches take a few cache misses
+* where a binary tree takes one per key compared.
+*
+* Keys and values live in plain arrays, so both must be default
+* constructible and move assignable. Iterators hand out
+* std::pair<const Key&, Value&> proxies, which support it->first,
+* it->second and conversion to std::pair<const Key, Value>. Any insert or
+* remove invalidates iterators.
+*/
+template <typename Key, typename Value, size_t NodeBytes = 256>
+class BPlusTree
+{
+protected:
+    struct NodeBase
+    {
+        bool leaf;
+        uint16_t count;
+    };
+
+    // how many entries fit in a node of about NodeBytes bytes, at least 4
+    static constexpr size_t fit(size_t bytes, size_t entry)
+    {
+        return bytes / entry < 4 ? 4 : (bytes / entry > 65535 ? 65535 : bytes / entry);
+    }
+
+public:
+    static constexpr size_t leafCapacity = fit(NodeBytes - sizeof(NodeBase) - sizeof(void*), sizeof(Key) + sizeof(Value));
+    static constexpr size_t innerCapacity = fit(NodeBytes - sizeof(NodeBase) - sizeof(void*), sizeof(Key) + sizeof(void*));
+
+    typedef std::pair<const Key&, Value&> reference;
+
+    BPlusTree();
+    ~BPlusTree();
+
+    class iterator;
+
+    std::pair<iterator, bool> insert(const std::pair<const Key, Value>& keyValuePair);
+    void remove(const Key& key);
+    void clear();
+    bool isBalanced() const;
+    bool empty() const;
+    size_t size() const;
+    int height() const;
+
+    /**
+    * A forward iterator over the items in key order, walking the chain
+    * of leaves.
+    */
+    class iterator
+    {
+    public:
+        /**
+        * What operator-> returns: holds the proxy pair so that
+        * it->first and it->second work.
+        */
+        class pointer
+        {
+        public:
+            explicit pointer(const reference& item) : item_(item) { }
+            const reference* operator->() const { return &item_; }
+
+        private:
+            reference item_;
+        };
+
+        iterator();
+
+        reference operator*() const;
+        pointer operator->() const;
+
+        bool operator==(const iterator& rhs) const;
+        bool operator!=(const iterator& rhs) const;
+
+        iterator& operator++();
+
+    protected:
+        friend class BPlusTree<Key, Value, NodeBytes>;
+        iterator(typename BPlusTree<Key, Value, NodeBytes>::Leaf* leaf, size_t index);
+
+        typename BPlusTree<Key, Value, NodeBytes>::Leaf* leaf_;
+        size_t index_;
+    };
+
+    iterator begin() const;
+    iterator end() const;
+    iterator find(const Key& key) const;
+    iterator lower_bound(const Key& key) const;
+    Value& operator[](const Key& key);
+    Value const & operator[](const Key& key) const;
+
+protected:
+    struct Leaf : NodeBase
+    {
+        Key keys[leafCapacity];
+        Value values[leafCapacity];
+        Leaf* next;
+    };
+
+    struct Inner : NodeBase
+    {
+        Key keys[innerCapacity];
+        NodeBase* children[innerCapacity + 1];
+    };
+
+    // deep enough for any tree that fits in memory (fanout is at least 4)
+    static const int maxHeight = 40;
+
+    /**
+    * The inner nodes on the way down to a leaf, and the child slot taken
+    * at each of them.
+    */
+    struct Path
+    {
+        Inner* nodes[maxHeight];
+        size_t slots[maxHeight];
+        int depth;
+    };
+
+    static size_t keyLowerBound(const Key* keys, size_t count, const Key& key);
+    static size_t keyUpperBound(const Key* keys, size_t count, const Key& key);
+    Leaf* findLeaf(const Key& key, Path* path) const;
+
+    void insertIntoInner(Path& path, Key separator, NodeBase* right);
+    void fixUnderflow(Path& path, NodeBase* node);
+    bool checkSubtree(const NodeBase* node, int depth, const Key* low, const Key* high,
+                      const Leaf*& chain, size_t& items) const;
+    void destroy(NodeBase* node);
+
+    static size_t minLeafCount();
+    static size_t minInnerCount();
+
+private:
+    BPlusTree(const BPlusTree&);
+    BPlusTree& operator=(const BPlusTree&);
+
+protected:
+    NodeBase* root_;
+    Leaf* leftmost_;
+    size_t count_;
+    int height_;
+};
+
+template <typename Key, typename Value, size_t NodeBytes>
+constexpr size_t BPlusTree<Key, Value, NodeBytes>::leafCapacity;
+template <typename Key, typename Value, size_t NodeBytes>
+constexpr size_t BPlusTree<Key, Value, NodeBytes>::innerCapacity;
+
+/*
+  --------------------------------------------------------
+  Begin implementations for the BPlusTree::iterator class.
+  --------------------------------------------------------
+*/
+
+/**
+* A default constructor that initializes the iterator to NULL.
+*/
+template<class Key, class Value, size_t NodeBytes>
+BPlusTree<Key, Value, NodeBytes>::iterator::iterator() :
+    leaf_(nullptr),
+    index_(0)
+{
+
+}
+
+/**
+* Initialize the internal members of the iterator
+*/
+template<class Key, class Value, size_t NodeBytes>
+BPlusTree<Key, Value, NodeBytes>::iterator::iterator(Leaf* leaf, size_t index) :
+    leaf_(leaf),
+    index_(index)
+{
+
+}
+
+/**
+* Provides access to the item.
+*/
+template<class Key, class Value, size_t NodeBytes>
+typename BPlusTree<Key, Value, NodeBytes>::reference BPlusTree<Key, Value, NodeBytes>::iterator::operator*() const
+{
+    return reference(leaf_->keys[index_], leaf_->values[index_]);
+}
+
+/**
+* Provides access to the item's members.
+*/
+template<class Key, class Value, size_t NodeBytes>
+typename BPlusTree<Key, Value, NodeBytes>::iterator::pointer BPlusTree<Key, Value, NodeBytes>::iterator::operator->() const
+{
+    return pointer(**this);
+}
+
+/**
+* Checks if 'this' iterator's internals have the same value
+* as 'rhs'
+*/
+template<class Key, class Value, size_t NodeBytes>
+bool BPlusTree<Key, Value, NodeBytes>::iterator::operator==(const iterator& rhs) const
+{
+    return leaf_ == rhs.leaf_ && index_ == rhs.index_;
+}
+
+/**
+* Checks if 'this' iterator's internals have a different value
+* as 'rhs'
+*/
+template<class Key, class Value, size_t NodeBytes>
+bool BPlusTree<Key, Value, NodeBytes>::iterator::operator!=(const iterator& rhs) const
+{
+    return !(*this == rhs);
+}
+
+/**
+* Advances the iterator's location using an in-order sequencing:
+* along the leaf, then on to the next leaf.
+*/
+template<class Key, class Value, size_t NodeBytes>
+typename BPlusTree<Key, Value, NodeBytes>::iterator& BPlusTree<Key, Value, NodeBytes>::iterator::operator++()
+{
+    if(++index_ == leaf_->count) {
+        leaf_ = leaf_->next;
+        index_ = 0;
+    }
+    return *this;
+}
+
+/*
+  ------------------------------------------------------
+  End implementations for the BPlusTree::iterator class.
+  ------------------------------------------------------
+*/
+
+/*
+  -----------------------------------------------
+  Begin implementations for the BPlusTree class.
+  -----------------------------------------------
+*/
+
+/**
+* Default constructor for an empty tree.
+*/
+template<class Key, class Value, size_t NodeBytes>
+BPlusTree<Key, Value, NodeBytes>::BPlusTree() :
+    root_(nullptr),
+    leftmost_(nullptr),
+    count_(0),
+    height_(0)
+{
+
+}
+
+/**
+* Destructor, which frees every node.
+*/
+template<class Key, class Value, size_t NodeBytes>
+BPlusTree<Key, Value, NodeBytes>::~BPlusTree()
+{
+    clear();
+}
+
+/**
+* Inserts keyValuePair, overwriting the value if the key is already in
+* the tree. A full leaf is split in half before the new item goes in,
+* and the new separator may split the inner nodes above it in turn.
+* Returns an iterator to the item and whether a new item was added.
+*/
+template<class Key, class Value, size_t NodeBytes>
+std::pair<typename BPlusTree<Key, Value, NodeBytes>::iterator, bool>
+BPlusTree<Key, Value, NodeBytes>::insert(const std::pair<const Key, Value>& keyValuePair)
+{
+    const Key& key = keyValuePair.first;
+    if(root_ == nullptr) {
+        Leaf* leaf = new Leaf;
+        leaf->leaf = true;
+        leaf->count = 0;
+        leaf->next = nullptr;
+        root_ = leftmost_ = leaf;
+        height_ = 1;
+    }
+
+    Path path;
+    Leaf* leaf = findLeaf(key, &path);
+    size_t pos = keyLowerBound(leaf->keys, leaf->count, key);
+    if(pos < leaf->count && !(key < leaf->keys[pos])) {
+        leaf->values[pos] = keyValuePair.second;
+        return std::make_pair(iterator(leaf, pos), false);
+    }
+
+    if(leaf->count == leafCapacity) {
+        // move the upper half to a new right sibling
+        Leaf* right = new Leaf;
+        right->leaf = true;
+        size_t keep = leafCapacity / 2;
+        for(size_t i = keep; i < leafCapacity; ++i) {
+            right->keys[i - keep] = std::move(leaf->keys[i]);
+            right->values[i - keep] = std::move(leaf->values[i]);
+        }
+        right->count = static_cast<uint16_t>(leafCapacity - keep);
+        leaf->count = static_cast<uint16_t>(keep);
+        right->next = leaf->next;
+        leaf->next = right;
+        insertIntoInner(path, right->keys[0], right);
+
+        if(pos > keep) {
+            leaf = right;
+            pos -= keep;
+        }
+    }
+
+    for(size_t i = leaf->count; i > pos; --i) {
+        leaf->keys[i] = std::move(leaf->keys[i - 1]);
+        leaf->values[i] = std::move(leaf->values[i - 1]);
+    }
+    leaf->keys[pos] = key;
+    leaf->values[pos] = keyValuePair.second;
+    ++leaf->count;
+    ++count_;
+    return std::make_pair(iterator(leaf, pos), true);
+}
+
+/**
+* Removes key if it is in the tree. A leaf left less than half full
+* borrows an item from a sibling or merges with it, which may in turn
+* leave its parent short, up to the root.
+*/
+template<class Key, class Value, size_t NodeBytes>
+void BPlusTree<Key, Value, NodeBytes>::remove(const Key& key)
+{
+    if(root_ == nullptr) {
+        return;
+    }
+    Path path;
+    Leaf* leaf = findLeaf(key, &path);
+    size_t pos = keyLowerBound(leaf->keys, leaf->count, key);
+    if(pos == leaf->count || key < leaf->keys[pos]) {
+        return;
+    }
+
+    for(size_t i = pos + 1; i < leaf->count; ++i) {
+        leaf->keys[i - 1] = std::move(leaf->keys[i]);
+        leaf->values[i - 1] = std::move(leaf->values[i]);
+    }
+    --leaf->count;
+    --count_;
+    fixUnderflow(path, leaf);
+}
+
+/**
+* A method to remove all contents of the tree and
+* reset the values in the tree for use again.
+*/
+template<class Key, class Value, size_t NodeBytes>
+void BPlusTree<Key, Value, NodeBytes>::clear()
+{
+    destroy(root_);
+    root_ = nullptr;
+    leftmost_ = nullptr;
+    count_ = 0;
+    height_ = 0;
+}
+
+/**
+* Checks the shape of the tree in O(n): every leaf sits height() levels
+* down, every node other than the root is at least minimally filled and
+* none is over capacity, keys increase within each node and stay between
+* the separators above them, and the leaf chain visits the leaves in key
+* order and holds size() items in all.
+*/
+template<class Key, class Value, size_t NodeBytes>
+bool BPlusTree<Key, Value, NodeBytes>::isBalanced() const
+{
+    if(root_ == nullptr) {
+        return count_ == 0 && height_ == 0 && leftmost_ == nullptr;
+    }
+    const Leaf* chain = leftmost_;
+    size_t items = 0;
+    return checkSubtree(root_, 1, nullptr, nullptr, chain, items) && chain == nullptr && items == count_;
+}
+
+/**
+ * Returns true if tree is empty
+*/
+template<class Key, class Value, size_t NodeBytes>
+bool BPlusTree<Key, Value, NodeBytes>::empty() const
+{
+    return root_ == nullptr;
+}
+
+/**
+ * Returns the number of items in the tree in O(1)
+*/
+template<class Key, class Value, size_t NodeBytes>
+size_t BPlusTree<Key, Value, NodeBytes>::size() const
+{
+    return count_;
+}
+
+/**
+ * Returns the number of levels, 0 when empty.
+*/
+template<class Key, class Value, size_t NodeBytes>
+int BPlusTree<Key, Value, NodeBytes>::height() const
+{
+    return height_;
+}
+
+/**
+* Returns an iterator to the smallest item.
+*/
+template<class Key, class Value, size_t NodeBytes>
+typename BPlusTree<Key, Value, NodeBytes>::iterator BPlusTree<Key, Value, NodeBytes>::begin() const
+{
+    return iterator(leftmost_, 0);
+}
+
+/**
+* Returns an iterator whose value means INVALID
+*/
+template<class Key, class Value, size_t NodeBytes>
+typename BPlusTree<Key, Value, NodeBytes>::iterator BPlusTree<Key, Value, NodeBytes>::end() const
+{
+    return iterator();
+}
+
+/**
+* Returns an iterator to the item with key, or end() if there is none.
+*/
+template<class Key, class Value, size_t NodeBytes>
+typename BPlusTree<Key, Value, NodeBytes>::iterator BPlusTree<Key, Value, NodeBytes>::find(const Key& key) const
+{
+    if(root_ == nullptr) {
+        return end();
+    }
+    Leaf* leaf = findLeaf(key, nullptr);
+    size_t pos = keyLowerBound(leaf->keys, leaf->count, key);
+    if(pos == leaf->count || key < leaf->keys[pos]) {
+        return end();
+    }
+    return iterator(leaf, pos);
+}
+
+/**
+* Returns an iterator to the first item whose key is not less than key.
+*/
+template<class Key, class Value, size_t NodeBytes>
+typename BPlusTree<Key, Value, NodeBytes>::iterator BPlusTree<Key, Value, NodeBytes>::lower_bound(const Key& key) const
+{
+    if(root_ == nullptr) {
+        return end();
+    }
+    Leaf* leaf = findLeaf(key, nullptr);
+    size_t pos = keyLowerBound(leaf->keys, leaf->count, key);
+    if(pos == leaf->count) {
+        // the separators guarantee the next leaf starts above key
+        return iterator(leaf->next, 0);
+    }
+    return iterator(leaf, pos);
+}
+
+/**
+* Returns the value stored under key, or throws std::out_of_range.
+*/
+template<class Key, class Value, size_t NodeBytes>
+Value& BPlusTree<Key, Value, NodeBytes>::operator[](const Key& key)
+{
+    iterator it = find(key);
+    if(it == end()) throw std::out_of_range("Invalid key");
+    return it->second;
+}
+template<class Key, class Value, size_t NodeBytes>
+Value const & BPlusTree<Key, Value, NodeBytes>::operator[](const Key& key) const
+{
+    iterator it = find(key);
+    if(it == end()) throw std::out_of_range("Invalid key");
+    return it->second;
+}
+
+/**
+* Index of the first of keys[0..count) that is not less than key. Integer
+* keys are searched with vector compares, see KeySearch.
+*/
+template<class Key, class Value, size_t NodeBytes>
+size_t BPlusTree<Key, Value, NodeBytes>::keyLowerBound(const Key* keys, size_t count, const Key& key)
+{
+    return KeySearch<Key>::lowerBound(keys, count, key);
+}
+
+/**
+* Index of the first of keys[0..count) that is greater than key, which
+* is also the child slot to follow in an inner node.
+*/
+template<class Key, class Value, size_t NodeBytes>
+size_t BPlusTree<Key, Value, NodeBytes>::keyUpperBound(const Key* keys, size_t count, const Key& key)
+{
+    return KeySearch<Key>::upperBound(keys, count, key);
+}
+
+/**
+* Walks down to the leaf that holds (or would hold) key, recording the
+* inner nodes and slots in path when one is given.
+*/
+template<class Key, class Value, size_t NodeBytes>
+typename BPlusTree<Key, Value, NodeBytes>::Leaf* BPlusTree<Key, Value, NodeBytes>::findLeaf(const Key& key, Path* path) const
+{
+    NodeBase* node = root_;
+    int depth = 0;
+    while(!node->leaf) {
+        Inner* inner = static_cast<Inner*>(node);
+        size_t slot = keyUpperBound(inner->keys, inner->count, key);
+        if(path != nullptr) {
+            path->nodes[depth] = inner;
+            path->slots[depth] = slot;
+        }
+        ++depth;
+        node = inner->children[slot];
+    }
+    if(path != nullptr) {
+        path->depth = depth;
+    }
+    return static_cast<Leaf*>(node);
+}
+
+/**
+* Adds separator and the new node right (holding the keys >= separator)
+* next to the child that was split, at the bottom of path. A full inner
+* node is split first and its middle key moves up a level; splitting the
+* root adds a new level.
+*/
+template<class Key, class Value, size_t NodeBytes>
+void BPlusTree<Key, Value, NodeBytes>::insertIntoInner(Path& path, Key separator, NodeBase* right)
+{
+    for(int depth = path.depth; ; --depth) {
+        if(depth == 0) {
+            Inner* root = new Inner;
+            root->leaf = false;
+            root->count = 1;
+            root->keys[0] = std::move(separator);
+            root->children[0] = root_;
+            root->children[1] = right;
+            root_ = root;
+            ++height_;
+            return;
+        }
+
+        Inner* parent = path.nodes[depth - 1];
+        size_t slot = path.slots[depth - 1];
+        Inner* target = parent;
+        Inner* sibling = nullptr;
+        Key up;
+
+        if(parent->count == innerCapacity) {
+            // keys left of mid stay, mid moves up, the rest go right
+            size_t mid = innerCapacity / 2;
+            sibling = new Inner;
+            sibling->leaf = false;
+            up = std::move(parent->keys[mid]);
+            for(size_t i = mid + 1; i < innerCapacity; ++i) {
+                sibling->keys[i - mid - 1] = std::move(parent->keys[i]);
+            }
+            for(size_t i = mid + 1; i <= innerCapacity; ++i) {
+                sibling->children[i - mid - 1] = parent->children[i];
+            }
+            sibling->count = static_cast<uint16_t>(innerCapacity - mid - 1);
+            parent->count = static_cast<uint16_t>(mid);
+            if(slot > mid) {
+                target = sibling;
+                slot -= mid + 1;
+            }
+        }
+
+        for(size_t i = target->count; i > slot; --i) {
+            target->keys[i] = std::move(target->keys[i - 1]);
+            target->children[i + 1] = target->children[i];
+        }
+        target->keys[slot] = std::move(separator);
+        target->children[slot + 1] = right;
+        ++target->count;
+
+        if(sibling == nullptr) {
+            return;
+        }
+        separator = std::move(up);
+        right = sibling;
+    }
+}
+
+/**
+* Restores the minimum fill of node, the bottom of path, after a remove:
+* borrow one entry from a sibling that can spare it, or else merge with
+* a sibling and repeat one level up, since the parent lost an entry.
+* Finally drops a root left with a single child, or an empty root leaf.
+*/
+template<class Key, class Value, size_t NodeBytes>
+void BPlusTree<Key, Value, NodeBytes>::fixUnderflow(Path& path, NodeBase* node)
+{
+    for(int depth = path.depth; depth > 0; --depth) {
+        size_t minimum = node->leaf ? minLeafCount() : minInnerCount();
+        if(node->count >= minimum) {
+            break;
+        }
+
+        Inner* parent = path.nodes[depth - 1];
+        size_t slot = path.slots[depth - 1];
+        NodeBase* left = slot > 0 ? parent->children[slot - 1] : nullptr;
+        NodeBase* right = slot < parent->count ? parent->children[slot + 1] : nullptr;
+
+        if(node->leaf) {
+            Leaf* leaf = static_cast<Leaf*>(node);
+            if(left != nullptr && left->count > minimum) {
+                Leaf* from = static_cast<Leaf*>(left);
+                for(size_t i = leaf->count; i > 0; --i) {
+                    leaf->keys[i] = std::move(leaf->keys[i - 1]);
+                    leaf->values[i] = std::move(leaf->values[i - 1]);
+                }
+                --from->count;
+                leaf->keys[0] = std::move(from->keys[from->count]);
+                leaf->values[0] = std::move(from->values[from->count]);
+                ++leaf->count;
+                parent->keys[slot - 1] = leaf->keys[0];
+                break;
+            }
+            if(right != nullptr && right->count > minimum) {
+                Leaf* from = static_cast<Leaf*>(right);
+                leaf->keys[leaf->count] = std::move(from->keys[0]);
+                leaf->values[leaf->count] = std::move(from->values[0]);
+                ++leaf->count;
+                for(size_t i = 1; i < from->count; ++i) {
+                    from->keys[i - 1] = std::move(from->keys[i]);
+                    from->values[i - 1] = std::move(from->values[i]);
+                }
+                --from->count;
+                parent->keys[slot] = from->keys[0];
+                break;
+            }
+
+            // merge the right one of the pair into the left one
+            size_t separator = left != nullptr ? slot - 1 : slot;
+            Leaf* into = static_cast<Leaf*>(left != nullptr ? left : node);
+            Leaf* from = static_cast<Leaf*>(left != nullptr ? node : right);
+            for(size_t i = 0; i < from->count; ++i) {
+                into->keys[into->count + i] = std::move(from->keys[i]);
+                into->values[into->count + i] = std::move(from->values[i]);
+            }
+            into->count = static_cast<uint16_t>(into->count + from->count);
+            into->next = from->next;
+            delete from;
+            for(size_t i = separator + 1; i < parent->count; ++i) {
+                parent->keys[i - 1] = std::move(parent->keys[i]);
+                parent->children[i] = parent->children[i + 1];
+            }
+            --parent->count;
+        }
+        else {
+            Inner* inner = static_cast<Inner*>(node);
+            if(left != nullptr && left->count > minimum) {
+                // rotate through the parent: its separator comes down,
+                // left's last key goes up
+                Inner* from = static_cast<Inner*>(left);
+                inner->children[inner->count + 1] = inner->children[inner->count];
+                for(size_t i = inner->count; i > 0; --i) {
+                    inner->keys[i] = std::move(inner->keys[i - 1]);
+                    inner->children[i] = inner->children[i - 1];
+                }
+                inner->keys[0] = std::move(parent->keys[slot - 1]);
+                inner->children[0] = from->children[from->count];
+                ++inner->count;
+                --from->count;
+                parent->keys[slot - 1] = std::move(from->keys[from->count]);
+                break;
+            }
+            if(right != nullptr && right->count > minimum) {
+                Inner* from = static_cast<Inner*>(right);
+                inner->keys[inner->count] = std::move(parent->keys[slot]);
+                inner->children[inner->count + 1] = from->children[0];
+                ++inner->count;
+                parent->keys[slot] = std::move(from->keys[0]);
+                for(size_t i = 1; i < from->count; ++i) {
+                    from->keys[i - 1] = std::move(from->keys[i]);
+                    from->children[i - 1] = from->children[i];
+                }
+                from->children[from->count - 1] = from->children[from->count];
+                --from->count;
+                break;
+            }
+
+            // merge, pulling the separator down between the two halves
+            size_t separator = left != nullptr ? slot - 1 : slot;
+            Inner* into = static_cast<Inner*>(left != nullptr ? left : node);
+            Inner* from = static_cast<Inner*>(left != nullptr ? node : right);
+            into->keys[into->count] = std::move(parent->keys[separator]);
+            for(size_t i = 0; i < from->count; ++i) {
+                into->keys[into->count + 1 + i] = std::move(from->keys[i]);
+            }
+            for(size_t i = 0; i <= from->count; ++i) {
+                into->children[into->count + 1 + i] = from->children[i];
+            }
+            into->count = static_cast<uint16_t>(into->count + 1 + from->count);
+            delete from;
+            for(size_t i = separator + 1; i < parent->count; ++i) {
+                parent->keys[i - 1] = std::move(parent->keys[i]);
+                parent->children[i] = parent->children[i + 1];
+            }
+            --parent->count;
+        }
+        node = parent;
+    }
+
+    if(!root_->leaf && root_->count == 0) {
+        Inner* old = static_cast<Inner*>(root_);
+        root_ = old->children[0];
+        delete old;
+        --height_;
+    }
+    else if(root_->leaf && root_->count == 0) {
+        delete static_cast<Leaf*>(root_);
+        root_ = nullptr;
+        leftmost_ = nullptr;
+        height_ = 0;
+    }
+}
+
+/**
+* isBalanced() for the subtree at node, depth levels down, whose keys must
+* be >= *low and < *high where given. chain is the next leaf expected on
+* the leaf chain, and items counts the items seen so far.
+*/
+template<class Key, class Value, size_t NodeBytes>
+bool BPlusTree<Key, Value, NodeBytes>::checkSubtree(const NodeBase* node, int depth, const Key* low, const Key* high,
+                                                    const Leaf*& chain, size_t& items) const
+{
+    bool root = node == root_;
+    if(node->leaf) {
+        const Leaf* leaf = static_cast<const Leaf*>(node);
+        if(depth != height_ || leaf != chain || leaf->count > leafCapacity ||
+           leaf->count < (root ? 1 : minLeafCount())) {
+            return false;
+        }
+        for(size_t i = 0; i < leaf->count; ++i) {
+            if((i > 0 && !(leaf->keys[i - 1] < leaf->keys[i])) ||
+               (low != nullptr && leaf->keys[i] < *low) ||
+               (high != nullptr && !(leaf->keys[i] < *high))) {
+                return false;
+            }
+        }
+        chain = leaf->next;
+        items += leaf->count;
+        return true;
+    }
+
+    const Inner* inner = static_cast<const Inner*>(node);
+    if(depth >= height_ || inner->count > innerCapacity || inner->count < (root ? 1 : minInnerCount())) {
+        return false;
+    }
+    for(size_t i = 0; i < inner->count; ++i) {
+        if((i > 0 && !(inner->keys[i - 1] < inner->keys[i])) ||
+           (low != nullptr && inner->keys[i] < *low) ||
+           (high != nullptr && !(inner->keys[i] < *high))) {
+            return false;
+        }
+    }
+    for(size_t i = 0; i <= inner->count; ++i) {
+        const Key* childLow = i > 0 ? &inner->keys[i - 1] : low;
+        const Key* childHigh = i < inner->count ? &inner->keys[i] : high;
+        if(inner->children[i] == nullptr ||
+           !checkSubtree(inner->children[i], depth + 1, childLow, childHigh, chain, items)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+* Frees the subtree at node.
+*/
+template<class Key, class Value, size_t NodeBytes>
+void BPlusTree<Key, Value, NodeBytes>::destroy(NodeBase* node)
+{
+    if(node == nullptr) {
+        return;
+    }
+    if(node->leaf) {
+        delete static_cast<Leaf*>(node);
+        return;
+    }
+    Inner* inner = static_cast<Inner*>(node);
+    for(size_t i = 0; i <= inner->count; ++i) {
+        destroy(inner->children[i]);
+    }
+    delete inner;
+}
+
+/**
+* Fewest items a leaf other than the root may hold.
+*/
+template<class Key, class Value, size_t NodeBytes>
+size_t BPlusTree<Key, Value, NodeBytes>::minLeafCount()
+{
+    return leafCapacity / 2;
+}
+
+/**
+* Fewest keys an inner node other than the root may hold. Two siblings
+* one short of it, plus their separator, still fit in one node.
+*/
+template<class Key, class Value, size_t NodeBytes>
+size_t BPlusTree<Key, Value, NodeBytes>::minInnerCount()
+{
+    return (innerCapacity - 1) / 2;
+}
+
+/*
+  ---------------------------------------------
+  End implementations for the BPlusTree class.
+  ---------------------------------------------
+*/
+
+#endif
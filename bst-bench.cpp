@@ -0,0 +1,932 @@
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include <string>
+#include <chrono>
+#include <random>
+#include <algorithm>
+#include <cstdlib>
+#include <cstdio>
+#include <new>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <map>
+#include "bst.h"
+#include "avlbst.h"
+#include "augmentedavl.h"
+#include "persistentavl.h"
+#include "concurrentavl.h"
+#include "shardedavl.h"
+#include "bplustree.h"
+#include "keysearch.h"
+#include "compactavl.h"
+#include "durableavl.h"
+#include "avlimage.h"
+
+using namespace std;
+
+// Simple micro-benchmarks for the search trees.
+// Usage: ./bst-bench [numKeys]
+
+typedef chrono::steady_clock Clock;
+
+// results are accumulated here so lookups cannot be optimized away
+volatile long long benchSink = 0;
+
+// every heap allocation in the program is counted here, with the bytes
+// requested
+static atomic<size_t> allocationCount(0);
+static atomic<size_t> allocatedBytes(0);
+
+// kept out of line so the compiler does not pair free() with operator new
+__attribute__((noinline)) void* operator new(size_t bytes)
+{
+    allocationCount.fetch_add(1, memory_order_relaxed);
+    allocatedBytes.fetch_add(bytes, memory_order_relaxed);
+    void* mem = malloc(bytes == 0 ? 1 : bytes);
+    if(mem == NULL) throw bad_alloc();
+    return mem;
+}
+
+__attribute__((noinline)) void operator delete(void* mem) noexcept
+{
+    free(mem);
+}
+
+static double msSince(Clock::time_point start)
+{
+    return chrono::duration<double, milli>(Clock::now() - start).count();
+}
+
+static void report(const string& name, double ms, size_t ops)
+{
+    cout << "  " << left << setw(36) << name << right << setw(10) << fixed << setprecision(1)
+         << ms << " ms" << setw(14) << setprecision(1) << (ms * 1e6 / ops) << " ns/op" << endl;
+}
+
+static vector<int> shuffledKeys(size_t n, unsigned seed)
+{
+    vector<int> keys(n);
+    for(size_t i = 0; i < n; ++i) {
+        keys[i] = static_cast<int>(i);
+    }
+    shuffle(keys.begin(), keys.end(), mt19937(seed));
+    return keys;
+}
+
+// insert all keys, remove half of them, insert them again, then clear
+template<class Tree>
+void benchAllocation(const string& name, const vector<int>& keys, bool pooled)
+{
+    Tree tree;
+    if(pooled) {
+        tree.enableNodePool(4096);
+    }
+    Clock::time_point start = Clock::now();
+    for(size_t i = 0; i < keys.size(); ++i) {
+        tree.insert(make_pair(keys[i], keys[i]));
+    }
+    for(size_t i = 0; i < keys.size(); i += 2) {
+        tree.remove(keys[i]);
+    }
+    for(size_t i = 0; i < keys.size(); i += 2) {
+        tree.insert(make_pair(keys[i], keys[i]));
+    }
+    tree.clear();
+    report(name + (pooled ? " (pool)" : " (new)"), msSince(start), 2 * keys.size());
+}
+
+// look up every key once, in a different random order than inserted
+template<class Tree>
+void benchFind(const string& name, const vector<int>& keys)
+{
+    Tree tree;
+    tree.enableNodePool(4096);
+    for(size_t i = 0; i < keys.size(); ++i) {
+        tree.insert(make_pair(keys[i], keys[i]));
+    }
+    vector<int> probes(keys);
+    shuffle(probes.begin(), probes.end(), mt19937(7));
+
+    long long sum = 0;
+    Clock::time_point start = Clock::now();
+    for(size_t i = 0; i < probes.size(); ++i) {
+        sum += tree.find(probes[i])->second;
+    }
+    report(name, msSince(start), probes.size());
+    benchSink += sum;
+}
+
+// cold start: rebuild by inserts vs. loading or mapping a saved image
+void benchStartup(const vector<int>& keys)
+{
+    const string path = "bst-bench-image.bin";
+    {
+        AVLTree<int, int> tree;
+        Clock::time_point start = Clock::now();
+        for(size_t i = 0; i < keys.size(); ++i) {
+            tree.insert(make_pair(keys[i], keys[i]));
+        }
+        report("rebuild by insert", msSince(start), keys.size());
+        start = Clock::now();
+        saveImage(tree, path);
+        report("saveImage() (once)", msSince(start), 1);
+    }
+    {
+        AVLTree<int, int> tree;
+        Clock::time_point start = Clock::now();
+        loadImage(tree, path);
+        report("loadImage()", msSince(start), keys.size());
+    }
+    long long sum = 0;
+    {
+        Clock::time_point start = Clock::now();
+        FrozenAVLTree<int, int> mapped = openMappedImage<int, int>(path);
+        report("openMappedImage() (once)", msSince(start), 1);
+        start = Clock::now();
+        for(size_t i = 0; i < 1000; ++i) {
+            sum += mapped.find(keys[i % keys.size()])->second;
+        }
+        report("first 1000 mapped finds", msSince(start), 1000);
+    }
+    remove(path.c_str());
+    benchSink += sum;
+}
+
+// clear() pause: a degenerate chain, then a balanced tree of strings
+// freed on the calling thread vs. handed to the reclaimer
+void benchTeardown(size_t n)
+{
+    {
+        BinarySearchTree<int, int> chain;
+        for(size_t i = 0; i < n; ++i) {
+            chain.insert(chain.end(), make_pair(static_cast<int>(i), 0));
+        }
+        Clock::time_point start = Clock::now();
+        chain.clear();
+        report("BST sorted chain clear()", msSince(start), n);
+    }
+    for(int deferred = 0; deferred < 2; ++deferred) {
+        AVLTree<int, string> tree;
+        tree.setDeferredClear(deferred != 0);
+        for(size_t i = 0; i < n; ++i) {
+            tree.insert(tree.end(), make_pair(static_cast<int>(i), string(32, 'x')));
+        }
+        Clock::time_point start = Clock::now();
+        tree.clear();
+        report(deferred ? "AVL<int, string> deferred clear()" : "AVL<int, string> clear()", msSince(start), n);
+        if(deferred) {
+            start = Clock::now();
+            NodeReclaimer::instance().drain();
+            report("  background reclaim finished after", msSince(start), n);
+        }
+    }
+}
+
+// one-pass structural check of a balanced and a degenerate tree
+void benchValidate(const vector<int>& keys)
+{
+    AVLTree<int, int> tree;
+    BinarySearchTree<int, int> chain;
+    for(size_t i = 0; i < keys.size(); ++i) {
+        tree.insert(make_pair(keys[i], keys[i]));
+        chain.insert(chain.end(), make_pair(static_cast<int>(i), 0));
+    }
+    Clock::time_point start = Clock::now();
+    benchSink += tree.isBalanced();
+    report("AVL isBalanced()", msSince(start), keys.size());
+    for(unsigned threads = 1; threads <= 4; threads *= 4) {
+        start = Clock::now();
+        TreeValidation result = tree.validate(threads);
+        report("AVL validate(), " + to_string(threads) + " thread(s)", msSince(start), keys.size());
+        benchSink += result.valid();
+    }
+    start = Clock::now();
+    benchSink += chain.validate().height;
+    report("BST sorted chain validate()", msSince(start), keys.size());
+}
+
+// heap bytes per entry and speed of the pointer and index-linked AVL trees
+void benchFootprint(const vector<int>& keys)
+{
+    vector<int> probes(keys);
+    shuffle(probes.begin(), probes.end(), mt19937(7));
+    long long sum = 0;
+    {
+        size_t before = allocatedBytes;
+        AVLTree<uint64_t, uint64_t> tree;
+        Clock::time_point start = Clock::now();
+        for(size_t i = 0; i < keys.size(); ++i) {
+            tree.insert(make_pair(uint64_t(keys[i]), uint64_t(keys[i])));
+        }
+        report("AVLTree<uint64_t, uint64_t> insert", msSince(start), keys.size());
+        double perEntry = double(allocatedBytes - before) / keys.size();
+        start = Clock::now();
+        for(size_t i = 0; i < probes.size(); ++i) {
+            sum += tree.find(uint64_t(probes[i]))->second;
+        }
+        report("AVLTree<uint64_t, uint64_t> find", msSince(start), probes.size());
+        cout << "    " << fixed << setprecision(1) << perEntry << " bytes/entry requested from the heap" << endl;
+    }
+    {
+        CompactAVLTree<uint64_t, uint64_t> tree;
+        tree.reserve(keys.size());
+        Clock::time_point start = Clock::now();
+        for(size_t i = 0; i < keys.size(); ++i) {
+            tree.insert(make_pair(uint64_t(keys[i]), uint64_t(keys[i])));
+        }
+        report("CompactAVLTree insert", msSince(start), keys.size());
+        start = Clock::now();
+        for(size_t i = 0; i < probes.size(); ++i) {
+            sum += tree.find(uint64_t(probes[i]))->second;
+        }
+        report("CompactAVLTree find", msSince(start), probes.size());
+        cout << "    " << fixed << setprecision(1) << double(tree.memoryBytes()) / keys.size()
+             << " bytes/entry (node vector)" << endl;
+    }
+    benchSink += sum;
+}
+
+// the same probes handed to findBatch in request-sized batches
+void benchFindBatch(const vector<int>& keys, size_t batch)
+{
+    AVLTree<int, int> tree;
+    tree.enableNodePool(4096);
+    for(size_t i = 0; i < keys.size(); ++i) {
+        tree.insert(make_pair(keys[i], keys[i]));
+    }
+    vector<int> probes(keys);
+    shuffle(probes.begin(), probes.end(), mt19937(7));
+
+    vector<AVLTree<int, int>::iterator> found(batch);
+    long long sum = 0;
+    Clock::time_point start = Clock::now();
+    for(size_t base = 0; base < probes.size(); base += batch) {
+        size_t width = min(batch, probes.size() - base);
+        tree.findBatch(&probes[base], width, &found[0]);
+        for(size_t i = 0; i < width; ++i) {
+            sum += found[i]->second;
+        }
+    }
+    report("AVL findBatch, batches of " + to_string(batch), msSince(start), probes.size());
+    benchSink += sum;
+}
+
+// the same probes against a frozen copy of the AVL tree
+void benchFrozenFind(const vector<int>& keys)
+{
+    AVLTree<int, int> tree;
+    for(size_t i = 0; i < keys.size(); ++i) {
+        tree.insert(make_pair(keys[i], keys[i]));
+    }
+    Clock::time_point start = Clock::now();
+    FrozenAVLTree<int, int> frozen = tree.freeze();
+    report("AVL freeze() (once)", msSince(start), 1);
+
+    vector<int> probes(keys);
+    shuffle(probes.begin(), probes.end(), mt19937(7));
+    long long sum = 0;
+    start = Clock::now();
+    for(size_t i = 0; i < probes.size(); ++i) {
+        sum += frozen.find(probes[i])->second;
+    }
+    report("frozen find", msSince(start), probes.size());
+
+    start = Clock::now();
+    for(FrozenAVLTree<int, int>::iterator it = frozen.begin(); it != frozen.end(); ++it) {
+        sum += it->second;
+    }
+    report("frozen scan", msSince(start), keys.size());
+    benchSink += sum;
+}
+
+// insert, look up and scan the same keys with any engine that has the
+// BinarySearchTree interface (std::map included)
+template<class Tree>
+void benchEngine(const string& name, const vector<int>& keys)
+{
+    vector<int> probes(keys);
+    shuffle(probes.begin(), probes.end(), mt19937(7));
+
+    Tree tree;
+    Clock::time_point start = Clock::now();
+    for(size_t i = 0; i < keys.size(); ++i) {
+        tree.insert(make_pair(keys[i], keys[i]));
+    }
+    report(name + " insert", msSince(start), keys.size());
+
+    long long sum = 0;
+    start = Clock::now();
+    for(size_t i = 0; i < probes.size(); ++i) {
+        sum += tree.find(probes[i])->second;
+    }
+    report(name + " find", msSince(start), probes.size());
+
+    start = Clock::now();
+    for(typename Tree::iterator it = tree.begin(); it != tree.end(); ++it) {
+        sum += it->second;
+    }
+    report(name + " scan", msSince(start), keys.size());
+    benchSink += sum;
+}
+
+// lower_bound inside one node-sized sorted array of 32-bit keys
+void benchNodeSearch(size_t probes)
+{
+    const size_t width = 64;
+    vector<uint32_t> node(width);
+    for(size_t i = 0; i < width; ++i) {
+        node[i] = static_cast<uint32_t>(i * 3);
+    }
+    vector<uint32_t> targets(probes);
+    mt19937 gen(11);
+    for(size_t i = 0; i < probes; ++i) {
+        targets[i] = gen() % (3 * width);
+    }
+
+    long long sum = 0;
+    Clock::time_point start = Clock::now();
+    for(size_t i = 0; i < probes; ++i) {
+        sum += std::lower_bound(node.begin(), node.end(), targets[i]) - node.begin();
+    }
+    report("std::lower_bound, 64 keys", msSince(start), probes);
+
+    start = Clock::now();
+    for(size_t i = 0; i < probes; ++i) {
+        sum += KeySearch<uint32_t>::lowerBound(node.data(), width, targets[i]);
+    }
+    report("KeySearch::lowerBound, 64 keys", msSince(start), probes);
+    benchSink += sum;
+}
+
+// load sorted pairs one insert at a time vs. the O(n) bulk build
+void benchSortedLoad(size_t n)
+{
+    vector<pair<int, int> > sorted(n);
+    for(size_t i = 0; i < n; ++i) {
+        sorted[i] = make_pair(static_cast<int>(i), static_cast<int>(i));
+    }
+
+    Clock::time_point start = Clock::now();
+    {
+        AVLTree<int, int> tree;
+        for(size_t i = 0; i < n; ++i) {
+            tree.insert(sorted[i]);
+        }
+        report("AVL insert loop (sorted)", msSince(start), n);
+    }
+
+    start = Clock::now();
+    {
+        AVLTree<int, int> tree(sorted.begin(), sorted.end());
+        report("AVL assignSorted", msSince(start), n);
+    }
+}
+
+// cold start from unsorted pairs with some repeated keys: insert loop
+// vs. bulkInsert at 1..8 threads
+void benchBulkLoad(const vector<int>& keys)
+{
+    vector<pair<int, int> > items(keys.size());
+    for(size_t i = 0; i < keys.size(); ++i) {
+        items[i] = make_pair(keys[i] / 2 * 2, static_cast<int>(i));
+    }
+
+    Clock::time_point start = Clock::now();
+    {
+        AVLTree<int, int> tree;
+        for(size_t i = 0; i < items.size(); ++i) {
+            tree.insert(items[i]);
+        }
+        benchSink += tree.size();
+        report("AVL insert loop (unsorted)", msSince(start), items.size());
+    }
+
+    for(unsigned threads = 1; threads <= 8; threads *= 2) {
+        start = Clock::now();
+        {
+            AVLTree<int, int> tree;
+            tree.bulkInsert(items.begin(), items.end(), threads);
+            benchSink += tree.size();
+            report("AVL bulkInsert, " + to_string(threads) + " thread(s)", msSince(start), items.size());
+        }
+    }
+}
+
+// copy one tree into another in order, with and without the end() hint
+void benchHintedFill(const vector<int>& keys)
+{
+    AVLTree<int, int> source;
+    for(size_t i = 0; i < keys.size(); ++i) {
+        source.insert(make_pair(keys[i], keys[i]));
+    }
+
+    Clock::time_point start = Clock::now();
+    {
+        AVLTree<int, int> target;
+        for(AVLTree<int, int>::iterator it = source.begin(); it != source.end(); ++it) {
+            target.insert(*it);
+        }
+        report("AVL in-order fill, insert", msSince(start), keys.size());
+    }
+
+    start = Clock::now();
+    {
+        AVLTree<int, int> target;
+        for(AVLTree<int, int>::iterator it = source.begin(); it != source.end(); ++it) {
+            target.insert(target.end(), *it);
+        }
+        report("AVL in-order fill, insert(end())", msSince(start), keys.size());
+    }
+}
+
+// read the 1st..99th percentiles by walking the iterator vs. select()
+void benchPercentiles(const vector<int>& keys)
+{
+    AVLTree<int, int> tree;
+    for(size_t i = 0; i < keys.size(); ++i) {
+        tree.insert(make_pair(keys[i], keys[i]));
+    }
+
+    long long sum = 0;
+    Clock::time_point start = Clock::now();
+    for(size_t p = 1; p < 100; ++p) {
+        AVLTree<int, int>::iterator it = tree.begin();
+        for(size_t step = tree.size() * p / 100; step > 0; --step) {
+            ++it;
+        }
+        sum += it->first;
+    }
+    report("AVL percentiles, iterator walk", msSince(start), 99);
+
+    start = Clock::now();
+    for(size_t p = 1; p < 100; ++p) {
+        sum += tree.select(tree.size() * p / 100)->first;
+    }
+    report("AVL percentiles, select()", msSince(start), 99);
+    benchSink += sum;
+}
+
+// sum every value: iterator walk vs. parallel_reduce at 1..8 threads
+void benchScan(const vector<int>& keys)
+{
+    AVLTree<int, int> tree;
+    for(size_t i = 0; i < keys.size(); ++i) {
+        tree.insert(make_pair(keys[i], keys[i]));
+    }
+
+    long long sum = 0;
+    Clock::time_point start = Clock::now();
+    for(AVLTree<int, int>::iterator it = tree.begin(); it != tree.end(); ++it) {
+        sum += it->second;
+    }
+    report("AVL scan, iterator", msSince(start), keys.size());
+
+    for(unsigned threads = 1; threads <= 8; threads *= 2) {
+        start = Clock::now();
+        sum -= tree.parallel_reduce(0LL,
+            [](const pair<const int, int>& item) { return static_cast<long long>(item.second); },
+            [](long long a, long long b) { return a + b; }, threads);
+        report("AVL scan, parallel_reduce, " + to_string(threads) + "t", msSince(start), keys.size());
+    }
+    benchSink += sum;
+}
+
+// sum the values over windows of 10% of the keys
+void benchRangeSum(const vector<int>& keys)
+{
+    typedef AugmentedAVLTree<int, long long, SumSummary<long long> > SumTree;
+    SumTree tree;
+    for(size_t i = 0; i < keys.size(); ++i) {
+        tree.insert(make_pair(keys[i], static_cast<long long>(keys[i])));
+    }
+
+    const int windows = 100;
+    const int width = static_cast<int>(keys.size() / 10);
+    long long sum = 0;
+    Clock::time_point start = Clock::now();
+    for(int w = 0; w < windows; ++w) {
+        int low = static_cast<int>((keys.size() - width) * w / windows);
+        SumTree::range_view view = tree.range(low, low + width);
+        for(SumTree::iterator it = view.begin(); it != view.end(); ++it) {
+            sum += it->second;
+        }
+    }
+    report("range sum, iterate", msSince(start), windows);
+
+    start = Clock::now();
+    for(int w = 0; w < windows; ++w) {
+        int low = static_cast<int>((keys.size() - width) * w / windows);
+        sum -= tree.aggregate(low, low + width);
+    }
+    report("range sum, aggregate()", msSince(start), windows);
+    benchSink += sum;
+}
+
+// cut the tree in two at a key and put it back together, vs. moving the
+// upper part over one item at a time
+void benchSplitJoin(const vector<int>& keys)
+{
+    AVLTree<int, int> tree;
+    for(size_t i = 0; i < keys.size(); ++i) {
+        tree.insert(make_pair(keys[i], keys[i]));
+    }
+
+    const int rounds = 100;
+    Clock::time_point start = Clock::now();
+    for(int r = 0; r < rounds; ++r) {
+        AVLTree<int, int> upper;
+        tree.split(keys[r], upper);
+        tree.join(upper);
+    }
+    report("AVL split + join", msSince(start), rounds);
+
+    start = Clock::now();
+    {
+        AVLTree<int, int> upper;
+        int cut = static_cast<int>(keys.size() / 2);
+        for(AVLTree<int, int>::iterator it = tree.lower_bound(cut); it != tree.end(); ++it) {
+            upper.insert(*it);
+        }
+        for(int key = cut; key < static_cast<int>(keys.size()); ++key) {
+            tree.remove(key);
+        }
+        report("AVL split by reinsert (once)", msSince(start), 1);
+    }
+}
+
+// two n-key sets, multiples of 2 and multiples of 3, overlapping in a third
+static void buildSetOperands(size_t n, AVLTree<int, int>& a, AVLTree<int, int>& b)
+{
+    vector<pair<int, int> > items(n);
+    for(size_t i = 0; i < n; ++i) {
+        items[i] = make_pair(static_cast<int>(2 * i), 1);
+    }
+    a.assignSorted(items.begin(), items.end());
+    for(size_t i = 0; i < n; ++i) {
+        items[i] = make_pair(static_cast<int>(3 * i), 2);
+    }
+    b.assignSorted(items.begin(), items.end());
+}
+
+// union/intersection/difference of two n-key trees at 1..8 threads, vs.
+// inserting one tree into the other item by item
+void benchSetOps(size_t n)
+{
+    {
+        AVLTree<int, int> a, b;
+        buildSetOperands(n, a, b);
+        Clock::time_point start = Clock::now();
+        for(AVLTree<int, int>::iterator it = b.begin(); it != b.end(); ++it) {
+            a.insert(*it);
+        }
+        report("union by insert loop", msSince(start), n);
+    }
+
+    const char* names[] = { "unionWith", "intersect", "difference" };
+    for(int op = 0; op < 3; ++op) {
+        for(unsigned threads = 1; threads <= 8; threads *= 2) {
+            AVLTree<int, int> a, b;
+            buildSetOperands(n, a, b);
+            Clock::time_point start = Clock::now();
+            if(op == 0) {
+                a.unionWith(b, threads);
+            }
+            else if(op == 1) {
+                a.intersect(b, threads);
+            }
+            else {
+                a.difference(b, threads);
+            }
+            report(string(names[op]) + ", " + to_string(threads) + " thread(s)", msSince(start), n);
+            benchSink += a.size();
+        }
+    }
+}
+
+// path-copying inserts, O(1) snapshots vs. a deep copy of the AVL tree
+void benchSnapshots(const vector<int>& keys)
+{
+    PersistentAVLTree<int, int> tree;
+    Clock::time_point start = Clock::now();
+    for(size_t i = 0; i < keys.size(); ++i) {
+        tree.insert(make_pair(keys[i], keys[i]));
+    }
+    report("persistent insert", msSince(start), keys.size());
+
+    const int snapshots = 1000;
+    start = Clock::now();
+    for(int i = 0; i < snapshots; ++i) {
+        PersistentAVLTree<int, int> view = tree.snapshot();
+        benchSink += view.size();
+    }
+    report("persistent snapshot()", msSince(start), snapshots);
+
+    AVLTree<int, int> source;
+    for(size_t i = 0; i < keys.size(); ++i) {
+        source.insert(make_pair(keys[i], keys[i]));
+    }
+    start = Clock::now();
+    {
+        AVLTree<int, int> copy;
+        for(AVLTree<int, int>::iterator it = source.begin(); it != source.end(); ++it) {
+            copy.insert(copy.end(), *it);
+        }
+        benchSink += copy.size();
+    }
+    report("AVL deep copy (once)", msSince(start), 1);
+}
+
+// runs threads copies of worker(thread index) and returns the elapsed time
+template<class Worker>
+static double runThreads(unsigned threads, Worker worker)
+{
+    vector<thread> pool;
+    Clock::time_point start = Clock::now();
+    for(unsigned t = 0; t < threads; ++t) {
+        pool.push_back(thread(worker, t));
+    }
+    for(unsigned t = 0; t < threads; ++t) {
+        pool[t].join();
+    }
+    return msSince(start);
+}
+
+// 95% finds and 5% inserts from 1..8 threads, against a mutex-wrapped AVLTree
+void benchConcurrent(const vector<int>& keys)
+{
+    const size_t opsPerThread = 200000;
+
+    AVLTree<int, int> locked;
+    mutex lock;
+    ConcurrentAVLTree<int, int> shared;
+    ShardedAVLMap<int, int> sharded(16);
+    for(size_t i = 0; i < keys.size(); ++i) {
+        locked.insert(make_pair(keys[i], keys[i]));
+        sharded.insert(make_pair(keys[i], keys[i]));
+    }
+    shared.apply([&keys](PersistentAVLTree<int, int>& version) {
+        for(size_t i = 0; i < keys.size(); ++i) {
+            version.insert(make_pair(keys[i], keys[i]));
+        }
+    });
+
+    for(unsigned threads = 1; threads <= 8; threads *= 2) {
+        double ms = runThreads(threads, [&](unsigned t) {
+            mt19937 rng(t);
+            long long sum = 0;
+            for(size_t i = 0; i < opsPerThread; ++i) {
+                int key = keys[rng() % keys.size()];
+                lock_guard<mutex> guard(lock);
+                if(i % 20 == 0) {
+                    locked.insert(make_pair(key, static_cast<int>(i)));
+                }
+                else {
+                    sum += locked.find(key)->second;
+                }
+            }
+            benchSink += sum;
+        });
+        report("mutex + AVLTree, " + to_string(threads) + " thread(s)", ms, threads * opsPerThread);
+
+        ms = runThreads(threads, [&](unsigned t) {
+            mt19937 rng(t);
+            long long sum = 0;
+            for(size_t i = 0; i < opsPerThread; ++i) {
+                int key = keys[rng() % keys.size()];
+                if(i % 20 == 0) {
+                    shared.insert(make_pair(key, static_cast<int>(i)));
+                }
+                else {
+                    int value = 0;
+                    shared.find(key, value);
+                    sum += value;
+                }
+            }
+            benchSink += sum;
+        });
+        report("ConcurrentAVLTree, " + to_string(threads) + " thread(s)", ms, threads * opsPerThread);
+
+        // finds only: how the read path scales without writers in the way
+        ms = runThreads(threads, [&](unsigned t) {
+            mt19937 rng(t);
+            long long sum = 0;
+            for(size_t i = 0; i < opsPerThread; ++i) {
+                int value = 0;
+                shared.find(keys[rng() % keys.size()], value);
+                sum += value;
+            }
+            benchSink += sum;
+        });
+        report("ConcurrentAVLTree, finds only, " + to_string(threads) + "t", ms, threads * opsPerThread);
+
+        sharded.resetStats();
+        ms = runThreads(threads, [&](unsigned t) {
+            mt19937 rng(t);
+            long long sum = 0;
+            for(size_t i = 0; i < opsPerThread; ++i) {
+                int key = keys[rng() % keys.size()];
+                if(i % 20 == 0) {
+                    sharded.insert(make_pair(key, static_cast<int>(i)));
+                }
+                else {
+                    int value = 0;
+                    sharded.find(key, value);
+                    sum += value;
+                }
+            }
+            benchSink += sum;
+        });
+        size_t acquisitions = 0, contended = 0;
+        vector<ShardedAVLMap<int, int>::ShardStats> stats = sharded.shardStats();
+        for(size_t i = 0; i < stats.size(); ++i) {
+            acquisitions += stats[i].acquisitions;
+            contended += stats[i].contended;
+        }
+        report("ShardedAVLMap(16), " + to_string(threads) + " thread(s)", ms, threads * opsPerThread);
+        cout << "    " << contended << " of " << acquisitions << " shard locks contended" << endl;
+    }
+}
+
+// inserts per durability level; syncing levels get fewer operations, and
+// group commit also runs with several writers sharing each sync
+void benchDurability(const vector<int>& keys)
+{
+    const string directory = "bst-bench-wal";
+    const size_t syncedOps = min<size_t>(keys.size(), 20000);
+    struct Level { const char* name; Durability durability; unsigned threads; size_t ops; };
+    const Level levels[] = {
+        { "none", DURABILITY_NONE, 1, keys.size() },
+        { "buffered", DURABILITY_BUFFERED, 1, keys.size() },
+        { "group, 1 thread", DURABILITY_GROUP, 1, syncedOps },
+        { "group, 4 threads", DURABILITY_GROUP, 4, syncedOps },
+        { "sync", DURABILITY_SYNC, 1, syncedOps },
+    };
+    for(size_t l = 0; l < sizeof(levels) / sizeof(levels[0]); ++l) {
+        const Level& level = levels[l];
+        double ms;
+        {
+            DurableAVLTree<int, int> tree(directory, level.durability);
+            ms = runThreads(level.threads, [&](unsigned t) {
+                for(size_t i = t; i < level.ops; i += level.threads) {
+                    tree.insert(make_pair(keys[i], keys[i]));
+                }
+            });
+        }
+        report(string("durable insert, ") + level.name, ms, level.ops);
+        remove((directory + "/wal.log").c_str());
+        remove((directory + "/checkpoint.img").c_str());
+    }
+    rmdir(directory.c_str());
+}
+
+static void reportAllocs(const string& name, double ms, size_t allocs, size_t ops)
+{
+    cout << "  " << left << setw(36) << name << right << setw(10) << fixed << setprecision(1)
+         << ms << " ms" << setw(10) << setprecision(2) << (double(allocs) / ops) << " allocs/op" << endl;
+}
+
+// string keys and values too long for the small-string buffer, so every
+// copy of either one costs a heap allocation
+void benchMoveInsert(size_t n)
+{
+    vector<string> keys(n), values(n);
+    char buf[64];
+    for(size_t i = 0; i < n; ++i) {
+        snprintf(buf, sizeof(buf), "benchmark-key-%012zu", i);
+        keys[i] = buf;
+        snprintf(buf, sizeof(buf), "benchmark-value-payload-%012zu", i);
+        values[i] = buf;
+    }
+
+    {
+        AVLTree<string, string> tree;
+        size_t before = allocationCount;
+        Clock::time_point start = Clock::now();
+        for(size_t i = 0; i < n; ++i) {
+            const pair<const string, string> item(keys[i], values[i]);
+            tree.insert(item);
+        }
+        reportAllocs("insert(const pair&)", msSince(start), allocationCount - before, n);
+    }
+    {
+        AVLTree<string, string> tree;
+        vector<string> k(keys), v(values);
+        size_t before = allocationCount;
+        Clock::time_point start = Clock::now();
+        for(size_t i = 0; i < n; ++i) {
+            tree.insert(make_pair(move(k[i]), move(v[i])));
+        }
+        reportAllocs("insert(pair&&)", msSince(start), allocationCount - before, n);
+    }
+    {
+        AVLTree<string, string> tree;
+        vector<string> k(keys), v(values);
+        size_t before = allocationCount;
+        Clock::time_point start = Clock::now();
+        for(size_t i = 0; i < n; ++i) {
+            tree.emplace(move(k[i]), move(v[i]));
+        }
+        reportAllocs("emplace(key&&, value&&)", msSince(start), allocationCount - before, n);
+    }
+    {
+        AVLTree<string, string> tree;
+        vector<string> k(keys), v(values);
+        size_t before = allocationCount;
+        Clock::time_point start = Clock::now();
+        for(size_t i = 0; i < n; ++i) {
+            tree.try_emplace(move(k[i]), move(v[i]));
+        }
+        reportAllocs("try_emplace(key&&, value&&)", msSince(start), allocationCount - before, n);
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    size_t n = argc > 1 ? strtoul(argv[1], NULL, 10) : 1000000;
+    vector<int> keys = shuffledKeys(n, 104);
+
+    cout << "Node allocation, " << n << " keys:" << endl;
+    benchAllocation<BinarySearchTree<int, int> >("BST insert/remove/clear", keys, false);
+    benchAllocation<BinarySearchTree<int, int> >("BST insert/remove/clear", keys, true);
+    benchAllocation<AVLTree<int, int> >("AVL insert/remove/clear", keys, false);
+    benchAllocation<AVLTree<int, int> >("AVL insert/remove/clear", keys, true);
+
+    cout << "Lookup, " << n << " keys:" << endl;
+    benchFind<BinarySearchTree<int, int> >("BST find", keys);
+    benchFind<AVLTree<int, int> >("AVL find", keys);
+    benchFindBatch(keys, 64);
+    benchFindBatch(keys, 512);
+    benchFrozenFind(keys);
+
+    cout << "Engines, " << n << " random keys:" << endl;
+    benchEngine<AVLTree<int, int> >("AVL", keys);
+    benchEngine<BPlusTree<int, int> >("B+ tree", keys);
+    benchEngine<map<int, int> >("std::map", keys);
+
+    cout << "Engines, " << n << " sequential keys:" << endl;
+    {
+        vector<int> sequential(n);
+        for(size_t i = 0; i < n; ++i) {
+            sequential[i] = static_cast<int>(i);
+        }
+        benchEngine<AVLTree<int, int> >("AVL", sequential);
+        benchEngine<BPlusTree<int, int> >("B+ tree", sequential);
+        benchEngine<map<int, int> >("std::map", sequential);
+    }
+
+    cout << "Node key search, " << n << " probes:" << endl;
+    benchNodeSearch(n);
+
+    cout << "Startup, " << n << " keys:" << endl;
+    benchStartup(keys);
+
+    cout << "Footprint, " << n << " keys:" << endl;
+    benchFootprint(keys);
+
+    cout << "Teardown, " << n << " keys:" << endl;
+    benchTeardown(n);
+
+    cout << "Validation, " << n << " keys:" << endl;
+    benchValidate(keys);
+
+    cout << "Sorted load, " << n << " keys:" << endl;
+    benchSortedLoad(n);
+
+    cout << "Bulk load, " << n << " unsorted keys:" << endl;
+    benchBulkLoad(keys);
+
+    cout << "Hinted insert, " << n << " keys:" << endl;
+    benchHintedFill(keys);
+
+    cout << "Order statistics, " << n << " keys:" << endl;
+    benchPercentiles(keys);
+
+    cout << "Full scan, " << n << " keys:" << endl;
+    benchScan(keys);
+
+    cout << "Range aggregates, " << n << " keys:" << endl;
+    benchRangeSum(keys);
+
+    cout << "Split and join, " << n << " keys:" << endl;
+    benchSplitJoin(keys);
+
+    cout << "Set operations, 2 x " << n << " keys (" << thread::hardware_concurrency()
+         << " hardware threads):" << endl;
+    benchSetOps(n);
+
+    cout << "Snapshots, " << n << " keys:" << endl;
+    benchSnapshots(keys);
+
+    cout << "Concurrent 95/5 find/insert and finds only, " << n << " keys:" << endl;
+    benchConcurrent(keys);
+
+    cout << "Durable inserts, " << n << " keys:" << endl;
+    benchDurability(keys);
+
+    cout << "Move-aware insert, " << n << " string pairs:" << endl;
+    benchMoveInsert(n);
+
+    return 0;
+}
@@ -3,22 +3,37 @@
 
 #include <iostream>
 #include <exception>
+#include <algorithm>
+#include <atomic>
 #include <cstdlib>
 #include <utility>
+#include <memory>
+#include <new>
+#include <stdexcept>
+#include <thread>
+#include <mutex>
+#include <type_traits>
+#include <vector>
+#include "nodepool.h"
+#include "nodereclaimer.h"
 
 /**
  * A templated class for a Node in a search tree.
- * The getters for parent/left/right are virtual so
- * that they can be overridden for future kinds of
- * search trees, such as Red Black trees, Splay trees,
- * and AVL trees.
+ * The getters for parent/left/right are not virtual:
+ * derived nodes for other kinds of search trees, such
+ * as AVL trees, redeclare them with a covariant return
+ * type, so every call is resolved at compile time and
+ * the descent loops can be inlined. Nodes carry no
+ * vtable; the owning tree destroys them through its
+ * destroyNode() hook with the right static type.
  */
 template <typename Key, typename Value>
 class Node
 {
 public:
     Node(const Key& key, const Value& value, Node<Key, Value>* parent);
-    virtual ~Node();
+    Node(Key&& key, Value&& value, Node<Key, Value>* parent);
+    ~Node();
 
     const std::pair<const Key, Value>& getItem() const;
     std::pair<const Key, Value>& getItem();
@@ -26,14 +41,15 @@ public:
     const Value& getValue() const;
     Value& getValue();
 
-    virtual Node<Key, Value>* getParent() const;
-    virtual Node<Key, Value>* getLeft() const;
-    virtual Node<Key, Value>* getRight() const;
+    Node<Key, Value>* getParent() const;
+    Node<Key, Value>* getLeft() const;
+    Node<Key, Value>* getRight() const;
 
     void setParent(Node<Key, Value>* parent);
     void setLeft(Node<Key, Value>* left);
     void setRight(Node<Key, Value>* right);
     void setValue(const Value &value);
+    void setValue(Value&& value);
 
 protected:
     std::pair<const Key, Value> item_;
@@ -61,6 +77,19 @@ Node<Key, Value>::Node(const Key& key, const Value& value, Node<Key, Value>* par
 
 }
 
+/**
+* Explicit constructor that moves the key and value into the node's item.
+*/
+template<typename Key, typename Value>
+Node<Key, Value>::Node(Key&& key, Value&& value, Node<Key, Value>* parent) :
+    item_(std::move(key), std::move(value)),
+    parent_(parent),
+    left_(NULL),
+    right_(NULL)
+{
+
+}
+
 /**
 * Destructor, which does not need to do anything since the pointers inside of a node
 * are only used as references to existing nodes. The nodes pointed to by parent/left/right
@@ -118,7 +147,7 @@ Value& Node<Key, Value>::getValue()
 }
 
 /**
-* An implementation of the virtual function for retreiving the parent.
+* A getter for the parent.
 */
 template<typename Key, typename Value>
 Node<Key, Value>* Node<Key, Value>::getParent() const
@@ -127,7 +156,7 @@ Node<Key, Value>* Node<Key, Value>::getParent() const
 }
 
 /**
-* An implementation of the virtual function for retreiving the left child.
+* A getter for the left child.
 */
 template<typename Key, typename Value>
 Node<Key, Value>* Node<Key, Value>::getLeft() const
@@ -136,7 +165,7 @@ Node<Key, Value>* Node<Key, Value>::getLeft() const
 }
 
 /**
-* An implementation of the virtual function for retreiving the right child.
+* A getter for the right child.
 */
 template<typename Key, typename Value>
 Node<Key, Value>* Node<Key, Value>::getRight() const
@@ -180,12 +209,89 @@ void Node<Key, Value>::setValue(const Value& value)
     item_.second = value;
 }
 
+/**
+* A setter that moves a new value into the node.
+*/
+template<typename Key, typename Value>
+void Node<Key, Value>::setValue(Value&& value)
+{
+    item_.second = std::move(value);
+}
+
 /*
   ---------------------------------------
   End implementations for the Node class.
   ---------------------------------------
 */
 
+/**
+* What BinarySearchTree::validate() found in one pass over a tree. The
+* mismatch counters are all zero and countMatches is set for a sound
+* tree; balanced and height describe its shape.
+*/
+struct TreeValidation
+{
+    TreeValidation();
+    bool valid() const;
+    void merge(const TreeValidation& other);
+
+    // no node's subtrees differ in height by more than one
+    bool balanced;
+    // levels on the longest root-to-leaf path, 0 when empty
+    int height;
+    // nodes reached from the root
+    size_t nodes;
+    // nodes reached equals size()
+    bool countMatches;
+    // in-order neighbours whose keys are not strictly increasing
+    size_t orderViolations;
+    // children (or the root) whose parent pointer is wrong
+    size_t parentMismatches;
+    // AVL nodes whose stored balance is not right height - left height
+    size_t balanceMismatches;
+    // AVL nodes whose stored subtree size is wrong
+    size_t sizeMismatches;
+};
+
+/**
+* An empty, sound result.
+*/
+inline TreeValidation::TreeValidation() :
+    balanced(true),
+    height(0),
+    nodes(0),
+    countMatches(true),
+    orderViolations(0),
+    parentMismatches(0),
+    balanceMismatches(0),
+    sizeMismatches(0)
+{
+
+}
+
+/**
+* Returns true if nothing is wrong with the links or bookkeeping.
+* Balance is reported separately, as plain BSTs need not be balanced.
+*/
+inline bool TreeValidation::valid() const
+{
+    return countMatches && orderViolations == 0 && parentMismatches == 0 &&
+           balanceMismatches == 0 && sizeMismatches == 0;
+}
+
+/**
+* Adds the counters of other, checked over a disjoint part of the tree.
+*/
+inline void TreeValidation::merge(const TreeValidation& other)
+{
+    balanced = balanced && other.balanced;
+    nodes += other.nodes;
+    orderViolations += other.orderViolations;
+    parentMismatches += other.parentMismatches;
+    balanceMismatches += other.balanceMismatches;
+    sizeMismatches += other.sizeMismatches;
+}
+
 /**
 * A templated unbalanced binary search tree.
 */
@@ -193,14 +299,24 @@ template <typename Key, typename Value>
 class BinarySearchTree
 {
 public:
+    class iterator;
+
     BinarySearchTree(); //TODO
     virtual ~BinarySearchTree(); //TODO
-    virtual void insert(const std::pair<const Key, Value>& keyValuePair); //TODO
+    virtual std::pair<iterator, bool> insert(const std::pair<const Key, Value>& keyValuePair); //TODO
+    template<typename P>
+    typename std::enable_if<std::is_constructible<std::pair<Key, Value>, P&&>::value, std::pair<iterator, bool> >::type
+    insert(P&& keyValuePair);
     virtual void remove(const Key& key); //TODO
     void clear(); //TODO
     bool isBalanced() const; //TODO
+    TreeValidation validate(unsigned threads = 0) const;
     void print() const;
     bool empty() const;
+    size_t size() const;
+    void enableNodePool(size_t nodesPerSlab = 1024);
+    void setInsertOnMissing(bool enable);
+    void setDeferredClear(bool enable);
 
     template<typename PPKey, typename PPValue>
     friend void prettyPrintBST(BinarySearchTree<PPKey, PPValue> & tree);
@@ -234,9 +350,66 @@ public:
     Value& operator[](const Key& key);
     Value const & operator[](const Key& key) const;
 
+    /**
+    * A pair of iterators over a key range, usable in range-based for loops.
+    */
+    class range_view
+    {
+    public:
+        range_view(iterator first, iterator last);
+
+        iterator begin() const;
+        iterator end() const;
+        bool empty() const;
+
+    private:
+        iterator first_;
+        iterator last_;
+    };
+
+    // ordered lookups: one descent, then stream with operator++
+    iterator lower_bound(const Key& key) const;
+    iterator upper_bound(const Key& key) const;
+    std::pair<iterator, iterator> equal_range(const Key& key) const;
+    range_view range(const Key& low, const Key& high) const;
+
+    // many lookups at once, descending in lock-step so their cache
+    // misses overlap; out[i] is find(keys[i])
+    void findBatch(const Key* keys, size_t n, iterator* out) const;
+
+    // hinted insertion: O(1) amortized when the new key belongs
+    // right before hint (hint may be end() when appending in order)
+    iterator insert(iterator hint, const std::pair<const Key, Value>& keyValuePair);
+    template<typename... Args>
+    iterator emplace_hint(iterator hint, Args&&... args);
+
+    // move-aware insertion; key and value are moved into the node
+    template<typename... Args>
+    std::pair<iterator, bool> emplace(Args&&... args);
+    template<typename... Args>
+    std::pair<iterator, bool> try_emplace(const Key& key, Args&&... args);
+    template<typename... Args>
+    std::pair<iterator, bool> try_emplace(Key&& key, Args&&... args);
+    template<typename M>
+    std::pair<iterator, bool> insert_or_assign(const Key& key, M&& value);
+    template<typename M>
+    std::pair<iterator, bool> insert_or_assign(Key&& key, M&& value);
+
+    // parallel scans over independent subtrees; threads == 0 uses every
+    // hardware thread
+    template<typename Function>
+    void parallel_for_each(Function fn, unsigned threads = 0) const;
+    template<typename T, typename Map, typename Combine>
+    T parallel_reduce(T init, Map map, Combine combine, unsigned threads = 0) const;
+
 protected:
     // Mandatory helper functions
     Node<Key, Value>* internalFind(const Key& k) const; // TODO
+    Node<Key, Value>* lowerBoundNode(const Key& key) const;
+    Node<Key, Value>* upperBoundNode(const Key& key) const;
+    // lookups findBatch advances together
+    static const size_t batchWidth = 16;
+    void findNodes(const Key* keys, size_t n, Node<Key, Value>** out) const;
     Node<Key, Value> *getSmallestNode() const;  // TODO
     static Node<Key, Value>* predecessor(Node<Key, Value>* current); // TODO
     // Note:  static means these functions don't have a "this" pointer
@@ -248,14 +421,63 @@ protected:
 
     // Add helper functions here
 
+    Node<Key, Value>* getLargestNode() const;
     static Node<Key, Value>* successor(Node<Key, Value>* current);
     void clearContents(Node<Key, Value>* node);
-    int calcHeight(Node<Key, Value>* node) const;
-    bool helpBalance(Node<Key, Value>* node) const;
+    template<typename Destroy>
+    static void destroySubtree(Node<Key, Value>* node, Destroy& destroy);
+    virtual void deferClear(Node<Key, Value>* root);
+    template<typename NodeType>
+    void deferSubtree(Node<Key, Value>* root);
+
+    // validate(): the tree above depth is checked on the calling thread,
+    // the subtrees below it in parallel
+    struct SubtreeCheck
+    {
+        TreeValidation report;
+        const Key* first;
+        const Key* last;
+    };
+    void collectFrontier(Node<Key, Value>* node, int depth, std::vector<Node<Key, Value>*>& frontier) const;
+    void checkSubtree(Node<Key, Value>* root, SubtreeCheck& check) const;
+    int checkTop(Node<Key, Value>* node, int depth, const std::vector<SubtreeCheck>& checks, size_t& next,
+                 const Key*& previous, TreeValidation& report) const;
+    void checkLinks(Node<Key, Value>* node, int leftHeight, int rightHeight, TreeValidation& report) const;
+    virtual void checkNode(Node<Key, Value>* node, int leftHeight, int rightHeight, TreeValidation& report) const;
+
+    // node allocation, routed through the pool when one is enabled
+    virtual Node<Key, Value>* createNode(const Key& key, const Value& value, Node<Key, Value>* parent);
+    virtual Node<Key, Value>* createNode(Key&& key, Value&& value, Node<Key, Value>* parent);
+    virtual void destroyNode(Node<Key, Value>* node);
+    virtual bool trivialNodeDestruction() const;
+    template<typename NodeType, typename K, typename V>
+    NodeType* allocNode(K&& key, V&& value, NodeType* parent);
+    void freeNodeMemory(void* mem);
+
+    // insertion plumbing shared by every insert flavour
+    Node<Key, Value>* findSlot(const Key& key, Node<Key, Value>*& parent, bool& isLeft) const;
+    Node<Key, Value>* findSlotNear(Node<Key, Value>* hint, const Key& key, Node<Key, Value>*& parent, bool& isLeft) const;
+    void linkNode(Node<Key, Value>* node, Node<Key, Value>* parent, bool isLeft);
+    std::pair<Node<Key, Value>*, bool> placeItem(Key&& key, Value&& value, Node<Key, Value>* hint, bool useHint);
+    virtual void insertFix(Node<Key, Value>* node);
+    virtual void valueChanged(Node<Key, Value>* node);
+    void unlinkBookkeeping(Node<Key, Value>* node);
+
+    // work split for the parallel scans, cut this many levels down
+    static const int scanDepth = 8;
+    void collectPieces(Node<Key, Value>* node, int depth, std::vector<std::pair<Node<Key, Value>*, bool> >& pieces) const;
+    template<typename Function>
+    static void visitSubtree(Node<Key, Value>* root, Function& fn);
+    template<typename Task>
+    static void runPieces(size_t count, unsigned threads, Task& task);
 
 protected:
     Node<Key, Value>* root_;
-    // You should not need other data members
+    Node<Key, Value>* rightmost_;
+    std::shared_ptr<NodePool> pool_;
+    bool insertOnMissing_;
+    bool deferredClear_;
+    size_t count_;
 };
 
 /*
@@ -366,6 +588,46 @@ End implementations for the BinarySearchTree::iterator class.
 -------------------------------------------------------------
 */
 
+/**
+* Creates a view over [first, last).
+*/
+template<class Key, class Value>
+BinarySearchTree<Key, Value>::range_view::range_view(iterator first, iterator last) :
+    first_(first),
+    last_(last)
+{
+
+}
+
+/**
+* Returns an iterator to the first item of the range.
+*/
+template<class Key, class Value>
+typename BinarySearchTree<Key, Value>::iterator
+BinarySearchTree<Key, Value>::range_view::begin() const
+{
+    return first_;
+}
+
+/**
+* Returns an iterator just past the last item of the range.
+*/
+template<class Key, class Value>
+typename BinarySearchTree<Key, Value>::iterator
+BinarySearchTree<Key, Value>::range_view::end() const
+{
+    return last_;
+}
+
+/**
+* Returns true iff the range holds no items.
+*/
+template<class Key, class Value>
+bool BinarySearchTree<Key, Value>::range_view::empty() const
+{
+    return first_ == last_;
+}
+
 /*
 -----------------------------------------------------
 Begin implementations for the BinarySearchTree class.
@@ -380,8 +642,17 @@ BinarySearchTree<Key, Value>::BinarySearchTree()
 {
     // TODO
     root_ = nullptr;
+    rightmost_ = nullptr;
+    insertOnMissing_ = false;
+    deferredClear_ = false;
+    count_ = 0;
 }
 
+/**
+* Destructor. Virtual calls made from here resolve to this class, so
+* every derived tree that overrides destroyNode() or deferClear() must clear() in its own
+* destructor first.
+*/
 template<typename Key, typename Value>
 BinarySearchTree<Key, Value>::~BinarySearchTree()
 {
@@ -399,6 +670,54 @@ bool BinarySearchTree<Key, Value>::empty() const
     return root_ == NULL;
 }
 
+/**
+* Switches node allocation over to a slab pool holding nodesPerSlab nodes
+* per slab. Removed nodes are recycled through the pool's freelist and
+* clear() hands all slabs back at once. Only allowed on an empty tree.
+* Trees split off an AVLTree draw on the same slabs through a pool of
+* their own (see NodePool::share()); the slabs are then only handed back
+* once the last of them is gone.
+*/
+template<class Key, class Value>
+void BinarySearchTree<Key, Value>::enableNodePool(size_t nodesPerSlab)
+{
+    if(!empty()) throw std::logic_error("Node pool must be enabled on an empty tree");
+    pool_ = std::make_shared<NodePool>(nodesPerSlab);
+}
+
+/**
+* Chooses what the non-const operator[] does with a missing key: throw
+* std::out_of_range (the default) or insert a default-constructed value.
+*/
+template<class Key, class Value>
+void BinarySearchTree<Key, Value>::setInsertOnMissing(bool enable)
+{
+    insertOnMissing_ = enable;
+}
+
+/**
+* Chooses how clear() and the destructor free the nodes: on the calling
+* thread (the default), or by handing the detached nodes to the
+* NodeReclaimer thread and returning at once. A pooled tree hands over
+* its pool too and starts a fresh one; nodes in slabs shared with split
+* off trees are still freed on the calling thread. Call
+* NodeReclaimer::instance().drain() to wait for deferred work.
+*/
+template<class Key, class Value>
+void BinarySearchTree<Key, Value>::setDeferredClear(bool enable)
+{
+    deferredClear_ = enable;
+}
+
+/**
+ * Returns the number of items in the tree in O(1)
+*/
+template<class Key, class Value>
+size_t BinarySearchTree<Key, Value>::size() const
+{
+    return count_;
+}
+
 template<typename Key, typename Value>
 void BinarySearchTree<Key, Value>::print() const
 {
@@ -441,13 +760,153 @@ BinarySearchTree<Key, Value>::find(const Key & k) const
     return it;
 }
 
+template<class Key, class Value>
+const size_t BinarySearchTree<Key, Value>::batchWidth;
+
+/**
+* Looks up keys[0..n) and stores find(keys[i]) in out[i]. The lookups go
+* batchWidth at a time, see findNodes().
+*/
+template<class Key, class Value>
+void BinarySearchTree<Key, Value>::findBatch(const Key* keys, size_t n, iterator* out) const
+{
+    Node<Key, Value>* found[batchWidth];
+    for(size_t base = 0; base < n; base += batchWidth) {
+        size_t width = std::min(batchWidth, n - base);
+        findNodes(keys + base, width, found);
+        for(size_t i = 0; i < width; ++i) {
+            out[base + i] = iterator(found[i]);
+        }
+    }
+}
+
+/**
+* Returns an iterator to the first item whose key is not less than key,
+* or end() if there is none.
+*/
+template<class Key, class Value>
+typename BinarySearchTree<Key, Value>::iterator
+BinarySearchTree<Key, Value>::lower_bound(const Key& key) const
+{
+    return iterator(lowerBoundNode(key));
+}
+
+/**
+* Returns an iterator to the first item whose key is greater than key,
+* or end() if there is none.
+*/
+template<class Key, class Value>
+typename BinarySearchTree<Key, Value>::iterator
+BinarySearchTree<Key, Value>::upper_bound(const Key& key) const
+{
+    return iterator(upperBoundNode(key));
+}
+
+/**
+* Returns the range of items whose key equals key (empty or one item).
+*/
+template<class Key, class Value>
+std::pair<typename BinarySearchTree<Key, Value>::iterator, typename BinarySearchTree<Key, Value>::iterator>
+BinarySearchTree<Key, Value>::equal_range(const Key& key) const
+{
+    Node<Key, Value>* first = lowerBoundNode(key);
+    Node<Key, Value>* last = first;
+    if(first != nullptr && !(key < first->getKey())){
+        last = successor(first);
+    }
+    return std::make_pair(iterator(first), iterator(last));
+}
+
+/**
+* Returns a view of the items with low <= key < high. Finding both ends
+* takes O(log n); iterating the view walks successors as usual.
+*/
+template<class Key, class Value>
+typename BinarySearchTree<Key, Value>::range_view
+BinarySearchTree<Key, Value>::range(const Key& low, const Key& high) const
+{
+    if(!(low < high)){
+        return range_view(end(), end());
+    }
+    return range_view(lower_bound(low), lower_bound(high));
+}
+
+/**
+* Calls fn(item) on every item, from up to threads threads at once, so
+* fn must be safe to call concurrently. Each subtree is walked in key
+* order, but there is no order between subtrees. The tree must not be
+* modified while this runs.
+*/
+template<class Key, class Value>
+template<typename Function>
+void BinarySearchTree<Key, Value>::parallel_for_each(Function fn, unsigned threads) const
+{
+    std::vector<std::pair<Node<Key, Value>*, bool> > pieces;
+    collectPieces(root_, scanDepth, pieces);
+
+    auto task = [&](size_t i) {
+        if(pieces[i].second) {
+            visitSubtree(pieces[i].first, fn);
+        }
+        else {
+            fn(pieces[i].first->getItem());
+        }
+    };
+    runPieces(pieces.size(), threads, task);
+}
+
+/**
+* Returns combine(...combine(combine(init, map(x1)), map(x2))..., map(xn))
+* over the items in key order, computing the pieces in parallel. combine
+* must be associative and T default constructible. The tree is always cut
+* into the same pieces, whatever threads is, and the piece results are
+* combined in key order, so the result does not depend on thread count
+* or scheduling.
+*/
+template<class Key, class Value>
+template<typename T, typename Map, typename Combine>
+T BinarySearchTree<Key, Value>::parallel_reduce(T init, Map map, Combine combine, unsigned threads) const
+{
+    std::vector<std::pair<Node<Key, Value>*, bool> > pieces;
+    collectPieces(root_, scanDepth, pieces);
+    std::vector<T> results(pieces.size());
+
+    auto task = [&](size_t i) {
+        if(!pieces[i].second) {
+            results[i] = map(pieces[i].first->getItem());
+            return;
+        }
+        bool first = true;
+        T& result = results[i];
+        auto fold = [&](std::pair<const Key, Value>& item) {
+            if(first) {
+                result = map(item);
+                first = false;
+            }
+            else {
+                result = combine(result, map(item));
+            }
+        };
+        visitSubtree(pieces[i].first, fold);
+    };
+    runPieces(pieces.size(), threads, task);
+
+    for(size_t i = 0; i < results.size(); ++i) {
+        init = combine(init, results[i]);
+    }
+    return init;
+}
+
 /**
- * @precondition The key exists in the map
+ * @precondition The key exists in the map, unless setInsertOnMissing(true)
+ * was called, in which case a missing key is inserted with a
+ * default-constructed value (like std::map) in the same descent.
  * Returns the value associated with the key
  */
 template<class Key, class Value>
 Value& BinarySearchTree<Key, Value>::operator[](const Key& key)
 {
+    if(insertOnMissing_) return try_emplace(key).first->second;
     Node<Key, Value> *curr = internalFind(key);
     if(curr == NULL) throw std::out_of_range("Invalid key");
     return curr->getValue();
@@ -465,84 +924,396 @@ Value const & BinarySearchTree<Key, Value>::operator[](const Key& key) const
 * The tree will not remain balanced when inserting.
 * Recall: If key is already in the tree, you should 
 * overwrite the current value with the updated value.
+* Returns an iterator to the item and whether a new node was
+* created, found with a single descent.
 */
 template<class Key, class Value>
-void BinarySearchTree<Key, Value>::insert(const std::pair<const Key, Value> &keyValuePair)
+std::pair<typename BinarySearchTree<Key, Value>::iterator, bool>
+BinarySearchTree<Key, Value>::insert(const std::pair<const Key, Value> &keyValuePair)
 {
     // TODO
 
-    if(empty()){
-        // empty tree, create new node, and set it as the root
-        root_ = new Node<Key, Value>(keyValuePair.first, keyValuePair.second, nullptr);
-        return;
+    Node<Key, Value>* parentNode = nullptr;
+    bool isLeft = false;
+    Node<Key, Value>* existing = findSlot(keyValuePair.first, parentNode, isLeft);
+
+    if(existing != nullptr){
+        // update value if key exists
+        existing->setValue(keyValuePair.second);
+        valueChanged(existing);
+        return std::make_pair(iterator(existing), false);
     }
 
-    // ptrs to traerse tree
-    Node<Key, Value>* currentNode = root_;
+    // new node w found parent
+    Node<Key, Value>* newNode = createNode(keyValuePair.first, keyValuePair.second, parentNode);
+    linkNode(newNode, parentNode, isLeft);
+    return std::make_pair(iterator(newNode), true);
+}
+
+/**
+* Inserts keyValuePair using hint as a starting point. If the key belongs
+* immediately before hint (or after the last key when hint is end()),
+* the root descent is skipped and only the fix-up after linking remains.
+* A wrong hint just falls back to the normal descent. Like insert(), an
+* existing key has its value overwritten. Returns an iterator to the item.
+*/
+template<class Key, class Value>
+typename BinarySearchTree<Key, Value>::iterator
+BinarySearchTree<Key, Value>::insert(iterator hint, const std::pair<const Key, Value>& keyValuePair)
+{
     Node<Key, Value>* parentNode = nullptr;
+    bool isLeft = false;
+    Node<Key, Value>* existing = findSlotNear(hint.current_, keyValuePair.first, parentNode, isLeft);
 
+    if(existing != nullptr){
+        existing->setValue(keyValuePair.second);
+        valueChanged(existing);
+        return iterator(existing);
+    }
 
-    while(currentNode != nullptr){
+    Node<Key, Value>* newNode = createNode(keyValuePair.first, keyValuePair.second, parentNode);
+    linkNode(newNode, parentNode, isLeft);
+    return iterator(newNode);
+}
 
-        // update parent to current
-        parentNode = currentNode;
+/**
+* Insert overload for pairs that can be moved from (or converted), such as
+* the result of std::make_pair. The key and value are moved into the node.
+*/
+template<class Key, class Value>
+template<typename P>
+typename std::enable_if<std::is_constructible<std::pair<Key, Value>, P&&>::value,
+                        std::pair<typename BinarySearchTree<Key, Value>::iterator, bool> >::type
+BinarySearchTree<Key, Value>::insert(P&& keyValuePair)
+{
+    std::pair<Key, Value> item(std::forward<P>(keyValuePair));
+    std::pair<Node<Key, Value>*, bool> placed = placeItem(std::move(item.first), std::move(item.second), nullptr, false);
+    return std::make_pair(iterator(placed.first), placed.second);
+}
 
-        if(keyValuePair.first < currentNode->getKey()){
-            // left subtree since key smalelr
-            currentNode = currentNode->getLeft();
-        }
-        else if(keyValuePair.first > currentNode->getKey()){
-            // right subtree since key is larger
-            currentNode = currentNode->getRight();
-        }
-        else{
-            // update value if key exists
-            currentNode->setValue(keyValuePair.second);
-            return;
-        }
-    }
+/**
+* Builds the item from args and inserts it with hint as in insert(hint, item).
+* The key and value are moved into the node rather than copied.
+*/
+template<class Key, class Value>
+template<typename... Args>
+typename BinarySearchTree<Key, Value>::iterator
+BinarySearchTree<Key, Value>::emplace_hint(iterator hint, Args&&... args)
+{
+    std::pair<Key, Value> item(std::forward<Args>(args)...);
+    return iterator(placeItem(std::move(item.first), std::move(item.second), hint.current_, true).first);
+}
 
-    // new node w found parent
-    Node<Key, Value>* newNode = new Node<Key,Value>(keyValuePair.first, keyValuePair.second, parentNode);
-    
-    // add new node to the croresponding parent
-    if(keyValuePair.first < parentNode->getKey()){
-        parentNode->setLeft(newNode);
-    } 
-    else{
-        parentNode->setRight(newNode);
-    }
+/**
+* Builds the item from args (anything std::pair accepts, including
+* std::piecewise_construct) and moves it into a new node. Follows the same
+* rule as insert(): an existing key has its value overwritten. Returns an
+* iterator to the item and whether a new node was created.
+*/
+template<class Key, class Value>
+template<typename... Args>
+std::pair<typename BinarySearchTree<Key, Value>::iterator, bool>
+BinarySearchTree<Key, Value>::emplace(Args&&... args)
+{
+    std::pair<Key, Value> item(std::forward<Args>(args)...);
+    std::pair<Node<Key, Value>*, bool> placed = placeItem(std::move(item.first), std::move(item.second), nullptr, false);
+    return std::make_pair(iterator(placed.first), placed.second);
 }
 
+/**
+* Inserts key with a value built from args, but only if key is not in the
+* tree yet. Unlike emplace(), nothing is constructed when the key exists.
+*/
+template<class Key, class Value>
+template<typename... Args>
+std::pair<typename BinarySearchTree<Key, Value>::iterator, bool>
+BinarySearchTree<Key, Value>::try_emplace(const Key& key, Args&&... args)
+{
+    Node<Key, Value>* parentNode = nullptr;
+    bool isLeft = false;
+    Node<Key, Value>* existing = findSlot(key, parentNode, isLeft);
+    if(existing != nullptr){
+        return std::make_pair(iterator(existing), false);
+    }
+
+    Node<Key, Value>* newNode = createNode(Key(key), Value(std::forward<Args>(args)...), parentNode);
+    linkNode(newNode, parentNode, isLeft);
+    return std::make_pair(iterator(newNode), true);
+}
 
 /**
-* A remove method to remove a specific key from a Binary Search Tree.
-* Recall: The writeup specifies that if a node has 2 children you
-* should swap with the predecessor and then remove.
+* Same as above, moving the key into the new node.
 */
-template<typename Key, typename Value>
-void BinarySearchTree<Key, Value>::remove(const Key& key)
+template<class Key, class Value>
+template<typename... Args>
+std::pair<typename BinarySearchTree<Key, Value>::iterator, bool>
+BinarySearchTree<Key, Value>::try_emplace(Key&& key, Args&&... args)
 {
-    // TODO
-    Node<Key,Value>* removeNode = internalFind(key);
+    Node<Key, Value>* parentNode = nullptr;
+    bool isLeft = false;
+    Node<Key, Value>* existing = findSlot(key, parentNode, isLeft);
+    if(existing != nullptr){
+        return std::make_pair(iterator(existing), false);
+    }
 
-    // no key found
-    if(removeNode == nullptr){
-        return;
+    Node<Key, Value>* newNode = createNode(std::move(key), Value(std::forward<Args>(args)...), parentNode);
+    linkNode(newNode, parentNode, isLeft);
+    return std::make_pair(iterator(newNode), true);
+}
+
+/**
+* Inserts key with value, or assigns value to it if key is already there,
+* in a single descent. Returns an iterator to the item and whether a new
+* node was created.
+*/
+template<class Key, class Value>
+template<typename M>
+std::pair<typename BinarySearchTree<Key, Value>::iterator, bool>
+BinarySearchTree<Key, Value>::insert_or_assign(const Key& key, M&& value)
+{
+    Node<Key, Value>* parentNode = nullptr;
+    bool isLeft = false;
+    Node<Key, Value>* existing = findSlot(key, parentNode, isLeft);
+    if(existing != nullptr){
+        existing->getValue() = std::forward<M>(value);
+        valueChanged(existing);
+        return std::make_pair(iterator(existing), false);
     }
 
-    // node has two children
-    if(removeNode->getLeft() != nullptr && removeNode->getRight() != nullptr){
-        Node<Key,Value>* pred = predecessor(removeNode);
-        // swap it w prededceso
-        nodeSwap(removeNode, pred);
+    Node<Key, Value>* newNode = createNode(Key(key), Value(std::forward<M>(value)), parentNode);
+    linkNode(newNode, parentNode, isLeft);
+    return std::make_pair(iterator(newNode), true);
+}
+
+/**
+* Same as above, moving the key into the new node.
+*/
+template<class Key, class Value>
+template<typename M>
+std::pair<typename BinarySearchTree<Key, Value>::iterator, bool>
+BinarySearchTree<Key, Value>::insert_or_assign(Key&& key, M&& value)
+{
+    Node<Key, Value>* parentNode = nullptr;
+    bool isLeft = false;
+    Node<Key, Value>* existing = findSlot(key, parentNode, isLeft);
+    if(existing != nullptr){
+        existing->getValue() = std::forward<M>(value);
+        valueChanged(existing);
+        return std::make_pair(iterator(existing), false);
     }
 
-    // only one child left in removeNode!
+    Node<Key, Value>* newNode = createNode(std::move(key), Value(std::forward<M>(value)), parentNode);
+    linkNode(newNode, parentNode, isLeft);
+    return std::make_pair(iterator(newNode), true);
+}
 
-    // only right child
-    if(removeNode->getLeft() == nullptr && removeNode->getRight() != nullptr){
-       
+/**
+* Moves key/value into the tree, overwriting the value if key is already
+* present. With useHint set, the slot is looked up next to hint (NULL
+* meaning end()). Returns the node holding key and whether it is new.
+*/
+template<class Key, class Value>
+std::pair<Node<Key, Value>*, bool>
+BinarySearchTree<Key, Value>::placeItem(Key&& key, Value&& value, Node<Key, Value>* hint, bool useHint)
+{
+    Node<Key, Value>* parentNode = nullptr;
+    bool isLeft = false;
+    Node<Key, Value>* existing = useHint ? findSlotNear(hint, key, parentNode, isLeft)
+                                         : findSlot(key, parentNode, isLeft);
+    if(existing != nullptr){
+        existing->setValue(std::move(value));
+        valueChanged(existing);
+        return std::make_pair(existing, false);
+    }
+
+    Node<Key, Value>* newNode = createNode(std::move(key), std::move(value), parentNode);
+    linkNode(newNode, parentNode, isLeft);
+    return std::make_pair(newNode, true);
+}
+
+/**
+* Descends from the root looking for key. Returns the node holding key,
+* or NULL when it is absent, in which case parent/isLeft describe the
+* empty child slot where it belongs (parent is NULL for an empty tree).
+*/
+template<class Key, class Value>
+Node<Key, Value>* BinarySearchTree<Key, Value>::findSlot(const Key& key, Node<Key, Value>*& parent, bool& isLeft) const
+{
+    // ptrs to traerse tree
+    Node<Key, Value>* currentNode = root_;
+    parent = nullptr;
+    isLeft = false;
+
+    while(currentNode != nullptr){
+
+        // update parent to current
+        parent = currentNode;
+
+        if(key < currentNode->getKey()){
+            // left subtree since key smalelr
+            currentNode = currentNode->getLeft();
+            isLeft = true;
+        }
+        else if(currentNode->getKey() < key){
+            // right subtree since key is larger
+            currentNode = currentNode->getRight();
+            isLeft = false;
+        }
+        else{
+            return currentNode;
+        }
+    }
+    return nullptr;
+}
+
+/**
+* Same contract as findSlot(), but first checks whether key belongs right
+* before hint (NULL meaning end()). That check looks at hint and one
+* neighbour, which is O(1) amortized over an in-order walk.
+*/
+template<class Key, class Value>
+Node<Key, Value>* BinarySearchTree<Key, Value>::findSlotNear(Node<Key, Value>* hint, const Key& key, Node<Key, Value>*& parent, bool& isLeft) const
+{
+    if(root_ == nullptr){
+        parent = nullptr;
+        isLeft = false;
+        return nullptr;
+    }
+
+    if(hint == nullptr){
+        // appending after the largest key
+        if(rightmost_->getKey() < key){
+            parent = rightmost_;
+            isLeft = false;
+            return nullptr;
+        }
+    }
+    else if(key < hint->getKey()){
+        // goes between hint's predecessor and hint
+        Node<Key, Value>* before = predecessor(hint);
+        if(before == nullptr || before->getKey() < key){
+            if(hint->getLeft() == nullptr){
+                parent = hint;
+                isLeft = true;
+            }
+            else{
+                parent = before;
+                isLeft = false;
+            }
+            return nullptr;
+        }
+    }
+    else if(hint->getKey() < key){
+        // goes between hint and its successor
+        Node<Key, Value>* after = (hint == rightmost_) ? nullptr : successor(hint);
+        if(after == nullptr || key < after->getKey()){
+            if(hint->getRight() == nullptr){
+                parent = hint;
+                isLeft = false;
+            }
+            else{
+                parent = after;
+                isLeft = true;
+            }
+            return nullptr;
+        }
+    }
+    else{
+        return hint;
+    }
+
+    // bad hint
+    return findSlot(key, parent, isLeft);
+}
+
+/**
+* Hangs a freshly created node off the slot found by findSlot() and
+* lets the tree restore its invariants through insertFix().
+*/
+template<class Key, class Value>
+void BinarySearchTree<Key, Value>::linkNode(Node<Key, Value>* node, Node<Key, Value>* parent, bool isLeft)
+{
+    node->setParent(parent);
+    ++count_;
+    if(parent == nullptr){
+        // empty tree, new node is the root
+        root_ = node;
+        rightmost_ = node;
+    }
+    else if(isLeft){
+        parent->setLeft(node);
+    }
+    else{
+        parent->setRight(node);
+        if(parent == rightmost_){
+            rightmost_ = node;
+        }
+    }
+    insertFix(node);
+}
+
+/**
+* Called after a new leaf has been linked in. A plain BST has nothing to fix.
+*/
+template<class Key, class Value>
+void BinarySearchTree<Key, Value>::insertFix(Node<Key, Value>* node)
+{
+
+}
+
+/**
+* Called after insert overwrote the value of an existing node. Trees that
+* keep data derived from values refresh it here; a plain BST does not.
+*/
+template<class Key, class Value>
+void BinarySearchTree<Key, Value>::valueChanged(Node<Key, Value>* node)
+{
+
+}
+
+/**
+* Updates the item count and cached tree bounds before node (which has
+* at most one child) is unlinked by remove().
+*/
+template<class Key, class Value>
+void BinarySearchTree<Key, Value>::unlinkBookkeeping(Node<Key, Value>* node)
+{
+    --count_;
+    if(node == rightmost_){
+        rightmost_ = predecessor(node);
+    }
+}
+
+
+/**
+* A remove method to remove a specific key from a Binary Search Tree.
+* Recall: The writeup specifies that if a node has 2 children you
+* should swap with the predecessor and then remove.
+*/
+template<typename Key, typename Value>
+void BinarySearchTree<Key, Value>::remove(const Key& key)
+{
+    // TODO
+    Node<Key,Value>* removeNode = internalFind(key);
+
+    // no key found
+    if(removeNode == nullptr){
+        return;
+    }
+
+    // node has two children
+    if(removeNode->getLeft() != nullptr && removeNode->getRight() != nullptr){
+        Node<Key,Value>* pred = predecessor(removeNode);
+        // swap it w prededceso
+        nodeSwap(removeNode, pred);
+    }
+
+    // only one child left in removeNode!
+    unlinkBookkeeping(removeNode);
+
+    // only right child
+    if(removeNode->getLeft() == nullptr && removeNode->getRight() != nullptr){
+       
         Node<Key,Value>* child = removeNode->getRight();
        
         // update root ptr is remove is the root
@@ -562,7 +1333,7 @@ void BinarySearchTree<Key, Value>::remove(const Key& key)
             }
             child->setParent(parent);
         }
-        delete removeNode;
+        destroyNode(removeNode);
     } 
     else if(removeNode->getLeft() != nullptr && removeNode->getRight() == nullptr){
        // node only has left child
@@ -581,13 +1352,13 @@ void BinarySearchTree<Key, Value>::remove(const Key& key)
             }
             child->setParent(parent);
         }
-        delete removeNode;
+        destroyNode(removeNode);
     } 
     // now a leaf
     else if (removeNode->getLeft() == nullptr && removeNode->getRight() == nullptr){
         // delete it!
         if(removeNode == root_){
-            delete root_;
+            destroyNode(root_);
             root_ = nullptr;
         } 
         else {
@@ -599,7 +1370,7 @@ void BinarySearchTree<Key, Value>::remove(const Key& key)
                 parent->setRight(nullptr);
             }
 
-            delete removeNode;
+            destroyNode(removeNode);
         }
     }
 
@@ -681,30 +1452,272 @@ template<typename Key, typename Value>
 void BinarySearchTree<Key, Value>::clear()
 {
     // TODO
-    clearContents(root_);
+
+    // pooled nodes with nothing to destruct can go back slab by slab,
+    // unless another tree still has nodes in the same slabs
+    rightmost_ = nullptr;
+    count_ = 0;
+    bool ownsPool = pool_ != nullptr && pool_->ownsSlabs();
+    if(ownsPool && trivialNodeDestruction()){
+        pool_->release();
+        root_ = nullptr;
+        return;
+    }
+    Node<Key, Value>* root = root_;
     // set to nullptr
     root_= nullptr;
+    if(deferredClear_ && root != nullptr && (pool_ == nullptr || ownsPool)){
+        try {
+            deferClear(root);
+            return;
+        }
+        catch(...) {
+            // no memory to hand the nodes over; free them here instead
+        }
+    }
+    clearContents(root);
+    if(ownsPool){
+        pool_->release();
+    }
 }
 
-// helper function
+/**
+* Destroys every node under node with destroyNode(), without recursion
+* or allocation, so degenerate trees of any height are safe.
+*/
 template<typename Key, typename Value>
 void BinarySearchTree<Key,Value>::clearContents(Node<Key,Value>* node){
-    
-    if(node == nullptr){
+    auto destroy = [this](Node<Key, Value>* dead) { destroyNode(dead); };
+    destroySubtree(node, destroy);
+}
+
+/**
+* Calls destroy on every node under node in O(n) time and O(1) space:
+* while the current node has a left child it is rotated right, which
+* turns the tree into a right-leaning list one node at a time, and a
+* node without a left child is destroyed and its right child taken next.
+* Parent pointers are left stale, as the nodes are going away.
+*/
+template<typename Key, typename Value>
+template<typename Destroy>
+void BinarySearchTree<Key, Value>::destroySubtree(Node<Key, Value>* node, Destroy& destroy)
+{
+    while(node != nullptr){
+        Node<Key, Value>* left = node->getLeft();
+        if(left != nullptr){
+            node->setLeft(left->getRight());
+            left->setRight(node);
+            node = left;
+        }
+        else{
+            Node<Key, Value>* right = node->getRight();
+            destroy(node);
+            node = right;
+        }
+    }
+}
+
+/**
+* Hands the detached subtree under root to the NodeReclaimer. Trees with
+* their own node type override this to pass it to deferSubtree().
+*/
+template<typename Key, typename Value>
+void BinarySearchTree<Key, Value>::deferClear(Node<Key, Value>* root)
+{
+    deferSubtree<Node<Key, Value> >(root);
+}
+
+/**
+* Queues a task that runs ~NodeType on every node under root. Without a
+* pool the task frees each node too; a pooled tree gives the task its
+* pool, whose slabs go when the task is done, and allocates from a new
+* one. Called by clear() only when no other tree shares the pool.
+*/
+template<typename Key, typename Value>
+template<typename NodeType>
+void BinarySearchTree<Key, Value>::deferSubtree(Node<Key, Value>* root)
+{
+    std::shared_ptr<NodePool> pool = pool_;
+    std::shared_ptr<NodePool> fresh;
+    if(pool != nullptr){
+        fresh = std::make_shared<NodePool>(pool->blocksPerSlab());
+    }
+    NodeReclaimer::instance().defer([root, pool]() {
+        auto destroy = [&pool](Node<Key, Value>* dead) {
+            NodeType* node = static_cast<NodeType*>(dead);
+            node->~NodeType();
+            if(pool == nullptr){
+                ::operator delete(node);
+            }
+        };
+        destroySubtree(root, destroy);
+    });
+    if(pool != nullptr){
+        pool_ = fresh;
+    }
+}
+
+/**
+* Cuts the tree into pieces for the parallel scans, in key order: every
+* non-empty subtree depth levels below node (second == true) and every
+* node above that level on its own (second == false). The number of
+* pieces is bounded by both 2^(depth+1) and the size of the tree.
+*/
+template<typename Key, typename Value>
+void BinarySearchTree<Key, Value>::collectPieces(Node<Key, Value>* node, int depth, std::vector<std::pair<Node<Key, Value>*, bool> >& pieces) const
+{
+    if(node == nullptr) {
         return;
     }
-    // clear left
-    if (node->getLeft() != nullptr) {
-        clearContents(node->getLeft());
+    if(depth == 0) {
+        pieces.push_back(std::make_pair(node, true));
+        return;
     }
-    
-    // clear right
-    if (node->getRight() != nullptr) {
-        clearContents(node->getRight());
+    collectPieces(node->getLeft(), depth - 1, pieces);
+    pieces.push_back(std::make_pair(node, false));
+    collectPieces(node->getRight(), depth - 1, pieces);
+}
+
+/**
+* Calls fn(item) on every item of the subtree at root, in key order. Uses
+* its own stack rather than successor(), so it never climbs parent links
+* and never leaves the subtree.
+*/
+template<typename Key, typename Value>
+template<typename Function>
+void BinarySearchTree<Key, Value>::visitSubtree(Node<Key, Value>* root, Function& fn)
+{
+    std::vector<Node<Key, Value>*> stack;
+    Node<Key, Value>* current = root;
+    while(current != nullptr || !stack.empty()) {
+        while(current != nullptr) {
+            stack.push_back(current);
+            current = current->getLeft();
+        }
+        current = stack.back();
+        stack.pop_back();
+        fn(current->getItem());
+        current = current->getRight();
+    }
+}
+
+/**
+* Runs task(0) .. task(count - 1) on up to threads threads. Every thread
+* takes the next unclaimed index from a shared counter until none are
+* left, so threads that finish early pick up the remaining work. The
+* first exception thrown by a task is rethrown once all threads stop.
+*/
+template<typename Key, typename Value>
+template<typename Task>
+void BinarySearchTree<Key, Value>::runPieces(size_t count, unsigned threads, Task& task)
+{
+    if(threads == 0) {
+        threads = std::max(1u, std::thread::hardware_concurrency());
+    }
+    if(threads > count) {
+        threads = static_cast<unsigned>(count);
+    }
+
+    std::atomic<size_t> next(0);
+    std::atomic<bool> failed(false);
+    std::exception_ptr error;
+    std::mutex errorLock;
+    auto worker = [&]() {
+        for(size_t i = next++; i < count && !failed; i = next++) {
+            try {
+                task(i);
+            }
+            catch(...) {
+                std::lock_guard<std::mutex> guard(errorLock);
+                if(!error) {
+                    error = std::current_exception();
+                }
+                failed = true;
+            }
+        }
+    };
+
+    std::vector<std::thread> helpers;
+    for(unsigned t = 1; t < threads; ++t) {
+        helpers.push_back(std::thread(worker));
+    }
+    worker();
+    for(size_t t = 0; t < helpers.size(); ++t) {
+        helpers[t].join();
+    }
+    if(error) {
+        std::rethrow_exception(error);
+    }
+}
+
+/**
+* Creates a plain BST node. Overridden by trees that use a richer node type.
+*/
+template<typename Key, typename Value>
+Node<Key, Value>* BinarySearchTree<Key, Value>::createNode(const Key& key, const Value& value, Node<Key, Value>* parent)
+{
+    return allocNode<Node<Key, Value> >(key, value, parent);
+}
+
+/**
+* Same as above, moving the key and value into the node.
+*/
+template<typename Key, typename Value>
+Node<Key, Value>* BinarySearchTree<Key, Value>::createNode(Key&& key, Value&& value, Node<Key, Value>* parent)
+{
+    return allocNode<Node<Key, Value> >(std::move(key), std::move(value), parent);
+}
+
+/**
+* Destroys a node made by createNode() and returns its memory.
+*/
+template<typename Key, typename Value>
+void BinarySearchTree<Key, Value>::destroyNode(Node<Key, Value>* node)
+{
+    node->~Node();
+    freeNodeMemory(node);
+}
+
+/**
+* Returns true if destroying a node has no effect besides freeing its
+* memory, so that clear() may drop pooled nodes without visiting them.
+*/
+template<typename Key, typename Value>
+bool BinarySearchTree<Key, Value>::trivialNodeDestruction() const
+{
+    return std::is_trivially_destructible<std::pair<const Key, Value> >::value;
+}
+
+/**
+* Constructs a NodeType in memory taken from the pool, or from the
+* global heap when no pool is enabled.
+*/
+template<typename Key, typename Value>
+template<typename NodeType, typename K, typename V>
+NodeType* BinarySearchTree<Key, Value>::allocNode(K&& key, V&& value, NodeType* parent)
+{
+    void* mem = pool_ != nullptr ? pool_->allocate(sizeof(NodeType)) : ::operator new(sizeof(NodeType));
+    try {
+        return new (mem) NodeType(std::forward<K>(key), std::forward<V>(value), parent);
+    }
+    catch(...) {
+        freeNodeMemory(mem);
+        throw;
+    }
+}
+
+/**
+* Returns the memory of a destroyed node to wherever it came from.
+*/
+template<typename Key, typename Value>
+void BinarySearchTree<Key, Value>::freeNodeMemory(void* mem)
+{
+    if(pool_ != nullptr){
+        pool_->deallocate(mem);
+    }
+    else{
+        ::operator delete(mem);
     }
-    
-    // clear current
-    delete node;
 }
 
 
@@ -730,6 +1743,67 @@ BinarySearchTree<Key, Value>::getSmallestNode() const
     return current;
 }
 
+/**
+* A helper function to find the largest node in the tree.
+*/
+template<typename Key, typename Value>
+Node<Key, Value>*
+BinarySearchTree<Key, Value>::getLargestNode() const
+{
+    Node<Key, Value>* current = root_;
+    if (current == nullptr) {
+        return nullptr;
+    }
+
+    // rightmost
+    while (current->getRight() != nullptr) {
+        current = current->getRight();
+    }
+    return current;
+}
+
+/**
+* Runs internalFind for each of keys[0..n), n <= batchWidth, all at once:
+* every round moves each unfinished lookup down one level and prefetches
+* the node it lands on, so by the time the round comes back to it that
+* node is likely in cache. A lookup that stops waiting on memory no
+* longer stalls the others. Finished lookups are swapped out of the
+* active set.
+*/
+template<typename Key, typename Value>
+void BinarySearchTree<Key, Value>::findNodes(const Key* keys, size_t n, Node<Key, Value>** out) const
+{
+    Node<Key, Value>* cursor[batchWidth];
+    size_t slot[batchWidth];
+    for(size_t i = 0; i < n; ++i) {
+        cursor[i] = root_;
+        slot[i] = i;
+        out[i] = nullptr;
+    }
+
+    size_t active = n;
+    while(active > 0) {
+        for(size_t i = 0; i < active; ) {
+            Node<Key, Value>* node = cursor[i];
+            const Key& key = keys[slot[i]];
+            if(node != nullptr && !(key == node->getKey())) {
+                node = key < node->getKey() ? node->getLeft() : node->getRight();
+                if(node != nullptr) {
+                    __builtin_prefetch(node);
+                }
+                cursor[i] = node;
+                ++i;
+                continue;
+            }
+            // found, or fell off the tree
+            out[slot[i]] = node;
+            --active;
+            cursor[i] = cursor[active];
+            slot[i] = slot[active];
+        }
+    }
+}
+
 /**
 * Helper function to find a node with given key, k and
 * return a pointer to it or NULL if no item with that key
@@ -763,6 +1837,50 @@ Node<Key, Value>* BinarySearchTree<Key, Value>::internalFind(const Key& key) con
     return nullptr;
 }
 
+/**
+* Returns the node with the smallest key not less than key, or NULL.
+*/
+template<typename Key, typename Value>
+Node<Key, Value>* BinarySearchTree<Key, Value>::lowerBoundNode(const Key& key) const
+{
+    Node<Key, Value>* currentNode = root_;
+    Node<Key, Value>* best = nullptr;
+
+    while(currentNode != nullptr){
+        if(currentNode->getKey() < key){
+            currentNode = currentNode->getRight();
+        }
+        else{
+            // candidate, look for a smaller one on the left
+            best = currentNode;
+            currentNode = currentNode->getLeft();
+        }
+    }
+    return best;
+}
+
+/**
+* Returns the node with the smallest key greater than key, or NULL.
+*/
+template<typename Key, typename Value>
+Node<Key, Value>* BinarySearchTree<Key, Value>::upperBoundNode(const Key& key) const
+{
+    Node<Key, Value>* currentNode = root_;
+    Node<Key, Value>* best = nullptr;
+
+    while(currentNode != nullptr){
+        if(key < currentNode->getKey()){
+            // candidate, look for a smaller one on the left
+            best = currentNode;
+            currentNode = currentNode->getLeft();
+        }
+        else{
+            currentNode = currentNode->getRight();
+        }
+    }
+    return best;
+}
+
 /**
  * Return true iff the BST is balanced.
  */
@@ -770,52 +1888,181 @@ template<typename Key, typename Value>
 bool BinarySearchTree<Key, Value>::isBalanced() const
 {
     // TODO
-    return helpBalance(root_);
+    return validate(1).balanced;
 }
 
-// helper
+/**
+* Checks the whole tree in one O(n) pass and reports its height, whether
+* it is balanced, and how many keys are out of order, parent pointers are
+* wrong, or node bookkeeping (see checkNode()) is stale. The subtrees
+* scanDepth levels down are checked on up to threads threads at once
+* (threads == 0 uses every hardware thread), each with its own stack, so
+* degenerate trees are safe too. The tree must not be modified while this
+* runs.
+*/
 template<typename Key, typename Value>
-bool BinarySearchTree<Key,Value>::helpBalance(Node<Key,Value>* node) const{
-    
-    // no node?
-    if(node == nullptr){
-        // balanced
-        return true;
-    }
+TreeValidation BinarySearchTree<Key, Value>::validate(unsigned threads) const
+{
+    std::vector<Node<Key, Value>*> frontier;
+    collectFrontier(root_, scanDepth, frontier);
+    std::vector<SubtreeCheck> checks(frontier.size());
+    auto task = [&](size_t i) {
+        checkSubtree(frontier[i], checks[i]);
+    };
+    runPieces(frontier.size(), threads, task);
 
-    // get heights
-    int heightLeft = calcHeight(node->getLeft());
-    int heightRight = calcHeight(node->getRight());
+    TreeValidation report;
+    if(root_ != nullptr && root_->getParent() != nullptr){
+        ++report.parentMismatches;
+    }
+    size_t next = 0;
+    const Key* previous = nullptr;
+    report.height = checkTop(root_, scanDepth, checks, next, previous, report);
+    report.countMatches = report.nodes == count_;
+    return report;
+}
 
-    // not balanced
-    if (std::abs(heightLeft - heightRight) > 1) {
-        return false;
+/**
+* Appends, in key order, the non-empty subtrees depth levels below node.
+*/
+template<typename Key, typename Value>
+void BinarySearchTree<Key, Value>::collectFrontier(Node<Key, Value>* node, int depth, std::vector<Node<Key, Value>*>& frontier) const
+{
+    if(node == nullptr){
+        return;
     }
+    if(depth == 0){
+        frontier.push_back(node);
+        return;
+    }
+    collectFrontier(node->getLeft(), depth - 1, frontier);
+    collectFrontier(node->getRight(), depth - 1, frontier);
+}
 
-    // check balance of left and right subtree
-    bool isLeftBalanced = helpBalance(node->getLeft());
-    bool isRightBalanced = helpBalance(node->getRight());
-    
-    return isLeftBalanced && isRightBalanced;
+/**
+* Checks the subtree at root with an explicit stack: each node is
+* entered, revisited in key order once its left subtree is done (where
+* its key is compared with the previous one), and finished once its
+* right subtree is done, when both child heights are known.
+*/
+template<typename Key, typename Value>
+void BinarySearchTree<Key, Value>::checkSubtree(Node<Key, Value>* root, SubtreeCheck& check) const
+{
+    struct Frame
+    {
+        Node<Key, Value>* node;
+        int leftHeight;
+        int stage;
+    };
+    TreeValidation& report = check.report;
+    check.first = nullptr;
+    check.last = nullptr;
+
+    std::vector<Frame> stack;
+    Frame start = { root, 0, 0 };
+    stack.push_back(start);
+    int finished = 0;
+    while(!stack.empty()){
+        Frame& frame = stack.back();
+        Node<Key, Value>* node = frame.node;
+        if(frame.stage == 0){
+            frame.stage = 1;
+            Node<Key, Value>* left = node->getLeft();
+            if(left != nullptr){
+                Frame child = { left, 0, 0 };
+                stack.push_back(child);
+                continue;
+            }
+            finished = 0;
+        }
+        if(frame.stage == 1){
+            frame.stage = 2;
+            frame.leftHeight = finished;
+            const Key& key = node->getKey();
+            if(check.last != nullptr && !(*check.last < key)){
+                ++report.orderViolations;
+            }
+            if(check.first == nullptr){
+                check.first = &key;
+            }
+            check.last = &key;
+            ++report.nodes;
+            Node<Key, Value>* right = node->getRight();
+            if(right != nullptr){
+                Frame child = { right, 0, 0 };
+                stack.push_back(child);
+                continue;
+            }
+            finished = 0;
+        }
+        checkLinks(node, frame.leftHeight, finished, report);
+        finished = 1 + std::max(frame.leftHeight, finished);
+        stack.pop_back();
+    }
+    report.height = finished;
 }
 
-// helper
+/**
+* Checks the top levels of the tree, down to the subtrees checkSubtree()
+* did, whose results are taken from checks in key order. previous is the
+* last key seen so far. Returns the height of the subtree at node.
+*/
 template<typename Key, typename Value>
-int BinarySearchTree<Key,Value>::calcHeight(Node<Key,Value>* node) const{
-    
-    // null node
-    if(node==nullptr){
+int BinarySearchTree<Key, Value>::checkTop(Node<Key, Value>* node, int depth, const std::vector<SubtreeCheck>& checks, size_t& next,
+                                           const Key*& previous, TreeValidation& report) const
+{
+    if(node == nullptr){
         return 0;
     }
+    if(depth == 0){
+        const SubtreeCheck& check = checks[next++];
+        if(previous != nullptr && !(*previous < *check.first)){
+            ++report.orderViolations;
+        }
+        previous = check.last;
+        report.merge(check.report);
+        return check.report.height;
+    }
 
-    // left height
-    int heightLeft = calcHeight(node->getLeft());
+    int leftHeight = checkTop(node->getLeft(), depth - 1, checks, next, previous, report);
+    if(previous != nullptr && !(*previous < node->getKey())){
+        ++report.orderViolations;
+    }
+    previous = &node->getKey();
+    ++report.nodes;
+    int rightHeight = checkTop(node->getRight(), depth - 1, checks, next, previous, report);
+    checkLinks(node, leftHeight, rightHeight, report);
+    return 1 + std::max(leftHeight, rightHeight);
+}
 
-    // right height
-    int heightRight = calcHeight(node->getRight());
+/**
+* The checks made at every node once its child heights are known: the
+* children point back to it, the heights differ by at most one, and
+* whatever the tree adds in checkNode().
+*/
+template<typename Key, typename Value>
+void BinarySearchTree<Key, Value>::checkLinks(Node<Key, Value>* node, int leftHeight, int rightHeight, TreeValidation& report) const
+{
+    if(node->getLeft() != nullptr && node->getLeft()->getParent() != node){
+        ++report.parentMismatches;
+    }
+    if(node->getRight() != nullptr && node->getRight()->getParent() != node){
+        ++report.parentMismatches;
+    }
+    if(std::abs(leftHeight - rightHeight) > 1){
+        report.balanced = false;
+    }
+    checkNode(node, leftHeight, rightHeight, report);
+}
+
+/**
+* Hook for trees that keep bookkeeping in their nodes to check it against
+* the child heights (and the children). A plain BST keeps none.
+*/
+template<typename Key, typename Value>
+void BinarySearchTree<Key, Value>::checkNode(Node<Key, Value>* node, int leftHeight, int rightHeight, TreeValidation& report) const
+{
 
-    // height of current node 
-    return 1 + std::max(heightRight, heightLeft);
 }
 
 template<typename Key, typename Value>
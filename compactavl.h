@@ -0,0 +1,792 @@
+#ifndef COMPACTAVL_H
+#define COMPACTAVL_H
+
+#include <cstddef>
+#include <cstdint>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+/**
+* An AVL tree whose nodes live in one contiguous vector and link to each
+* other by 32-bit index instead of by pointer.
+*
+* A node holds its key, its value and two child indices, nothing else:
+* there is no parent link (updates keep their path on the call stack,
+* iterators keep theirs in a small stack) and no separate balance field.
+* The balance is packed into the top bit of each child index, one bit
+* for "left side taller" and one for "right side taller", which leaves
+* 31 bits, about two billion nodes, for the index itself. For
+* 8-byte keys and values a node is 24 bytes where AVLNode takes 56 plus
+* the allocator's own overhead.
+*
+* Removing a node moves the last node of the vector into its slot, so the
+* storage stays dense. Because links are indices the whole tree can be
+* copied or moved as one block of memory.
+*/
+template <typename Key, typename Value>
+class CompactAVLTree
+{
+public:
+    typedef std::pair<const Key&, Value&> reference;
+
+    CompactAVLTree();
+
+    class iterator;
+
+    std::pair<iterator, bool> insert(const std::pair<const Key, Value>& keyValuePair);
+    void remove(const Key& key);
+    void clear();
+    void reserve(size_t count);
+    bool isBalanced() const;
+    bool empty() const;
+    size_t size() const;
+    size_t memoryBytes() const;
+
+    /**
+    * An in-order iterator. It keeps the indices of the nodes still to be
+    * visited on the way back up, since nodes have no parent link, in a
+    * fixed array: an AVL tree of 2^31 nodes is less than 46 levels high.
+    */
+    class iterator
+    {
+    public:
+        /**
+        * What operator-> returns: holds the proxy pair so that
+        * it->first and it->second work.
+        */
+        class pointer
+        {
+        public:
+            explicit pointer(const reference& item) : item_(item) { }
+            const reference* operator->() const { return &item_; }
+
+        private:
+            reference item_;
+        };
+
+        iterator();
+
+        reference operator*() const;
+        pointer operator->() const;
+
+        bool operator==(const iterator& rhs) const;
+        bool operator!=(const iterator& rhs) const;
+
+        iterator& operator++();
+
+    protected:
+        friend class CompactAVLTree<Key, Value>;
+        explicit iterator(const CompactAVLTree<Key, Value>* tree);
+        iterator(const CompactAVLTree<Key, Value>* tree, uint32_t index);
+        void pushLeftSpine(uint32_t index);
+
+        static const int maxDepth = 48;
+
+        const CompactAVLTree<Key, Value>* tree_;
+        uint32_t stack_[maxDepth];
+        int depth_;
+        // only the current node is on the stack; the path is looked up
+        // on the first step
+        bool pathPending_;
+    };
+
+    iterator begin() const;
+    iterator end() const;
+    iterator find(const Key& key) const;
+    iterator lower_bound(const Key& key) const;
+    Value& operator[](const Key& key);
+    Value const & operator[](const Key& key) const;
+
+protected:
+    struct CompactNode
+    {
+        CompactNode(const Key& k, const Value& v) : key(k), value(v)
+        {
+            child[0] = child[1] = nil;
+        }
+
+        Key key;
+        Value value;
+        // left and right child index in the low 31 bits, balance flags in
+        // the top bits; an array so a search can pick one without a branch
+        uint32_t child[2];
+    };
+
+    static const uint32_t nil = 0x7fffffff;
+    static const uint32_t tallBit = 0x80000000;
+
+    uint32_t leftOf(uint32_t index) const;
+    uint32_t rightOf(uint32_t index) const;
+    void setLeft(uint32_t index, uint32_t child);
+    void setRight(uint32_t index, uint32_t child);
+    int balanceOf(uint32_t index) const;
+    void setBalance(uint32_t index, int balance);
+
+    uint32_t rotateLeft(uint32_t index);
+    uint32_t rotateRight(uint32_t index);
+    uint32_t fixRightTall(uint32_t index, bool& shorter);
+    uint32_t fixLeftTall(uint32_t index, bool& shorter);
+
+    uint32_t insertAt(uint32_t index, const std::pair<const Key, Value>& keyValuePair, bool& taller, uint32_t& slot);
+    uint32_t removeAt(uint32_t index, const Key& key, bool& shorter, uint32_t& hole);
+    uint32_t removeSmallest(uint32_t index, bool& shorter, uint32_t& smallest);
+    uint32_t leftShorter(uint32_t index, bool& shorter);
+    uint32_t rightShorter(uint32_t index, bool& shorter);
+    void releaseSlot(uint32_t hole);
+    int checkHeight(uint32_t index) const;
+
+    std::vector<CompactNode> nodes_;
+    uint32_t root_;
+};
+
+template<class Key, class Value>
+const uint32_t CompactAVLTree<Key, Value>::nil;
+template<class Key, class Value>
+const uint32_t CompactAVLTree<Key, Value>::tallBit;
+template<class Key, class Value>
+const int CompactAVLTree<Key, Value>::iterator::maxDepth;
+
+/*
+  -------------------------------------------------------------
+  Begin implementations for the CompactAVLTree::iterator class.
+  -------------------------------------------------------------
+*/
+
+/**
+* A default constructor that initializes the iterator to NULL.
+*/
+template<class Key, class Value>
+CompactAVLTree<Key, Value>::iterator::iterator() :
+    tree_(nullptr),
+    depth_(0),
+    pathPending_(false)
+{
+
+}
+
+/**
+* An end iterator of tree, ready to have a path pushed.
+*/
+template<class Key, class Value>
+CompactAVLTree<Key, Value>::iterator::iterator(const CompactAVLTree<Key, Value>* tree) :
+    tree_(tree),
+    depth_(0),
+    pathPending_(false)
+{
+
+}
+
+/**
+* An iterator at the node in slot index of tree, for insert(), which
+* knows where the node went but not the path down to it after the
+* rotations. The path is only searched for if the iterator moves on.
+*/
+template<class Key, class Value>
+CompactAVLTree<Key, Value>::iterator::iterator(const CompactAVLTree<Key, Value>* tree, uint32_t index) :
+    tree_(tree),
+    depth_(1),
+    pathPending_(true)
+{
+    stack_[0] = index;
+}
+
+/**
+* Provides access to the item.
+*/
+template<class Key, class Value>
+typename CompactAVLTree<Key, Value>::reference CompactAVLTree<Key, Value>::iterator::operator*() const
+{
+    // find() is const here as on the other trees, yet values stay writable
+    CompactNode& node = const_cast<CompactNode&>(tree_->nodes_[stack_[depth_ - 1]]);
+    return reference(node.key, node.value);
+}
+
+/**
+* Provides access to the item's members.
+*/
+template<class Key, class Value>
+typename CompactAVLTree<Key, Value>::iterator::pointer CompactAVLTree<Key, Value>::iterator::operator->() const
+{
+    return pointer(**this);
+}
+
+/**
+* Checks if 'this' iterator's internals have the same value
+* as 'rhs'
+*/
+template<class Key, class Value>
+bool CompactAVLTree<Key, Value>::iterator::operator==(const iterator& rhs) const
+{
+    if(depth_ == 0 || rhs.depth_ == 0) {
+        return depth_ == rhs.depth_;
+    }
+    return tree_ == rhs.tree_ && stack_[depth_ - 1] == rhs.stack_[rhs.depth_ - 1];
+}
+
+/**
+* Checks if 'this' iterator's internals have a different value
+* as 'rhs'
+*/
+template<class Key, class Value>
+bool CompactAVLTree<Key, Value>::iterator::operator!=(const iterator& rhs) const
+{
+    return !(*this == rhs);
+}
+
+/**
+* Advances the iterator's location using an in-order sequencing
+*/
+template<class Key, class Value>
+typename CompactAVLTree<Key, Value>::iterator& CompactAVLTree<Key, Value>::iterator::operator++()
+{
+    if(pathPending_) {
+        *this = tree_->lower_bound(tree_->nodes_[stack_[0]].key);
+    }
+    uint32_t current = stack_[--depth_];
+    pushLeftSpine(tree_->rightOf(current));
+    return *this;
+}
+
+/**
+* Pushes index and its chain of left children, ending at the smallest
+* item of that subtree.
+*/
+template<class Key, class Value>
+void CompactAVLTree<Key, Value>::iterator::pushLeftSpine(uint32_t index)
+{
+    while(index != nil) {
+        stack_[depth_++] = index;
+        index = tree_->leftOf(index);
+    }
+}
+
+/*
+  -----------------------------------------------------------
+  End implementations for the CompactAVLTree::iterator class.
+  -----------------------------------------------------------
+*/
+
+/*
+  ----------------------------------------------------
+  Begin implementations for the CompactAVLTree class.
+  ----------------------------------------------------
+*/
+
+/**
+* Default constructor for an empty tree.
+*/
+template<class Key, class Value>
+CompactAVLTree<Key, Value>::CompactAVLTree() :
+    root_(nil)
+{
+
+}
+
+/**
+* Inserts keyValuePair, overwriting the value if the key is already in
+* the tree. Returns an iterator to the item and whether a new item was
+* added.
+*/
+template<class Key, class Value>
+std::pair<typename CompactAVLTree<Key, Value>::iterator, bool>
+CompactAVLTree<Key, Value>::insert(const std::pair<const Key, Value>& keyValuePair)
+{
+    if(nodes_.size() >= nil) throw std::length_error("CompactAVLTree is full");
+    size_t before = nodes_.size();
+    bool taller = false;
+    uint32_t slot = nil;
+    root_ = insertAt(root_, keyValuePair, taller, slot);
+    return std::make_pair(iterator(this, slot), nodes_.size() != before);
+}
+
+/**
+* Removes key if it is in the tree, then fills the freed slot with the
+* last node of the vector.
+*/
+template<class Key, class Value>
+void CompactAVLTree<Key, Value>::remove(const Key& key)
+{
+    bool shorter = false;
+    uint32_t hole = nil;
+    root_ = removeAt(root_, key, shorter, hole);
+    if(hole != nil) {
+        releaseSlot(hole);
+    }
+}
+
+/**
+* A method to remove all contents of the tree and
+* reset the values in the tree for use again.
+*/
+template<class Key, class Value>
+void CompactAVLTree<Key, Value>::clear()
+{
+    nodes_.clear();
+    root_ = nil;
+}
+
+/**
+* Makes room for count items, so loading a known number of items does
+* not grow the vector step by step.
+*/
+template<class Key, class Value>
+void CompactAVLTree<Key, Value>::reserve(size_t count)
+{
+    nodes_.reserve(count);
+}
+
+/**
+* Return true iff the stored balance bits match the subtree heights and
+* no node's subtrees differ in height by more than one.
+*/
+template<class Key, class Value>
+bool CompactAVLTree<Key, Value>::isBalanced() const
+{
+    return checkHeight(root_) >= 0;
+}
+
+/**
+ * Returns true if tree is empty
+*/
+template<class Key, class Value>
+bool CompactAVLTree<Key, Value>::empty() const
+{
+    return root_ == nil;
+}
+
+/**
+ * Returns the number of items in the tree
+*/
+template<class Key, class Value>
+size_t CompactAVLTree<Key, Value>::size() const
+{
+    return nodes_.size();
+}
+
+/**
+* Returns the bytes the tree holds on to, including spare capacity in
+* the node vector (but not memory owned by the keys and values).
+*/
+template<class Key, class Value>
+size_t CompactAVLTree<Key, Value>::memoryBytes() const
+{
+    return sizeof(*this) + nodes_.capacity() * sizeof(CompactNode);
+}
+
+/**
+* Returns an iterator to the smallest item.
+*/
+template<class Key, class Value>
+typename CompactAVLTree<Key, Value>::iterator CompactAVLTree<Key, Value>::begin() const
+{
+    iterator it(this);
+    it.pushLeftSpine(root_);
+    return it;
+}
+
+/**
+* Returns an iterator whose value means INVALID
+*/
+template<class Key, class Value>
+typename CompactAVLTree<Key, Value>::iterator CompactAVLTree<Key, Value>::end() const
+{
+    return iterator(this);
+}
+
+/**
+* Returns an iterator to the item with key, or end() if there is none.
+*/
+template<class Key, class Value>
+typename CompactAVLTree<Key, Value>::iterator CompactAVLTree<Key, Value>::find(const Key& key) const
+{
+    iterator it = lower_bound(key);
+    if(it != end() && key < nodes_[it.stack_[it.depth_ - 1]].key) {
+        return end();
+    }
+    return it;
+}
+
+/**
+* Returns an iterator to the first item whose key is not less than key.
+* Every node passed on the left keeps its place on the stack, to be
+* visited after the left subtree. The step down indexes child[] with the
+* comparison and the push always writes, only the depth moves, so the
+* loop has no branch on the key except the rarely taken exact match.
+*/
+template<class Key, class Value>
+typename CompactAVLTree<Key, Value>::iterator CompactAVLTree<Key, Value>::lower_bound(const Key& key) const
+{
+    iterator it(this);
+    uint32_t current = root_;
+    while(current != nil) {
+        const CompactNode& node = nodes_[current];
+        bool right = node.key < key;
+        it.stack_[it.depth_] = current;
+        it.depth_ += !right;
+        if(!right && !(key < node.key)) {
+            break;
+        }
+        current = node.child[right] & ~tallBit;
+    }
+    return it;
+}
+
+/**
+* Returns the value stored under key, or throws std::out_of_range.
+*/
+template<class Key, class Value>
+Value& CompactAVLTree<Key, Value>::operator[](const Key& key)
+{
+    iterator it = find(key);
+    if(it == end()) throw std::out_of_range("Invalid key");
+    return nodes_[it.stack_[it.depth_ - 1]].value;
+}
+template<class Key, class Value>
+Value const & CompactAVLTree<Key, Value>::operator[](const Key& key) const
+{
+    iterator it = find(key);
+    if(it == end()) throw std::out_of_range("Invalid key");
+    return nodes_[it.stack_[it.depth_ - 1]].value;
+}
+
+/**
+* Index of the left child of index, or nil.
+*/
+template<class Key, class Value>
+uint32_t CompactAVLTree<Key, Value>::leftOf(uint32_t index) const
+{
+    return nodes_[index].child[0] & ~tallBit;
+}
+
+/**
+* Index of the right child of index, or nil.
+*/
+template<class Key, class Value>
+uint32_t CompactAVLTree<Key, Value>::rightOf(uint32_t index) const
+{
+    return nodes_[index].child[1] & ~tallBit;
+}
+
+/**
+* Links child as the left child of index, keeping index's balance.
+*/
+template<class Key, class Value>
+void CompactAVLTree<Key, Value>::setLeft(uint32_t index, uint32_t child)
+{
+    nodes_[index].child[0] = (nodes_[index].child[0] & tallBit) | child;
+}
+
+/**
+* Links child as the right child of index, keeping index's balance.
+*/
+template<class Key, class Value>
+void CompactAVLTree<Key, Value>::setRight(uint32_t index, uint32_t child)
+{
+    nodes_[index].child[1] = (nodes_[index].child[1] & tallBit) | child;
+}
+
+/**
+* Height of the right subtree minus that of the left: -1, 0 or 1.
+*/
+template<class Key, class Value>
+int CompactAVLTree<Key, Value>::balanceOf(uint32_t index) const
+{
+    return (nodes_[index].child[1] & tallBit ? 1 : 0) - (nodes_[index].child[0] & tallBit ? 1 : 0);
+}
+
+/**
+* Stores balance (-1, 0 or 1) in the top bits of the child links.
+*/
+template<class Key, class Value>
+void CompactAVLTree<Key, Value>::setBalance(uint32_t index, int balance)
+{
+    CompactNode& node = nodes_[index];
+    node.child[0] = (node.child[0] & ~tallBit) | (balance < 0 ? tallBit : 0);
+    node.child[1] = (node.child[1] & ~tallBit) | (balance > 0 ? tallBit : 0);
+}
+
+/**
+* Rotates the right child of index up into its place and returns it.
+* Balances are left for the caller to set.
+*/
+template<class Key, class Value>
+uint32_t CompactAVLTree<Key, Value>::rotateLeft(uint32_t index)
+{
+    uint32_t pivot = rightOf(index);
+    setRight(index, leftOf(pivot));
+    setLeft(pivot, index);
+    return pivot;
+}
+
+/**
+* Rotates the left child of index up into its place and returns it.
+* Balances are left for the caller to set.
+*/
+template<class Key, class Value>
+uint32_t CompactAVLTree<Key, Value>::rotateRight(uint32_t index)
+{
+    uint32_t pivot = leftOf(index);
+    setLeft(index, rightOf(pivot));
+    setRight(pivot, index);
+    return pivot;
+}
+
+/**
+* Rebalances index, whose right subtree has become two levels taller
+* than its left, and returns the new subtree root. shorter tells whether
+* the subtree ended up a level lower than it was while out of balance
+* (always, except after a removal leaves the right child balanced).
+*/
+template<class Key, class Value>
+uint32_t CompactAVLTree<Key, Value>::fixRightTall(uint32_t index, bool& shorter)
+{
+    uint32_t right = rightOf(index);
+    int rightBalance = balanceOf(right);
+    if(rightBalance >= 0) {
+        uint32_t root = rotateLeft(index);
+        setBalance(index, rightBalance == 0 ? 1 : 0);
+        setBalance(root, rightBalance == 0 ? -1 : 0);
+        shorter = rightBalance != 0;
+        return root;
+    }
+    uint32_t middle = leftOf(right);
+    int middleBalance = balanceOf(middle);
+    setRight(index, rotateRight(right));
+    uint32_t root = rotateLeft(index);
+    setBalance(index, middleBalance > 0 ? -1 : 0);
+    setBalance(right, middleBalance < 0 ? 1 : 0);
+    setBalance(root, 0);
+    shorter = true;
+    return root;
+}
+
+/**
+* The mirror image of fixRightTall().
+*/
+template<class Key, class Value>
+uint32_t CompactAVLTree<Key, Value>::fixLeftTall(uint32_t index, bool& shorter)
+{
+    uint32_t left = leftOf(index);
+    int leftBalance = balanceOf(left);
+    if(leftBalance <= 0) {
+        uint32_t root = rotateRight(index);
+        setBalance(index, leftBalance == 0 ? -1 : 0);
+        setBalance(root, leftBalance == 0 ? 1 : 0);
+        shorter = leftBalance != 0;
+        return root;
+    }
+    uint32_t middle = rightOf(left);
+    int middleBalance = balanceOf(middle);
+    setLeft(index, rotateLeft(left));
+    uint32_t root = rotateRight(index);
+    setBalance(index, middleBalance < 0 ? 1 : 0);
+    setBalance(left, middleBalance > 0 ? -1 : 0);
+    setBalance(root, 0);
+    shorter = true;
+    return root;
+}
+
+/**
+* Inserts keyValuePair into the subtree at index and returns its new
+* root. taller reports whether the subtree grew a level, and slot is set
+* to the item's place in nodes_, which the rotations do not change.
+*/
+template<class Key, class Value>
+uint32_t CompactAVLTree<Key, Value>::insertAt(uint32_t index, const std::pair<const Key, Value>& keyValuePair, bool& taller, uint32_t& slot)
+{
+    if(index == nil) {
+        nodes_.push_back(CompactNode(keyValuePair.first, keyValuePair.second));
+        taller = true;
+        slot = static_cast<uint32_t>(nodes_.size() - 1);
+        return slot;
+    }
+
+    const Key& key = keyValuePair.first;
+    if(key < nodes_[index].key) {
+        setLeft(index, insertAt(leftOf(index), keyValuePair, taller, slot));
+        if(taller) {
+            int balance = balanceOf(index);
+            if(balance == -1) {
+                bool ignored;
+                index = fixLeftTall(index, ignored);
+                taller = false;
+            }
+            else {
+                setBalance(index, balance - 1);
+                taller = balance == 0;
+            }
+        }
+    }
+    else if(nodes_[index].key < key) {
+        setRight(index, insertAt(rightOf(index), keyValuePair, taller, slot));
+        if(taller) {
+            int balance = balanceOf(index);
+            if(balance == 1) {
+                bool ignored;
+                index = fixRightTall(index, ignored);
+                taller = false;
+            }
+            else {
+                setBalance(index, balance + 1);
+                taller = balance == 0;
+            }
+        }
+    }
+    else {
+        nodes_[index].value = keyValuePair.second;
+        taller = false;
+        slot = index;
+    }
+    return index;
+}
+
+/**
+* Unlinks key from the subtree at index and returns its new root. The
+* unlinked node's slot is reported in hole (nil if key was missing) and
+* shorter reports whether the subtree lost a level.
+*/
+template<class Key, class Value>
+uint32_t CompactAVLTree<Key, Value>::removeAt(uint32_t index, const Key& key, bool& shorter, uint32_t& hole)
+{
+    if(index == nil) {
+        shorter = false;
+        return nil;
+    }
+
+    if(key < nodes_[index].key) {
+        setLeft(index, removeAt(leftOf(index), key, shorter, hole));
+        return shorter ? leftShorter(index, shorter) : index;
+    }
+    if(nodes_[index].key < key) {
+        setRight(index, removeAt(rightOf(index), key, shorter, hole));
+        return shorter ? rightShorter(index, shorter) : index;
+    }
+
+    hole = index;
+    uint32_t left = leftOf(index);
+    uint32_t right = rightOf(index);
+    if(left == nil || right == nil) {
+        shorter = true;
+        return left == nil ? right : left;
+    }
+
+    // the successor takes the removed node's place
+    uint32_t successor = nil;
+    right = removeSmallest(right, shorter, successor);
+    nodes_[successor].child[0] = nodes_[index].child[0];
+    nodes_[successor].child[1] = nodes_[index].child[1];
+    setRight(successor, right);
+    return shorter ? rightShorter(successor, shorter) : successor;
+}
+
+/**
+* Unlinks the smallest node of the subtree at index, reporting it in
+* smallest, and returns the new subtree root.
+*/
+template<class Key, class Value>
+uint32_t CompactAVLTree<Key, Value>::removeSmallest(uint32_t index, bool& shorter, uint32_t& smallest)
+{
+    if(leftOf(index) == nil) {
+        smallest = index;
+        shorter = true;
+        return rightOf(index);
+    }
+    setLeft(index, removeSmallest(leftOf(index), shorter, smallest));
+    return shorter ? leftShorter(index, shorter) : index;
+}
+
+/**
+* Updates index after its left subtree lost a level and returns the
+* subtree root; shorter reports whether this subtree lost a level too.
+*/
+template<class Key, class Value>
+uint32_t CompactAVLTree<Key, Value>::leftShorter(uint32_t index, bool& shorter)
+{
+    int balance = balanceOf(index);
+    if(balance == 1) {
+        return fixRightTall(index, shorter);
+    }
+    setBalance(index, balance + 1);
+    shorter = balance == -1;
+    return index;
+}
+
+/**
+* Updates index after its right subtree lost a level and returns the
+* subtree root; shorter reports whether this subtree lost a level too.
+*/
+template<class Key, class Value>
+uint32_t CompactAVLTree<Key, Value>::rightShorter(uint32_t index, bool& shorter)
+{
+    int balance = balanceOf(index);
+    if(balance == -1) {
+        return fixLeftTall(index, shorter);
+    }
+    setBalance(index, balance - 1);
+    shorter = balance == 1;
+    return index;
+}
+
+/**
+* Frees slot hole, which is no longer linked, by moving the last node of
+* the vector into it and repointing that node's parent.
+*/
+template<class Key, class Value>
+void CompactAVLTree<Key, Value>::releaseSlot(uint32_t hole)
+{
+    uint32_t last = static_cast<uint32_t>(nodes_.size() - 1);
+    if(hole != last) {
+        const Key& key = nodes_[last].key;
+        if(root_ == last) {
+            root_ = hole;
+        }
+        else {
+            uint32_t parent = root_;
+            while(true) {
+                if(key < nodes_[parent].key) {
+                    if(leftOf(parent) == last) {
+                        setLeft(parent, hole);
+                        break;
+                    }
+                    parent = leftOf(parent);
+                }
+                else {
+                    if(rightOf(parent) == last) {
+                        setRight(parent, hole);
+                        break;
+                    }
+                    parent = rightOf(parent);
+                }
+            }
+        }
+        nodes_[hole] = std::move(nodes_[last]);
+    }
+    nodes_.pop_back();
+}
+
+/**
+* Returns the height of the subtree at index, or -1 if it or any subtree
+* below it is out of balance or has stale balance bits.
+*/
+template<class Key, class Value>
+int CompactAVLTree<Key, Value>::checkHeight(uint32_t index) const
+{
+    if(index == nil) {
+        return 0;
+    }
+    int left = checkHeight(leftOf(index));
+    int right = checkHeight(rightOf(index));
+    if(left < 0 || right < 0 || right - left != balanceOf(index)) {
+        return -1;
+    }
+    return 1 + (left > right ? left : right);
+}
+
+/*
+  --------------------------------------------------
+  End implementations for the CompactAVLTree class.
+  --------------------------------------------------
+*/
+
+#endif
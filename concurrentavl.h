@@ -0,0 +1,317 @@
+#ifndef CONCURRENTAVL_H
+#define CONCURRENTAVL_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <thread>
+#include <utility>
+#include "persistentavl.h"
+
+/**
+* A map for many reader threads and a few writer threads.
+*
+* The current contents are an immutable PersistentAVLTree version behind
+* an atomic raw pointer. A reader announces itself on a reader counter,
+* loads the pointer and searches that version in place: no lock, no
+* reference count, and it only retries if a writer moved on between the
+* announcement and the load. Writers take the writer mutex, derive the
+* next version by path copying, swap the pointer and flip the epoch, then
+* wait for the readers counted under the old epoch to leave before the
+* old version is freed (epoch-based reclamation, as in RCU).
+*
+* Reads are lock-free; how well they scale then comes down to the reader
+* counters, which are spread over readerSlots cache lines by thread.
+* Writes are serialized and also wait out the readers of the version
+* they replace, so batch them with apply() to pay for one publish per
+* batch instead of per item, or use ShardedAVLMap when writes need to
+* scale too.
+*/
+template <typename Key, typename Value>
+class ConcurrentAVLTree
+{
+public:
+    typedef PersistentAVLTree<Key, Value> Version;
+
+    ConcurrentAVLTree();
+    ~ConcurrentAVLTree();
+
+    void insert(const std::pair<const Key, Value>& keyValuePair);
+    void remove(const Key& key);
+    void clear();
+    template<typename Batch>
+    void apply(Batch batch);
+
+    bool find(const Key& key, Value& value) const;
+    bool contains(const Key& key) const;
+    size_t size() const;
+    Version snapshot() const;
+
+protected:
+    /**
+    * Pins the current version for the lifetime of the guard.
+    */
+    class ReadGuard
+    {
+    public:
+        explicit ReadGuard(const ConcurrentAVLTree<Key, Value>& tree);
+        ~ReadGuard();
+
+        const Version& version() const;
+
+    private:
+        ReadGuard(const ReadGuard&);
+        ReadGuard& operator=(const ReadGuard&);
+
+        std::atomic<size_t>* counter_;
+        const Version* version_;
+    };
+
+    // readers in each of the two most recent epochs, padded to a cache line
+    struct ReaderSlot
+    {
+        std::atomic<size_t> active[2];
+        char padding[64 - 2 * sizeof(std::atomic<size_t>)];
+    };
+
+    static const size_t readerSlots = 64;
+
+    static size_t slotOfThisThread();
+    void publish(const Version& next);
+
+    std::atomic<const Version*> current_;
+    std::atomic<size_t> epoch_;
+    // readers_ starts at the first cache line boundary in slotStorage_,
+    // which a member array would only do if the tree itself were aligned
+    std::unique_ptr<char[]> slotStorage_;
+    ReaderSlot* readers_;
+    std::mutex writeLock_;
+
+private:
+    ConcurrentAVLTree(const ConcurrentAVLTree&);
+    ConcurrentAVLTree& operator=(const ConcurrentAVLTree&);
+};
+
+template<class Key, class Value>
+const size_t ConcurrentAVLTree<Key, Value>::readerSlots;
+
+/*
+  -----------------------------------------------------------------
+  Begin implementations for the ConcurrentAVLTree::ReadGuard class.
+  -----------------------------------------------------------------
+*/
+
+/**
+* Counts this thread as a reader of the current epoch and then loads the
+* current version. If the epoch moved on in between, the count may have
+* gone to a parity the writer already waited out, so it is taken again.
+*/
+template<class Key, class Value>
+ConcurrentAVLTree<Key, Value>::ReadGuard::ReadGuard(const ConcurrentAVLTree<Key, Value>& tree)
+{
+    ReaderSlot& slot = tree.readers_[slotOfThisThread()];
+    while(true) {
+        size_t epoch = tree.epoch_.load();
+        counter_ = &slot.active[epoch & 1];
+        counter_->fetch_add(1);
+        if(tree.epoch_.load() == epoch) {
+            break;
+        }
+        counter_->fetch_sub(1);
+    }
+    version_ = tree.current_.load();
+}
+
+/**
+* Destructor, which lets writers free the version again.
+*/
+template<class Key, class Value>
+ConcurrentAVLTree<Key, Value>::ReadGuard::~ReadGuard()
+{
+    counter_->fetch_sub(1, std::memory_order_release);
+}
+
+/**
+* Returns the pinned version.
+*/
+template<class Key, class Value>
+const typename ConcurrentAVLTree<Key, Value>::Version&
+ConcurrentAVLTree<Key, Value>::ReadGuard::version() const
+{
+    return *version_;
+}
+
+/*
+  ---------------------------------------------------------------
+  End implementations for the ConcurrentAVLTree::ReadGuard class.
+  ---------------------------------------------------------------
+*/
+
+/*
+  ------------------------------------------------------
+  Begin implementations for the ConcurrentAVLTree class.
+  ------------------------------------------------------
+*/
+
+/**
+* Default constructor, which publishes an empty version.
+*/
+template<class Key, class Value>
+ConcurrentAVLTree<Key, Value>::ConcurrentAVLTree() :
+    current_(nullptr),
+    epoch_(0),
+    slotStorage_(new char[(readerSlots + 1) * sizeof(ReaderSlot)])
+{
+    static_assert(sizeof(ReaderSlot) == 64, "a reader slot fills one cache line");
+    uintptr_t address = reinterpret_cast<uintptr_t>(slotStorage_.get());
+    readers_ = reinterpret_cast<ReaderSlot*>(slotStorage_.get() + (64 - address % 64) % 64);
+    for(size_t i = 0; i < readerSlots; ++i) {
+        new(&readers_[i]) ReaderSlot;
+        readers_[i].active[0].store(0);
+        readers_[i].active[1].store(0);
+    }
+    current_.store(new Version());
+}
+
+/**
+* Destructor. No thread may still be reading.
+*/
+template<class Key, class Value>
+ConcurrentAVLTree<Key, Value>::~ConcurrentAVLTree()
+{
+    delete current_.load();
+}
+
+/**
+* Inserts keyValuePair, overwriting the value if the key is already in
+* the tree. Readers see either the old or the new version as a whole.
+*/
+template<class Key, class Value>
+void ConcurrentAVLTree<Key, Value>::insert(const std::pair<const Key, Value>& keyValuePair)
+{
+    std::lock_guard<std::mutex> guard(writeLock_);
+    Version next = *current_.load();
+    next.insert(keyValuePair);
+    publish(next);
+}
+
+/**
+* Removes key if it is in the tree.
+*/
+template<class Key, class Value>
+void ConcurrentAVLTree<Key, Value>::remove(const Key& key)
+{
+    std::lock_guard<std::mutex> guard(writeLock_);
+    Version next = *current_.load();
+    next.remove(key);
+    publish(next);
+}
+
+/**
+* Publishes an empty version. Snapshots taken earlier keep their items.
+*/
+template<class Key, class Value>
+void ConcurrentAVLTree<Key, Value>::clear()
+{
+    std::lock_guard<std::mutex> guard(writeLock_);
+    publish(Version());
+}
+
+/**
+* Calls batch(version) on a private copy of the current version under
+* the writer lock, then publishes the result at once, so readers see
+* all of the batch's changes or none of them.
+*/
+template<class Key, class Value>
+template<typename Batch>
+void ConcurrentAVLTree<Key, Value>::apply(Batch batch)
+{
+    std::lock_guard<std::mutex> guard(writeLock_);
+    Version next = *current_.load();
+    batch(next);
+    publish(next);
+}
+
+/**
+* Copies the value stored under key into value and returns true, or
+* returns false if key is missing. Lock-free.
+*/
+template<class Key, class Value>
+bool ConcurrentAVLTree<Key, Value>::find(const Key& key, Value& value) const
+{
+    ReadGuard guard(*this);
+    return guard.version().lookup(key, value);
+}
+
+/**
+* Returns true if key is in the tree. Lock-free.
+*/
+template<class Key, class Value>
+bool ConcurrentAVLTree<Key, Value>::contains(const Key& key) const
+{
+    ReadGuard guard(*this);
+    return guard.version().find(key) != guard.version().end();
+}
+
+/**
+ * Returns the number of items in the current version.
+*/
+template<class Key, class Value>
+size_t ConcurrentAVLTree<Key, Value>::size() const
+{
+    ReadGuard guard(*this);
+    return guard.version().size();
+}
+
+/**
+* Returns the current version, in O(1). It can be iterated at leisure
+* from any thread; later writes do not show up in it.
+*/
+template<class Key, class Value>
+typename ConcurrentAVLTree<Key, Value>::Version ConcurrentAVLTree<Key, Value>::snapshot() const
+{
+    ReadGuard guard(*this);
+    return guard.version();
+}
+
+/**
+* Returns the reader slot of the calling thread. Threads are dealt the
+* slots in turn, so up to readerSlots readers never share a cache line.
+*/
+template<class Key, class Value>
+size_t ConcurrentAVLTree<Key, Value>::slotOfThisThread()
+{
+    static std::atomic<size_t> nextSlot(0);
+    static thread_local size_t slot = nextSlot.fetch_add(1, std::memory_order_relaxed) % readerSlots;
+    return slot;
+}
+
+/**
+* Makes next the current version, then flips the epoch and waits until
+* every reader counted under the old one has left before freeing the old
+* version: readers counted under the new epoch load the pointer after the
+* swap. Called with writeLock_ held.
+*/
+template<class Key, class Value>
+void ConcurrentAVLTree<Key, Value>::publish(const Version& next)
+{
+    const Version* old = current_.exchange(new Version(next));
+    size_t parity = epoch_.fetch_add(1) & 1;
+    for(size_t i = 0; i < readerSlots; ++i) {
+        while(readers_[i].active[parity].load(std::memory_order_acquire) != 0) {
+            std::this_thread::yield();
+        }
+    }
+    delete old;
+}
+
+/*
+  ----------------------------------------------------
+  End implementations for the ConcurrentAVLTree class.
+  ----------------------------------------------------
+*/
+
+#endif
@@ -0,0 +1,499 @@
+#ifndef DURABLEAVL_H
+#define DURABLEAVL_H
+
+#include <cerrno>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "avlbst.h"
+#include "avlimage.h"
+
+/**
+* How long insert() and remove() wait before returning, from cheapest to
+* safest.
+*/
+enum Durability
+{
+    // no log: changes live only in memory until the next checkpoint()
+    DURABILITY_NONE,
+    // every change is written to the log file, not synced: survives the
+    // process crashing, not the machine
+    DURABILITY_BUFFERED,
+    // every change is synced before returning, but callers that arrive
+    // while a sync is running share the next one (group commit)
+    DURABILITY_GROUP,
+    // every change is written and synced on its own
+    DURABILITY_SYNC
+};
+
+/**
+* An AVLTree whose changes are recorded in an append-only write-ahead
+* log in directory, so its contents survive a crash.
+*
+* Every insert and remove is applied to the tree and appended to the log
+* as a checksummed record; how soon the record reaches the disk depends
+* on the durability level. Once the log grows past checkpointBytes the
+* whole tree is saved as an image (see saveImage()) and the log
+* starts over. Opening the directory again loads the latest image and
+* replays the log on top of it, stopping at the first torn or damaged
+* record, which is cut off. Replaying a record the image already holds
+* is harmless, since inserts overwrite and removes of missing keys do
+* nothing, so a crash in the middle of a checkpoint loses nothing.
+*
+* All methods lock one mutex, so the tree can be shared between threads.
+* Keys and values must be trivially copyable. If writing or syncing the
+* log fails, the change that hit the error and every later one throws
+* std::runtime_error, since the log no longer matches the tree.
+*/
+template <typename Key, typename Value>
+class DurableAVLTree
+{
+public:
+    DurableAVLTree(const std::string& directory, Durability durability = DURABILITY_GROUP,
+                   size_t checkpointBytes = 64 << 20);
+    ~DurableAVLTree();
+
+    void insert(const std::pair<const Key, Value>& keyValuePair);
+    void remove(const Key& key);
+    bool find(const Key& key, Value& value) const;
+    bool contains(const Key& key) const;
+    size_t size() const;
+
+    void sync();
+    void checkpoint();
+    size_t logBytes() const;
+
+protected:
+    enum RecordType { RECORD_INSERT = 1, RECORD_REMOVE = 2 };
+
+    /**
+    * What precedes each record's payload in the log: the payload's
+    * length and the low bits of its checksum.
+    */
+    struct RecordHeader
+    {
+        uint32_t size;
+        uint32_t check;
+    };
+
+    void recover();
+    void append(RecordType type, const Key& key, const Value* value);
+    void commit(std::unique_lock<std::mutex>& guard, uint64_t sequence);
+    void flushPending(std::unique_lock<std::mutex>& guard);
+    void checkpointLocked(std::unique_lock<std::mutex>& guard);
+    void writeAll(const char* data, size_t bytes);
+    void syncFile(int fd, const std::string& what);
+    static uint32_t recordCheck(const char* payload, size_t bytes);
+
+    AVLTree<Key, Value> tree_;
+    std::string directory_;
+    std::string logPath_;
+    std::string imagePath_;
+    Durability durability_;
+    size_t checkpointBytes_;
+    int logFd_;
+    size_t logBytes_;
+
+    // group commit: records not yet written, and how far the log is synced
+    std::vector<char> pending_;
+    uint64_t appended_;
+    uint64_t durable_;
+    bool flushing_;
+    // set once a log write or sync fails; every later change then throws
+    bool broken_;
+    std::condition_variable flushed_;
+    mutable std::mutex lock_;
+
+private:
+    DurableAVLTree(const DurableAVLTree&);
+    DurableAVLTree& operator=(const DurableAVLTree&);
+};
+
+/*
+  ----------------------------------------------------
+  Begin implementations for the DurableAVLTree class.
+  ----------------------------------------------------
+*/
+
+/**
+* Opens (creating if needed) the tree kept in directory and recovers its
+* contents. Throws std::runtime_error if the directory or its files
+* cannot be used.
+*/
+template<class Key, class Value>
+DurableAVLTree<Key, Value>::DurableAVLTree(const std::string& directory, Durability durability, size_t checkpointBytes) :
+    directory_(directory),
+    logPath_(directory + "/wal.log"),
+    imagePath_(directory + "/checkpoint.img"),
+    durability_(durability),
+    checkpointBytes_(checkpointBytes),
+    logFd_(-1),
+    logBytes_(0),
+    appended_(0),
+    durable_(0),
+    flushing_(false),
+    broken_(false)
+{
+    static_assert(std::is_trivially_copyable<Key>::value && std::is_trivially_copyable<Value>::value,
+                  "logged keys and values must be trivially copyable");
+    if(mkdir(directory_.c_str(), 0755) != 0 && errno != EEXIST) {
+        throw std::runtime_error("cannot create " + directory_);
+    }
+    recover();
+}
+
+/**
+* Writes and syncs whatever is still pending, then closes the log.
+*/
+template<class Key, class Value>
+DurableAVLTree<Key, Value>::~DurableAVLTree()
+{
+    try {
+        sync();
+    }
+    catch(...) {
+        // nothing sensible to do from a destructor; recovery copes
+    }
+    close(logFd_);
+}
+
+/**
+* Inserts keyValuePair, overwriting the value if the key is already in
+* the tree, and returns once the change is as durable as the level
+* promises. Readers see the change as soon as it is applied.
+*/
+template<class Key, class Value>
+void DurableAVLTree<Key, Value>::insert(const std::pair<const Key, Value>& keyValuePair)
+{
+    std::unique_lock<std::mutex> guard(lock_);
+    tree_.insert(keyValuePair);
+    if(durability_ != DURABILITY_NONE) {
+        append(RECORD_INSERT, keyValuePair.first, &keyValuePair.second);
+        commit(guard, appended_);
+    }
+}
+
+/**
+* Removes key if it is in the tree, with the same durability as insert().
+*/
+template<class Key, class Value>
+void DurableAVLTree<Key, Value>::remove(const Key& key)
+{
+    std::unique_lock<std::mutex> guard(lock_);
+    tree_.remove(key);
+    if(durability_ != DURABILITY_NONE) {
+        append(RECORD_REMOVE, key, nullptr);
+        commit(guard, appended_);
+    }
+}
+
+/**
+* Copies the value stored under key into value and returns true, or
+* returns false if key is missing.
+*/
+template<class Key, class Value>
+bool DurableAVLTree<Key, Value>::find(const Key& key, Value& value) const
+{
+    std::lock_guard<std::mutex> guard(lock_);
+    typename AVLTree<Key, Value>::iterator it = tree_.find(key);
+    if(it == tree_.end()) {
+        return false;
+    }
+    value = it->second;
+    return true;
+}
+
+/**
+* Returns true if key is in the tree.
+*/
+template<class Key, class Value>
+bool DurableAVLTree<Key, Value>::contains(const Key& key) const
+{
+    std::lock_guard<std::mutex> guard(lock_);
+    return tree_.find(key) != tree_.end();
+}
+
+/**
+ * Returns the number of items in the tree
+*/
+template<class Key, class Value>
+size_t DurableAVLTree<Key, Value>::size() const
+{
+    std::lock_guard<std::mutex> guard(lock_);
+    return tree_.size();
+}
+
+/**
+* Makes every change logged so far durable, whatever the level. Under
+* DURABILITY_NONE there is no log, so this does nothing; use checkpoint().
+*/
+template<class Key, class Value>
+void DurableAVLTree<Key, Value>::sync()
+{
+    std::unique_lock<std::mutex> guard(lock_);
+    if(durability_ != DURABILITY_NONE) {
+        flushPending(guard);
+        syncFile(logFd_, logPath_);
+    }
+}
+
+/**
+* Saves the whole tree as the new checkpoint image and empties the log.
+* Writers wait while the image is written.
+*/
+template<class Key, class Value>
+void DurableAVLTree<Key, Value>::checkpoint()
+{
+    std::unique_lock<std::mutex> guard(lock_);
+    checkpointLocked(guard);
+}
+
+/**
+* Returns the size of the log, which checkpoint() resets.
+*/
+template<class Key, class Value>
+size_t DurableAVLTree<Key, Value>::logBytes() const
+{
+    std::lock_guard<std::mutex> guard(lock_);
+    return logBytes_;
+}
+
+/**
+* Loads the checkpoint image if there is one, replays the log records
+* after it up to the first incomplete or damaged one, cuts the log off
+* there and opens it for appending.
+*/
+template<class Key, class Value>
+void DurableAVLTree<Key, Value>::recover()
+{
+    if(access(imagePath_.c_str(), F_OK) == 0) {
+        loadImage(tree_, imagePath_);
+    }
+
+    logFd_ = open(logPath_.c_str(), O_RDWR | O_CREAT | O_APPEND, 0644);
+    if(logFd_ < 0) throw std::runtime_error("cannot open " + logPath_);
+    struct stat info;
+    if(fstat(logFd_, &info) != 0) throw std::runtime_error("cannot read " + logPath_);
+    std::vector<char> log(static_cast<size_t>(info.st_size));
+    size_t got = 0;
+    while(got < log.size()) {
+        ssize_t n = pread(logFd_, &log[got], log.size() - got, static_cast<off_t>(got));
+        if(n <= 0) throw std::runtime_error("cannot read " + logPath_);
+        got += static_cast<size_t>(n);
+    }
+
+    size_t offset = 0;
+    while(offset + sizeof(RecordHeader) <= log.size()) {
+        RecordHeader header;
+        std::memcpy(&header, log.data() + offset, sizeof(header));
+        // may point one past the end when the log stops right after a
+        // header, so it is only read once header.size has been checked
+        const char* payload = log.data() + offset + sizeof(header);
+        if(header.size < 1 + sizeof(Key) || header.size > log.size() - offset - sizeof(header) ||
+           header.check != recordCheck(payload, header.size)) {
+            break;
+        }
+        Key key;
+        std::memcpy(&key, payload + 1, sizeof(Key));
+        if(payload[0] == RECORD_INSERT && header.size == 1 + sizeof(Key) + sizeof(Value)) {
+            Value value;
+            std::memcpy(&value, payload + 1 + sizeof(Key), sizeof(Value));
+            tree_.insert(std::make_pair(key, value));
+        }
+        else if(payload[0] == RECORD_REMOVE && header.size == 1 + sizeof(Key)) {
+            tree_.remove(key);
+        }
+        else {
+            break;
+        }
+        offset += sizeof(header) + header.size;
+    }
+
+    if(offset != log.size()) {
+        // drop the torn tail so new records follow the last good one
+        if(ftruncate(logFd_, static_cast<off_t>(offset)) != 0) {
+            throw std::runtime_error("cannot truncate " + logPath_);
+        }
+        syncFile(logFd_, logPath_);
+    }
+    logBytes_ = offset;
+}
+
+/**
+* Adds a record to the pending buffer; commit() writes it out.
+*/
+template<class Key, class Value>
+void DurableAVLTree<Key, Value>::append(RecordType type, const Key& key, const Value* value)
+{
+    char payload[1 + sizeof(Key) + sizeof(Value)];
+    payload[0] = static_cast<char>(type);
+    std::memcpy(payload + 1, &key, sizeof(Key));
+    size_t size = 1 + sizeof(Key);
+    if(value != nullptr) {
+        std::memcpy(payload + size, value, sizeof(Value));
+        size += sizeof(Value);
+    }
+    RecordHeader header;
+    header.size = static_cast<uint32_t>(size);
+    header.check = recordCheck(payload, size);
+    const char* head = reinterpret_cast<const char*>(&header);
+    pending_.insert(pending_.end(), head, head + sizeof(header));
+    pending_.insert(pending_.end(), payload, payload + size);
+    ++appended_;
+}
+
+/**
+* Waits, with the lock held on entry and exit, until record sequence is
+* as durable as the level asks. Under DURABILITY_GROUP the first caller
+* to find no sync running becomes the leader: it takes every pending
+* record, writes and syncs them with the lock released, so records
+* appended meanwhile queue up for the next leader, then wakes everyone
+* its sync covered. May checkpoint afterwards.
+*/
+template<class Key, class Value>
+void DurableAVLTree<Key, Value>::commit(std::unique_lock<std::mutex>& guard, uint64_t sequence)
+{
+    if(broken_) throw std::runtime_error("cannot log to " + logPath_ + " after an earlier failure");
+    if(durability_ == DURABILITY_BUFFERED || durability_ == DURABILITY_SYNC) {
+        try {
+            flushPending(guard);
+            if(durability_ == DURABILITY_SYNC) {
+                syncFile(logFd_, logPath_);
+            }
+        }
+        catch(...) {
+            broken_ = true;
+            throw;
+        }
+    }
+    else {
+        while(durable_ < sequence) {
+            if(broken_) throw std::runtime_error("cannot log to " + logPath_ + " after an earlier failure");
+            if(flushing_) {
+                flushed_.wait(guard);
+                continue;
+            }
+            flushing_ = true;
+            std::vector<char> batch;
+            batch.swap(pending_);
+            uint64_t covered = appended_;
+            guard.unlock();
+            try {
+                writeAll(batch.data(), batch.size());
+                syncFile(logFd_, logPath_);
+            }
+            catch(...) {
+                guard.lock();
+                broken_ = true;
+                flushing_ = false;
+                flushed_.notify_all();
+                throw;
+            }
+            guard.lock();
+            logBytes_ += batch.size();
+            durable_ = covered;
+            flushing_ = false;
+            flushed_.notify_all();
+        }
+    }
+
+    if(checkpointBytes_ != 0 && logBytes_ >= checkpointBytes_ && !flushing_) {
+        checkpointLocked(guard);
+    }
+}
+
+/**
+* Writes the pending records to the log, after any group sync in flight
+* has finished. Called with the lock held.
+*/
+template<class Key, class Value>
+void DurableAVLTree<Key, Value>::flushPending(std::unique_lock<std::mutex>& guard)
+{
+    while(flushing_) {
+        flushed_.wait(guard);
+    }
+    // a failed group write lost records, so later ones must not follow them
+    if(broken_) throw std::runtime_error("cannot log to " + logPath_ + " after an earlier failure");
+    writeAll(pending_.data(), pending_.size());
+    logBytes_ += pending_.size();
+    pending_.clear();
+    durable_ = appended_;
+}
+
+/**
+* Syncs the log, saves the tree image (which replaces the old one
+* atomically), then empties the log. Called with the lock held.
+*/
+template<class Key, class Value>
+void DurableAVLTree<Key, Value>::checkpointLocked(std::unique_lock<std::mutex>& guard)
+{
+    if(durability_ != DURABILITY_NONE) {
+        flushPending(guard);
+        syncFile(logFd_, logPath_);
+    }
+    saveImage(tree_, imagePath_);
+
+    // make the rename itself durable before dropping the log it replaces
+    int dirFd = open(directory_.c_str(), O_RDONLY);
+    if(dirFd < 0) throw std::runtime_error("cannot open " + directory_);
+    int synced = fsync(dirFd);
+    close(dirFd);
+    if(synced != 0) throw std::runtime_error("cannot sync " + directory_);
+
+    if(ftruncate(logFd_, 0) != 0) throw std::runtime_error("cannot truncate " + logPath_);
+    syncFile(logFd_, logPath_);
+    logBytes_ = 0;
+}
+
+/**
+* Appends bytes to the log file, retrying short writes.
+*/
+template<class Key, class Value>
+void DurableAVLTree<Key, Value>::writeAll(const char* data, size_t bytes)
+{
+    while(bytes > 0) {
+        ssize_t n = write(logFd_, data, bytes);
+        if(n < 0 && errno == EINTR) {
+            continue;
+        }
+        if(n <= 0) throw std::runtime_error("cannot write " + logPath_);
+        data += n;
+        bytes -= static_cast<size_t>(n);
+    }
+}
+
+/**
+* Forces fd's data to disk.
+*/
+template<class Key, class Value>
+void DurableAVLTree<Key, Value>::syncFile(int fd, const std::string& what)
+{
+    if(fdatasync(fd) != 0) throw std::runtime_error("cannot sync " + what);
+}
+
+/**
+* The check stored with a record: the low half of the image checksum.
+*/
+template<class Key, class Value>
+uint32_t DurableAVLTree<Key, Value>::recordCheck(const char* payload, size_t bytes)
+{
+    return static_cast<uint32_t>(imageChecksum(reinterpret_cast<const unsigned char*>(payload), bytes));
+}
+
+/*
+  --------------------------------------------------
+  End implementations for the DurableAVLTree class.
+  --------------------------------------------------
+*/
+
+#endif
@@ -0,0 +1,409 @@
+#ifndef FROZENAVL_H
+#define FROZENAVL_H
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+/**
+* An immutable, read-only copy of a sorted map, laid out for fast lookups.
+*
+* The keys sit in one contiguous array in Eytzinger (breadth-first) order:
+* the children of slot k are slots 2k and 2k+1, so a search is a loop of
+* k = 2k + (key < target) with no pointers to chase and no unpredictable
+* branch. The top levels of the implicit tree share a few cache lines, and
+* the search prefetches the line holding the descendants of k four levels
+* down, so the misses on the way to a leaf overlap. Values are kept in a
+* parallel array and are only touched once the key is found.
+*
+* Both arrays are indexed from 1 (slot 0 is padding), so Key and Value
+* must be default constructible. Iteration walks the implicit tree in
+* order, so items come out sorted by key.
+*
+* The arrays need not be owned by the tree: it can also search arrays
+* laid out by fillArrays() in memory someone else keeps alive, which is
+* how avlimage.h serves a tree straight from a mapped file.
+*/
+template <typename Key, typename Value>
+class FrozenAVLTree
+{
+public:
+    typedef std::pair<const Key&, const Value&> reference;
+
+    FrozenAVLTree();
+    template<typename InputIt>
+    FrozenAVLTree(InputIt first, size_t count);
+    FrozenAVLTree(std::shared_ptr<const void> storage, const Key* keys, const Value* values, size_t count);
+
+    class iterator;
+
+    bool empty() const;
+    size_t size() const;
+
+    /**
+    * A forward iterator over the items in key order.
+    */
+    class iterator
+    {
+    public:
+        /**
+        * What operator-> returns: holds the proxy pair so that
+        * it->first and it->second work.
+        */
+        class pointer
+        {
+        public:
+            explicit pointer(const reference& item) : item_(item) { }
+            const reference* operator->() const { return &item_; }
+
+        private:
+            reference item_;
+        };
+
+        iterator();
+
+        reference operator*() const;
+        pointer operator->() const;
+
+        bool operator==(const iterator& rhs) const;
+        bool operator!=(const iterator& rhs) const;
+
+        iterator& operator++();
+
+    protected:
+        friend class FrozenAVLTree<Key, Value>;
+        iterator(const FrozenAVLTree<Key, Value>* tree, size_t slot);
+
+        const FrozenAVLTree<Key, Value>* tree_;
+        size_t slot_;
+    };
+
+    iterator begin() const;
+    iterator end() const;
+    iterator find(const Key& key) const;
+    iterator lower_bound(const Key& key) const;
+    bool contains(const Key& key) const;
+    Value const & operator[](const Key& key) const;
+
+    // lays out count sorted items in arrays of count + 1 slots
+    template<typename InputIt>
+    static void fillArrays(InputIt first, size_t count, Key* keys, Value* values);
+
+protected:
+    /**
+    * The arrays of a tree built in memory.
+    */
+    struct Arrays
+    {
+        std::vector<Key> keys;
+        std::vector<Value> values;
+    };
+
+    template<typename InputIt>
+    static void fill(Key* keys, Value* values, size_t count, size_t slot, InputIt& it);
+    size_t lowerBoundSlot(const Key& key) const;
+
+    // how many slots apart the descendants four levels down start
+    static const size_t prefetchStride = sizeof(Key) < 64 ? 64 / sizeof(Key) : 1;
+
+    // keeps keys_ and values_ alive: an Arrays, or whatever the caller gave
+    std::shared_ptr<const void> storage_;
+    const Key* keys_;
+    const Value* values_;
+    size_t count_;
+};
+
+/*
+  ------------------------------------------------------------
+  Begin implementations for the FrozenAVLTree::iterator class.
+  ------------------------------------------------------------
+*/
+
+/**
+* A default constructor that initializes the iterator to NULL.
+*/
+template<class Key, class Value>
+FrozenAVLTree<Key, Value>::iterator::iterator() :
+    tree_(nullptr),
+    slot_(0)
+{
+
+}
+
+/**
+* Initialize the internal members of the iterator
+*/
+template<class Key, class Value>
+FrozenAVLTree<Key, Value>::iterator::iterator(const FrozenAVLTree<Key, Value>* tree, size_t slot) :
+    tree_(tree),
+    slot_(slot)
+{
+
+}
+
+/**
+* Provides access to the item.
+*/
+template<class Key, class Value>
+typename FrozenAVLTree<Key, Value>::reference FrozenAVLTree<Key, Value>::iterator::operator*() const
+{
+    return reference(tree_->keys_[slot_], tree_->values_[slot_]);
+}
+
+/**
+* Provides access to the item's members.
+*/
+template<class Key, class Value>
+typename FrozenAVLTree<Key, Value>::iterator::pointer FrozenAVLTree<Key, Value>::iterator::operator->() const
+{
+    return pointer(**this);
+}
+
+/**
+* Checks if 'this' iterator's internals have the same value
+* as 'rhs'. Every end() compares equal, whichever tree it came from.
+*/
+template<class Key, class Value>
+bool FrozenAVLTree<Key, Value>::iterator::operator==(const iterator& rhs) const
+{
+    return slot_ == rhs.slot_ && (slot_ == 0 || tree_ == rhs.tree_);
+}
+
+/**
+* Checks if 'this' iterator's internals have a different value
+* as 'rhs'
+*/
+template<class Key, class Value>
+bool FrozenAVLTree<Key, Value>::iterator::operator!=(const iterator& rhs) const
+{
+    return !(*this == rhs);
+}
+
+/**
+* Advances the iterator's location using an in-order sequencing:
+* the leftmost slot of the right subtree if there is one, otherwise the
+* closest ancestor reached from its left child.
+*/
+template<class Key, class Value>
+typename FrozenAVLTree<Key, Value>::iterator& FrozenAVLTree<Key, Value>::iterator::operator++()
+{
+    size_t count = tree_->count_;
+    if(2 * slot_ + 1 <= count) {
+        slot_ = 2 * slot_ + 1;
+        while(2 * slot_ <= count) {
+            slot_ *= 2;
+        }
+    }
+    else {
+        while(slot_ & 1) {
+            slot_ >>= 1;
+        }
+        slot_ >>= 1;
+    }
+    return *this;
+}
+
+/*
+  ----------------------------------------------------------
+  End implementations for the FrozenAVLTree::iterator class.
+  ----------------------------------------------------------
+*/
+
+/*
+  ---------------------------------------------------
+  Begin implementations for the FrozenAVLTree class.
+  ---------------------------------------------------
+*/
+
+/**
+* Default constructor for an empty tree.
+*/
+template<class Key, class Value>
+FrozenAVLTree<Key, Value>::FrozenAVLTree() :
+    keys_(nullptr),
+    values_(nullptr),
+    count_(0)
+{
+
+}
+
+/**
+* Copies count items, which must come in increasing key order, from
+* first. Each item is read once and written straight to its slot, so the
+* build is O(n).
+*/
+template<class Key, class Value>
+template<typename InputIt>
+FrozenAVLTree<Key, Value>::FrozenAVLTree(InputIt first, size_t count) :
+    count_(count)
+{
+    std::shared_ptr<Arrays> arrays = std::make_shared<Arrays>();
+    arrays->keys.resize(count + 1);
+    arrays->values.resize(count + 1);
+    fill(arrays->keys.data(), arrays->values.data(), count, 1, first);
+    keys_ = arrays->keys.data();
+    values_ = arrays->values.data();
+    storage_ = arrays;
+}
+
+/**
+* Searches the count items in keys and values, laid out by fillArrays(),
+* without copying them. storage keeps the arrays alive for as long as
+* the tree or any copy of it is around.
+*/
+template<class Key, class Value>
+FrozenAVLTree<Key, Value>::FrozenAVLTree(std::shared_ptr<const void> storage, const Key* keys, const Value* values,
+                                         size_t count) :
+    storage_(storage),
+    keys_(keys),
+    values_(values),
+    count_(count)
+{
+
+}
+
+/**
+ * Returns true if tree is empty
+*/
+template<class Key, class Value>
+bool FrozenAVLTree<Key, Value>::empty() const
+{
+    return count_ == 0;
+}
+
+/**
+ * Returns the number of items in the tree
+*/
+template<class Key, class Value>
+size_t FrozenAVLTree<Key, Value>::size() const
+{
+    return count_;
+}
+
+/**
+* Returns an iterator to the smallest item.
+*/
+template<class Key, class Value>
+typename FrozenAVLTree<Key, Value>::iterator FrozenAVLTree<Key, Value>::begin() const
+{
+    if(count_ == 0) {
+        return end();
+    }
+    size_t slot = 1;
+    while(2 * slot <= count_) {
+        slot *= 2;
+    }
+    return iterator(this, slot);
+}
+
+/**
+* Returns an iterator whose value means INVALID
+*/
+template<class Key, class Value>
+typename FrozenAVLTree<Key, Value>::iterator FrozenAVLTree<Key, Value>::end() const
+{
+    return iterator(this, 0);
+}
+
+/**
+* Returns an iterator to the item with key, or end() if there is none.
+*/
+template<class Key, class Value>
+typename FrozenAVLTree<Key, Value>::iterator FrozenAVLTree<Key, Value>::find(const Key& key) const
+{
+    size_t slot = lowerBoundSlot(key);
+    if(slot == 0 || key < keys_[slot]) {
+        return end();
+    }
+    return iterator(this, slot);
+}
+
+/**
+* Returns an iterator to the first item whose key is not less than key.
+*/
+template<class Key, class Value>
+typename FrozenAVLTree<Key, Value>::iterator FrozenAVLTree<Key, Value>::lower_bound(const Key& key) const
+{
+    return iterator(this, lowerBoundSlot(key));
+}
+
+/**
+* Returns true if key is in the tree.
+*/
+template<class Key, class Value>
+bool FrozenAVLTree<Key, Value>::contains(const Key& key) const
+{
+    size_t slot = lowerBoundSlot(key);
+    return slot != 0 && !(key < keys_[slot]);
+}
+
+/**
+* Returns the value stored under key, or throws std::out_of_range.
+*/
+template<class Key, class Value>
+Value const & FrozenAVLTree<Key, Value>::operator[](const Key& key) const
+{
+    size_t slot = lowerBoundSlot(key);
+    if(slot == 0 || key < keys_[slot]) throw std::out_of_range("Invalid key");
+    return values_[slot];
+}
+
+/**
+* Stores count items, which must come in increasing key order, from first
+* into keys and values, which have count + 1 slots each, in the layout
+* the tree searches. Slot 0 is left alone.
+*/
+template<class Key, class Value>
+template<typename InputIt>
+void FrozenAVLTree<Key, Value>::fillArrays(InputIt first, size_t count, Key* keys, Value* values)
+{
+    fill(keys, values, count, 1, first);
+}
+
+/**
+* Stores the items read from it into the subtree at slot of a tree with
+* count items, in order: left subtree, slot itself, right subtree.
+*/
+template<class Key, class Value>
+template<typename InputIt>
+void FrozenAVLTree<Key, Value>::fill(Key* keys, Value* values, size_t count, size_t slot, InputIt& it)
+{
+    if(slot > count) {
+        return;
+    }
+    fill(keys, values, count, 2 * slot, it);
+    keys[slot] = (*it).first;
+    values[slot] = (*it).second;
+    ++it;
+    fill(keys, values, count, 2 * slot + 1, it);
+}
+
+/**
+* Returns the slot of the first key not less than key, or 0 if every key
+* is less. The descent records a 1 bit for each step right; the answer is
+* the last node left from, found by dropping the trailing 1s and one 0.
+*/
+template<class Key, class Value>
+size_t FrozenAVLTree<Key, Value>::lowerBoundSlot(const Key& key) const
+{
+    const Key* keys = keys_;
+    size_t slot = 1;
+    while(slot <= count_) {
+        // the address is only a hint; it may point past the array
+        __builtin_prefetch(reinterpret_cast<const void*>(
+            reinterpret_cast<uintptr_t>(keys) + slot * prefetchStride * sizeof(Key)));
+        slot = 2 * slot + (keys[slot] < key);
+    }
+    return slot >> __builtin_ffsll(~static_cast<unsigned long long>(slot));
+}
+
+/*
+  -------------------------------------------------
+  End implementations for the FrozenAVLTree class.
+  -------------------------------------------------
+*/
+
+#endif
@@ -0,0 +1,279 @@
+#ifndef KEYSEARCH_H
+#define KEYSEARCH_H
+
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <type_traits>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define KEYSEARCH_X86 1
+#endif
+
+/**
+* lower/upper bound over a short sorted key array, such as the keys of
+* one B+ tree node.
+*
+* The generic version is a binary search using operator<. For 32 and
+* 64-bit integer keys there is a specialization that narrows the range
+* by binary search until it spans at most linearBytes, then counts the
+* keys below the target with vector compares, 8 (AVX2) or 4 (SSE) 32-bit
+* keys or half as many 64-bit keys per instruction, instead of taking a
+* hard to predict branch per key. The instruction set is picked at run
+* time from what the CPU supports; other CPUs use a scalar loop.
+*/
+template <typename Key, typename Enable = void>
+struct KeySearch
+{
+    static size_t lowerBound(const Key* keys, size_t count, const Key& key);
+    static size_t upperBound(const Key* keys, size_t count, const Key& key);
+};
+
+namespace keysearch_detail
+{
+
+enum SimdLevel { SIMD_NONE, SIMD_SSE42, SIMD_AVX2 };
+
+/**
+* The best kernel this CPU can run, detected once.
+*/
+inline SimdLevel detectLevel()
+{
+#ifdef KEYSEARCH_X86
+    __builtin_cpu_init();
+    if(__builtin_cpu_supports("avx2")) {
+        return SIMD_AVX2;
+    }
+    if(__builtin_cpu_supports("sse4.2")) {
+        return SIMD_SSE42;
+    }
+#endif
+    return SIMD_NONE;
+}
+
+inline SimdLevel simdLevel()
+{
+    static const SimdLevel level = detectLevel();
+    return level;
+}
+
+#ifdef KEYSEARCH_X86
+
+// Each kernel looks at the first blocks whole vectors of keys and counts
+// the keys below key (or above it, when greater is set). Keys and key are
+// xor-ed with bias first, which turns an unsigned order into the signed
+// one the compare instructions implement.
+
+__attribute__((target("avx2")))
+inline size_t count32Avx2(const void* keys, size_t blocks, int32_t key, int32_t bias, bool greater)
+{
+    const __m256i* p = static_cast<const __m256i*>(keys);
+    __m256i b = _mm256_set1_epi32(bias);
+    __m256i k = _mm256_set1_epi32(key ^ bias);
+    size_t count = 0;
+    for(size_t i = 0; i < blocks; ++i) {
+        __m256i v = _mm256_xor_si256(_mm256_loadu_si256(p + i), b);
+        __m256i hit = greater ? _mm256_cmpgt_epi32(v, k) : _mm256_cmpgt_epi32(k, v);
+        count += __builtin_popcount(_mm256_movemask_ps(_mm256_castsi256_ps(hit)));
+    }
+    return count;
+}
+
+__attribute__((target("avx2")))
+inline size_t count64Avx2(const void* keys, size_t blocks, int64_t key, int64_t bias, bool greater)
+{
+    const __m256i* p = static_cast<const __m256i*>(keys);
+    __m256i b = _mm256_set1_epi64x(bias);
+    __m256i k = _mm256_set1_epi64x(key ^ bias);
+    size_t count = 0;
+    for(size_t i = 0; i < blocks; ++i) {
+        __m256i v = _mm256_xor_si256(_mm256_loadu_si256(p + i), b);
+        __m256i hit = greater ? _mm256_cmpgt_epi64(v, k) : _mm256_cmpgt_epi64(k, v);
+        count += __builtin_popcount(_mm256_movemask_pd(_mm256_castsi256_pd(hit)));
+    }
+    return count;
+}
+
+__attribute__((target("sse4.2")))
+inline size_t count32Sse(const void* keys, size_t blocks, int32_t key, int32_t bias, bool greater)
+{
+    const __m128i* p = static_cast<const __m128i*>(keys);
+    __m128i b = _mm_set1_epi32(bias);
+    __m128i k = _mm_set1_epi32(key ^ bias);
+    size_t count = 0;
+    for(size_t i = 0; i < blocks; ++i) {
+        __m128i v = _mm_xor_si128(_mm_loadu_si128(p + i), b);
+        __m128i hit = greater ? _mm_cmpgt_epi32(v, k) : _mm_cmpgt_epi32(k, v);
+        count += __builtin_popcount(_mm_movemask_ps(_mm_castsi128_ps(hit)));
+    }
+    return count;
+}
+
+__attribute__((target("sse4.2")))
+inline size_t count64Sse(const void* keys, size_t blocks, int64_t key, int64_t bias, bool greater)
+{
+    const __m128i* p = static_cast<const __m128i*>(keys);
+    __m128i b = _mm_set1_epi64x(bias);
+    __m128i k = _mm_set1_epi64x(key ^ bias);
+    size_t count = 0;
+    for(size_t i = 0; i < blocks; ++i) {
+        __m128i v = _mm_xor_si128(_mm_loadu_si128(p + i), b);
+        __m128i hit = greater ? _mm_cmpgt_epi64(v, k) : _mm_cmpgt_epi64(k, v);
+        count += __builtin_popcount(_mm_movemask_pd(_mm_castsi128_pd(hit)));
+    }
+    return count;
+}
+
+#endif
+
+/**
+* Counts the keys of keys[0..count) below key (or above it when greater
+* is set) with the widest kernel available, finishing any keys left over
+* from the last whole vector with scalar compares.
+*/
+template <typename Key>
+size_t countKeys(const Key* keys, size_t count, const Key& key, bool greater)
+{
+    size_t done = 0;
+    size_t found = 0;
+#ifdef KEYSEARCH_X86
+    typedef typename std::conditional<sizeof(Key) == 4, int32_t, int64_t>::type Lane;
+    Lane bias = std::is_signed<Key>::value ? 0 : std::numeric_limits<Lane>::min();
+    Lane lane = static_cast<Lane>(key);
+    SimdLevel level = simdLevel();
+    if(level != SIMD_NONE) {
+        size_t perVector = (level == SIMD_AVX2 ? 32 : 16) / sizeof(Key);
+        size_t blocks = count / perVector;
+        if(sizeof(Key) == 4) {
+            found = level == SIMD_AVX2 ? count32Avx2(keys, blocks, lane, bias, greater)
+                                       : count32Sse(keys, blocks, lane, bias, greater);
+        }
+        else {
+            found = level == SIMD_AVX2 ? count64Avx2(keys, blocks, lane, bias, greater)
+                                       : count64Sse(keys, blocks, lane, bias, greater);
+        }
+        done = blocks * perVector;
+    }
+#endif
+    for(size_t i = done; i < count; ++i) {
+        found += greater ? (key < keys[i]) : (keys[i] < key);
+    }
+    return found;
+}
+
+}
+
+/**
+* The specialization for 32 and 64-bit integer keys.
+*/
+template <typename Key>
+struct KeySearch<Key, typename std::enable_if<std::is_integral<Key>::value && !std::is_same<Key, bool>::value &&
+                                              (sizeof(Key) == 4 || sizeof(Key) == 8)>::type>
+{
+    // ranges this many bytes long or shorter are counted, not bisected
+    static const size_t linearBytes = 256;
+
+    static size_t lowerBound(const Key* keys, size_t count, const Key& key);
+    static size_t upperBound(const Key* keys, size_t count, const Key& key);
+};
+
+/*
+  -----------------------------------------------
+  Begin implementations for the KeySearch class.
+  -----------------------------------------------
+*/
+
+/**
+* Index of the first of keys[0..count) that is not less than key.
+*/
+template<class Key, class Enable>
+size_t KeySearch<Key, Enable>::lowerBound(const Key* keys, size_t count, const Key& key)
+{
+    size_t low = 0;
+    while(count > 0) {
+        size_t half = count / 2;
+        if(keys[low + half] < key) {
+            low += half + 1;
+            count -= half + 1;
+        }
+        else {
+            count = half;
+        }
+    }
+    return low;
+}
+
+/**
+* Index of the first of keys[0..count) that is greater than key.
+*/
+template<class Key, class Enable>
+size_t KeySearch<Key, Enable>::upperBound(const Key* keys, size_t count, const Key& key)
+{
+    size_t low = 0;
+    while(count > 0) {
+        size_t half = count / 2;
+        if(!(key < keys[low + half])) {
+            low += half + 1;
+            count -= half + 1;
+        }
+        else {
+            count = half;
+        }
+    }
+    return low;
+}
+
+/**
+* Index of the first of keys[0..count) that is not less than key: bisect
+* down to linearBytes, then count the keys below key.
+*/
+template<class Key>
+size_t KeySearch<Key, typename std::enable_if<std::is_integral<Key>::value && !std::is_same<Key, bool>::value &&
+                                              (sizeof(Key) == 4 || sizeof(Key) == 8)>::type>::
+    lowerBound(const Key* keys, size_t count, const Key& key)
+{
+    size_t low = 0;
+    while(count * sizeof(Key) > linearBytes) {
+        size_t half = count / 2;
+        if(keys[low + half] < key) {
+            low += half + 1;
+            count -= half + 1;
+        }
+        else {
+            count = half;
+        }
+    }
+    return low + keysearch_detail::countKeys(keys + low, count, key, false);
+}
+
+/**
+* Index of the first of keys[0..count) that is greater than key: bisect
+* down to linearBytes, then count the keys not above key.
+*/
+template<class Key>
+size_t KeySearch<Key, typename std::enable_if<std::is_integral<Key>::value && !std::is_same<Key, bool>::value &&
+                                              (sizeof(Key) == 4 || sizeof(Key) == 8)>::type>::
+    upperBound(const Key* keys, size_t count, const Key& key)
+{
+    size_t low = 0;
+    while(count * sizeof(Key) > linearBytes) {
+        size_t half = count / 2;
+        if(!(key < keys[low + half])) {
+            low += half + 1;
+            count -= half + 1;
+        }
+        else {
+            count = half;
+        }
+    }
+    return low + count - keysearch_detail::countKeys(keys + low, count, key, true);
+}
+
+/*
+  ---------------------------------------------
+  End implementations for the KeySearch class.
+  ---------------------------------------------
+*/
+
+#endif
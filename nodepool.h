@@ -0,0 +1,255 @@
+#ifndef NODEPOOL_H
+#define NODEPOOL_H
+
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <vector>
+
+/**
+* A fixed-size block allocator for search tree nodes.
+* Blocks are carved out of large slabs, and freed blocks are kept on an
+* intrusive freelist so that allocate() and deallocate() are O(1) and
+* nodes created close together in time end up close together in memory.
+* Every slab is handed back at once by release().
+*
+* A pool is used by one thread at a time, but share() makes further pools
+* over the same slabs for trees that trade nodes (split, join, ...). Each
+* of those has its own freelist and slab cursor, so trees on different
+* threads never touch each other's lists, and a block from any of them
+* may be freed into any other. Only fetching a new slab takes a lock.
+* The slabs go back with the last pool that holds them.
+*/
+class NodePool
+{
+public:
+    explicit NodePool(size_t blocksPerSlab = 1024);
+    ~NodePool();
+
+    std::shared_ptr<NodePool> share() const;
+
+    void* allocate(size_t bytes);
+    void deallocate(void* block);
+    void release();
+
+    bool ownsSlabs() const;
+    bool sharesSlabsWith(const NodePool& other) const;
+
+    size_t blockSize() const;
+    size_t slabCount() const;
+    size_t blocksPerSlab() const;
+
+private:
+    NodePool(const NodePool&);
+    NodePool& operator=(const NodePool&);
+
+    struct FreeBlock
+    {
+        FreeBlock* next;
+    };
+
+    // the slabs of every pool made by share(), freed with the last of them
+    struct SlabStore
+    {
+        ~SlabStore();
+
+        std::mutex lock;
+        std::vector<char*> slabs;
+    };
+
+    char* newSlab();
+
+    std::shared_ptr<SlabStore> store_;
+    FreeBlock* freeList_;
+    char* cursor_;
+    char* slabEnd_;
+    size_t blockSize_;
+    size_t blocksPerSlab_;
+};
+
+/*
+  ---------------------------------------------
+  Begin implementations for the NodePool class.
+  ---------------------------------------------
+*/
+
+/**
+* Frees every slab; runs once no pool refers to the store any more.
+*/
+inline NodePool::SlabStore::~SlabStore()
+{
+    for(size_t i = 0; i < slabs.size(); ++i) {
+        ::operator delete(slabs[i]);
+    }
+}
+
+/**
+* Constructs an empty pool. No memory is reserved until the first allocation.
+*/
+inline NodePool::NodePool(size_t blocksPerSlab) :
+    store_(std::make_shared<SlabStore>()),
+    freeList_(NULL),
+    cursor_(NULL),
+    slabEnd_(NULL),
+    blockSize_(0),
+    blocksPerSlab_(blocksPerSlab == 0 ? 1 : blocksPerSlab)
+{
+
+}
+
+/**
+* Destructor, which returns every slab unless another pool still shares
+* them. The pool does not run destructors for the objects living in its
+* blocks; that is up to the owner.
+*/
+inline NodePool::~NodePool()
+{
+
+}
+
+/**
+* Returns a new, empty pool drawing on the same slabs as this one, with
+* the same block and slab sizes.
+*/
+inline std::shared_ptr<NodePool> NodePool::share() const
+{
+    std::shared_ptr<NodePool> pool = std::make_shared<NodePool>(blocksPerSlab_);
+    pool->store_ = store_;
+    pool->blockSize_ = blockSize_;
+    return pool;
+}
+
+/**
+* Returns a block of at least bytes bytes. The block size is fixed by the
+* first call, and later requests must not be larger.
+*/
+inline void* NodePool::allocate(size_t bytes)
+{
+    if(blockSize_ == 0) {
+        // round up so that every block stays suitably aligned
+        const size_t align = alignof(std::max_align_t);
+        size_t size = bytes < sizeof(FreeBlock) ? sizeof(FreeBlock) : bytes;
+        blockSize_ = (size + align - 1) / align * align;
+    }
+    if(bytes > blockSize_) {
+        throw std::bad_alloc();
+    }
+
+    // reuse a freed block first
+    if(freeList_ != NULL) {
+        FreeBlock* block = freeList_;
+        freeList_ = block->next;
+        return block;
+    }
+
+    // current slab used up, grab a new one
+    if(cursor_ == slabEnd_) {
+        cursor_ = newSlab();
+        slabEnd_ = cursor_ + blockSize_ * blocksPerSlab_;
+    }
+
+    void* block = cursor_;
+    cursor_ += blockSize_;
+    return block;
+}
+
+/**
+* Puts a block obtained from allocate(), on this pool or one sharing its
+* slabs, back on the freelist.
+*/
+inline void NodePool::deallocate(void* block)
+{
+    if(block == NULL) {
+        return;
+    }
+    FreeBlock* freed = static_cast<FreeBlock*>(block);
+    freed->next = freeList_;
+    freeList_ = freed;
+}
+
+/**
+* Frees every slab at once. All blocks handed out so far become invalid.
+* If other pools share the slabs, only this pool's freelist and cursor are
+* dropped and the slabs stay until the last of them lets go.
+*/
+inline void NodePool::release()
+{
+    if(ownsSlabs()) {
+        for(size_t i = 0; i < store_->slabs.size(); ++i) {
+            ::operator delete(store_->slabs[i]);
+        }
+        store_->slabs.clear();
+    }
+    freeList_ = NULL;
+    cursor_ = NULL;
+    slabEnd_ = NULL;
+}
+
+/**
+* Returns true if no other pool shares this pool's slabs.
+*/
+inline bool NodePool::ownsSlabs() const
+{
+    return store_.use_count() == 1;
+}
+
+/**
+* Returns true if blocks can move between this pool and other, because
+* one was made from the other by share().
+*/
+inline bool NodePool::sharesSlabsWith(const NodePool& other) const
+{
+    return store_ == other.store_;
+}
+
+/**
+* Returns the size of a single block, or 0 before the first allocation.
+*/
+inline size_t NodePool::blockSize() const
+{
+    return blockSize_;
+}
+
+/**
+* Returns the number of slabs currently held by the pool and the pools
+* sharing its slabs.
+*/
+inline size_t NodePool::slabCount() const
+{
+    std::lock_guard<std::mutex> guard(store_->lock);
+    return store_->slabs.size();
+}
+
+/**
+* Returns the number of blocks carved out of each slab.
+*/
+inline size_t NodePool::blocksPerSlab() const
+{
+    return blocksPerSlab_;
+}
+
+/**
+* Takes a new slab from the heap and files it with the shared slabs.
+*/
+inline char* NodePool::newSlab()
+{
+    char* slab = static_cast<char*>(::operator new(blockSize_ * blocksPerSlab_));
+    try {
+        std::lock_guard<std::mutex> guard(store_->lock);
+        store_->slabs.push_back(slab);
+    }
+    catch(...) {
+        ::operator delete(slab);
+        throw;
+    }
+    return slab;
+}
+
+/*
+  -------------------------------------------
+  End implementations for the NodePool class.
+  -------------------------------------------
+*/
+
+#endif
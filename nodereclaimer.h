@@ -0,0 +1,155 @@
+#ifndef NODERECLAIMER_H
+#define NODERECLAIMER_H
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+/**
+* A background thread that frees detached node graphs for trees in
+* deferred clear mode, so clear() and the destructors only unhook the
+* root and return.
+*
+* There is one reclaimer per process, started by the first defer(). Tasks
+* run one at a time in the order they were handed over. At exit the
+* reclaimer finishes its queue before the program ends, so trees with
+* static storage duration should not use deferred clearing.
+*/
+class NodeReclaimer
+{
+public:
+    static NodeReclaimer& instance();
+    ~NodeReclaimer();
+
+    void defer(const std::function<void()>& task);
+    void drain();
+
+private:
+    NodeReclaimer();
+    NodeReclaimer(const NodeReclaimer&);
+    NodeReclaimer& operator=(const NodeReclaimer&);
+
+    void run();
+
+    std::mutex lock_;
+    std::condition_variable ready_;
+    std::condition_variable idle_;
+    std::deque<std::function<void()> > tasks_;
+    bool busy_;
+    bool stopping_;
+    std::thread worker_;
+};
+
+/*
+  --------------------------------------------------
+  Begin implementations for the NodeReclaimer class.
+  --------------------------------------------------
+*/
+
+/**
+* Returns the process-wide reclaimer.
+*/
+inline NodeReclaimer& NodeReclaimer::instance()
+{
+    static NodeReclaimer reclaimer;
+    return reclaimer;
+}
+
+/**
+* Constructs an idle reclaimer. The thread starts with the first task.
+*/
+inline NodeReclaimer::NodeReclaimer() :
+    busy_(false),
+    stopping_(false)
+{
+
+}
+
+/**
+* Destructor, which lets the queued tasks finish and joins the thread.
+*/
+inline NodeReclaimer::~NodeReclaimer()
+{
+    {
+        std::lock_guard<std::mutex> guard(lock_);
+        stopping_ = true;
+    }
+    ready_.notify_all();
+    if(worker_.joinable()) {
+        worker_.join();
+    }
+}
+
+/**
+* Queues task to run on the reclaimer thread and returns at once. If the
+* thread cannot be started, task runs on the caller's thread instead.
+*/
+inline void NodeReclaimer::defer(const std::function<void()>& task)
+{
+    {
+        std::lock_guard<std::mutex> guard(lock_);
+        if(!worker_.joinable()) {
+            try {
+                worker_ = std::thread(&NodeReclaimer::run, this);
+            }
+            catch(...) {
+                // no thread to hand over to; fall through and run it here
+            }
+        }
+        if(worker_.joinable()) {
+            tasks_.push_back(task);
+            ready_.notify_one();
+            return;
+        }
+    }
+    task();
+}
+
+/**
+* Waits until every task queued so far has run.
+*/
+inline void NodeReclaimer::drain()
+{
+    std::unique_lock<std::mutex> guard(lock_);
+    while(busy_ || !tasks_.empty()) {
+        idle_.wait(guard);
+    }
+}
+
+/**
+* The reclaimer thread: runs tasks until stopped with an empty queue.
+*/
+inline void NodeReclaimer::run()
+{
+    std::unique_lock<std::mutex> guard(lock_);
+    while(true) {
+        while(tasks_.empty() && !stopping_) {
+            ready_.wait(guard);
+        }
+        if(tasks_.empty()) {
+            return;
+        }
+        std::function<void()> task;
+        task.swap(tasks_.front());
+        tasks_.pop_front();
+        busy_ = true;
+        guard.unlock();
+        task();
+        task = nullptr;
+        guard.lock();
+        busy_ = false;
+        if(tasks_.empty()) {
+            idle_.notify_all();
+        }
+    }
+}
+
+/*
+  ------------------------------------------------
+  End implementations for the NodeReclaimer class.
+  ------------------------------------------------
+*/
+
+#endif
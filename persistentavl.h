@@ -0,0 +1,632 @@
+#ifndef PERSISTENTAVL_H
+#define PERSISTENTAVL_H
+
+#include <algorithm>
+#include <cstddef>
+#include <memory>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+/**
+* An immutable AVL node. Once built it never changes, so any number of
+* tree versions can share it. Children are held by shared_ptr, and a node
+* is freed as soon as the last version that reaches it goes away.
+*/
+template <typename Key, typename Value>
+class PersistentAVLNode
+{
+public:
+    typedef std::shared_ptr<const PersistentAVLNode<Key, Value> > Ptr;
+
+    PersistentAVLNode(const std::pair<const Key, Value>& item, const Ptr& left, const Ptr& right);
+
+    const std::pair<const Key, Value>& getItem() const;
+    const Key& getKey() const;
+    const Value& getValue() const;
+    const Ptr& getLeft() const;
+    const Ptr& getRight() const;
+    int getHeight() const;
+
+    static int heightOf(const Ptr& node);
+
+protected:
+    std::pair<const Key, Value> item_;
+    Ptr left_;
+    Ptr right_;
+    int height_;
+};
+
+/*
+  ---------------------------------------------------
+  Begin implementations for the PersistentAVLNode class.
+  ---------------------------------------------------
+*/
+
+/**
+* Constructor, which computes the node's height from its children.
+*/
+template<typename Key, typename Value>
+PersistentAVLNode<Key, Value>::PersistentAVLNode(const std::pair<const Key, Value>& item, const Ptr& left, const Ptr& right) :
+    item_(item),
+    left_(left),
+    right_(right),
+    height_(1 + std::max(heightOf(left), heightOf(right)))
+{
+
+}
+
+/**
+* A const getter for the item.
+*/
+template<typename Key, typename Value>
+const std::pair<const Key, Value>& PersistentAVLNode<Key, Value>::getItem() const
+{
+    return item_;
+}
+
+/**
+* A const getter for the key.
+*/
+template<typename Key, typename Value>
+const Key& PersistentAVLNode<Key, Value>::getKey() const
+{
+    return item_.first;
+}
+
+/**
+* A const getter for the value.
+*/
+template<typename Key, typename Value>
+const Value& PersistentAVLNode<Key, Value>::getValue() const
+{
+    return item_.second;
+}
+
+/**
+* A getter for the left child.
+*/
+template<typename Key, typename Value>
+const typename PersistentAVLNode<Key, Value>::Ptr& PersistentAVLNode<Key, Value>::getLeft() const
+{
+    return left_;
+}
+
+/**
+* A getter for the right child.
+*/
+template<typename Key, typename Value>
+const typename PersistentAVLNode<Key, Value>::Ptr& PersistentAVLNode<Key, Value>::getRight() const
+{
+    return right_;
+}
+
+/**
+* A getter for the height of the node's subtree.
+*/
+template<typename Key, typename Value>
+int PersistentAVLNode<Key, Value>::getHeight() const
+{
+    return height_;
+}
+
+/**
+* Height of a possibly empty subtree.
+*/
+template<typename Key, typename Value>
+int PersistentAVLNode<Key, Value>::heightOf(const Ptr& node)
+{
+    return node ? node->height_ : 0;
+}
+
+/*
+  -------------------------------------------------
+  End implementations for the PersistentAVLNode class.
+  -------------------------------------------------
+*/
+
+/**
+* An AVL tree whose updates never modify a node in place. insert() and
+* remove() copy the O(log n) nodes on the path from the root and share
+* everything else with the previous version, so snapshot() (and copying
+* the tree) is O(1), and a snapshot stays valid and unchanged no matter
+* what happens to the tree afterwards.
+*
+* A tree object itself is not thread safe, but each snapshot is an
+* independent object over immutable nodes: take it on the writer's
+* thread and hand it to readers, who may then search and iterate it
+* while the writer keeps going. Nodes are reclaimed by reference
+* counting once no version reaches them.
+*
+* The nodes on a copied path are rebuilt with copies of their key and
+* value, so both should be cheap to copy.
+*/
+template <typename Key, typename Value>
+class PersistentAVLTree
+{
+public:
+    typedef PersistentAVLNode<Key, Value> NodeType;
+    typedef typename NodeType::Ptr NodePtr;
+
+    PersistentAVLTree();
+
+    void insert(const std::pair<const Key, Value>& keyValuePair);
+    void remove(const Key& key);
+    void clear();
+    PersistentAVLTree<Key, Value> snapshot() const;
+
+    bool empty() const;
+    size_t size() const;
+    int height() const;
+    Value const & operator[](const Key& key) const;
+    bool lookup(const Key& key, Value& value) const;
+
+    /**
+    * An in-order iterator. It holds on to the version it was made from,
+    * so it stays valid while the tree moves on.
+    */
+    class iterator
+    {
+    public:
+        iterator();
+
+        const std::pair<const Key, Value>& operator*() const;
+        const std::pair<const Key, Value>* operator->() const;
+
+        bool operator==(const iterator& rhs) const;
+        bool operator!=(const iterator& rhs) const;
+
+        iterator& operator++();
+
+    protected:
+        friend class PersistentAVLTree<Key, Value>;
+        explicit iterator(const NodePtr& root);
+        void pushLeftSpine(const NodeType* node);
+
+        NodePtr root_;
+        // the current node on top, under it the ancestors still to visit
+        std::vector<const NodeType*> stack_;
+    };
+
+    iterator begin() const;
+    iterator end() const;
+    iterator find(const Key& key) const;
+    iterator lower_bound(const Key& key) const;
+
+protected:
+    const NodeType* findNode(const Key& key) const;
+    static NodePtr makeNode(const std::pair<const Key, Value>& item, const NodePtr& left, const NodePtr& right);
+    static NodePtr balanced(const std::pair<const Key, Value>& item, const NodePtr& left, const NodePtr& right);
+    static NodePtr insertInto(const NodePtr& node, const std::pair<const Key, Value>& item, bool& added);
+    static NodePtr removeFrom(const NodePtr& node, const Key& key, bool& removed);
+    static NodePtr removeSmallest(const NodePtr& node, NodePtr& smallest);
+
+    NodePtr root_;
+    size_t count_;
+};
+
+/*
+  -------------------------------------------------------------
+  Begin implementations for the PersistentAVLTree::iterator class.
+  -------------------------------------------------------------
+*/
+
+/**
+* A default constructor that makes an end() iterator.
+*/
+template<class Key, class Value>
+PersistentAVLTree<Key, Value>::iterator::iterator()
+{
+
+}
+
+/**
+* Makes an iterator over the version at root with an empty stack; the
+* tree fills in the stack.
+*/
+template<class Key, class Value>
+PersistentAVLTree<Key, Value>::iterator::iterator(const NodePtr& root) :
+    root_(root)
+{
+
+}
+
+/**
+* Provides access to the item.
+*/
+template<class Key, class Value>
+const std::pair<const Key, Value>& PersistentAVLTree<Key, Value>::iterator::operator*() const
+{
+    return stack_.back()->getItem();
+}
+
+/**
+* Provides access to the address of the item.
+*/
+template<class Key, class Value>
+const std::pair<const Key, Value>* PersistentAVLTree<Key, Value>::iterator::operator->() const
+{
+    return &(stack_.back()->getItem());
+}
+
+/**
+* Checks if 'this' iterator's internals have the same value
+* as 'rhs'
+*/
+template<class Key, class Value>
+bool PersistentAVLTree<Key, Value>::iterator::operator==(const iterator& rhs) const
+{
+    if(stack_.empty() || rhs.stack_.empty()) {
+        return stack_.empty() && rhs.stack_.empty();
+    }
+    return stack_.back() == rhs.stack_.back();
+}
+
+/**
+* Checks if 'this' iterator's internals have a different value
+* as 'rhs'
+*/
+template<class Key, class Value>
+bool PersistentAVLTree<Key, Value>::iterator::operator!=(const iterator& rhs) const
+{
+    return !(*this == rhs);
+}
+
+/**
+* Advances the iterator's location using an in-order sequencing. The
+* nodes have no parent pointers, so the way back up is kept on the stack.
+*/
+template<class Key, class Value>
+typename PersistentAVLTree<Key, Value>::iterator& PersistentAVLTree<Key, Value>::iterator::operator++()
+{
+    const NodeType* current = stack_.back();
+    stack_.pop_back();
+    pushLeftSpine(current->getRight().get());
+    if(stack_.empty()) {
+        root_.reset();
+    }
+    return *this;
+}
+
+/**
+* Pushes node and its chain of left children, so that the smallest key of
+* node's subtree ends up on top.
+*/
+template<class Key, class Value>
+void PersistentAVLTree<Key, Value>::iterator::pushLeftSpine(const NodeType* node)
+{
+    while(node != nullptr) {
+        stack_.push_back(node);
+        node = node->getLeft().get();
+    }
+}
+
+/*
+  -----------------------------------------------------------
+  End implementations for the PersistentAVLTree::iterator class.
+  -----------------------------------------------------------
+*/
+
+/*
+  ------------------------------------------------------
+  Begin implementations for the PersistentAVLTree class.
+  ------------------------------------------------------
+*/
+
+/**
+* Default constructor for an empty tree.
+*/
+template<class Key, class Value>
+PersistentAVLTree<Key, Value>::PersistentAVLTree() :
+    count_(0)
+{
+
+}
+
+/**
+* Inserts keyValuePair, overwriting the value if the key is already in
+* the tree. Copies the search path; earlier snapshots are not affected.
+*/
+template<class Key, class Value>
+void PersistentAVLTree<Key, Value>::insert(const std::pair<const Key, Value>& keyValuePair)
+{
+    bool added = false;
+    root_ = insertInto(root_, keyValuePair, added);
+    if(added) {
+        ++count_;
+    }
+}
+
+/**
+* Removes key if it is in the tree. Copies the search path; earlier
+* snapshots are not affected.
+*/
+template<class Key, class Value>
+void PersistentAVLTree<Key, Value>::remove(const Key& key)
+{
+    bool removed = false;
+    NodePtr root = removeFrom(root_, key, removed);
+    if(removed) {
+        root_ = root;
+        --count_;
+    }
+}
+
+/**
+* Drops this version. Nodes still reachable from snapshots stay alive.
+*/
+template<class Key, class Value>
+void PersistentAVLTree<Key, Value>::clear()
+{
+    root_.reset();
+    count_ = 0;
+}
+
+/**
+* Returns the current version in O(1). Later changes to this tree do not
+* show up in the snapshot, nor the other way around.
+*/
+template<class Key, class Value>
+PersistentAVLTree<Key, Value> PersistentAVLTree<Key, Value>::snapshot() const
+{
+    return *this;
+}
+
+/**
+ * Returns true if tree is empty
+*/
+template<class Key, class Value>
+bool PersistentAVLTree<Key, Value>::empty() const
+{
+    return !root_;
+}
+
+/**
+ * Returns the number of items in the tree in O(1)
+*/
+template<class Key, class Value>
+size_t PersistentAVLTree<Key, Value>::size() const
+{
+    return count_;
+}
+
+/**
+ * Returns the height of the tree, 0 when empty.
+*/
+template<class Key, class Value>
+int PersistentAVLTree<Key, Value>::height() const
+{
+    return NodeType::heightOf(root_);
+}
+
+/**
+* Returns the value stored under key, or throws std::out_of_range.
+*/
+template<class Key, class Value>
+Value const & PersistentAVLTree<Key, Value>::operator[](const Key& key) const
+{
+    const NodeType* node = findNode(key);
+    if(node == nullptr) throw std::out_of_range("Invalid key");
+    return node->getValue();
+}
+
+/**
+* Copies the value stored under key into value and returns true, or
+* returns false if key is missing. Unlike find() it builds no iterator.
+*/
+template<class Key, class Value>
+bool PersistentAVLTree<Key, Value>::lookup(const Key& key, Value& value) const
+{
+    const NodeType* node = findNode(key);
+    if(node == nullptr) {
+        return false;
+    }
+    value = node->getValue();
+    return true;
+}
+
+/**
+* Returns the node holding key, or NULL.
+*/
+template<class Key, class Value>
+const typename PersistentAVLTree<Key, Value>::NodeType* PersistentAVLTree<Key, Value>::findNode(const Key& key) const
+{
+    const NodeType* current = root_.get();
+    while(current != nullptr) {
+        if(key < current->getKey()) {
+            current = current->getLeft().get();
+        }
+        else if(current->getKey() < key) {
+            current = current->getRight().get();
+        }
+        else {
+            return current;
+        }
+    }
+    return nullptr;
+}
+
+/**
+* Returns an iterator to the smallest item.
+*/
+template<class Key, class Value>
+typename PersistentAVLTree<Key, Value>::iterator PersistentAVLTree<Key, Value>::begin() const
+{
+    iterator it(root_);
+    it.pushLeftSpine(root_.get());
+    if(it.stack_.empty()) {
+        it.root_.reset();
+    }
+    return it;
+}
+
+/**
+* Returns an iterator whose value means INVALID
+*/
+template<class Key, class Value>
+typename PersistentAVLTree<Key, Value>::iterator PersistentAVLTree<Key, Value>::end() const
+{
+    return iterator();
+}
+
+/**
+* Returns an iterator to the item with key, or end() if there is none.
+*/
+template<class Key, class Value>
+typename PersistentAVLTree<Key, Value>::iterator PersistentAVLTree<Key, Value>::find(const Key& key) const
+{
+    iterator it = lower_bound(key);
+    if(it != end() && key < it->first) {
+        return end();
+    }
+    return it;
+}
+
+/**
+* Returns an iterator to the first item whose key is not less than key.
+* Every node the search turns left at is still to be visited, so those
+* make up the stack.
+*/
+template<class Key, class Value>
+typename PersistentAVLTree<Key, Value>::iterator PersistentAVLTree<Key, Value>::lower_bound(const Key& key) const
+{
+    iterator it(root_);
+    const NodeType* current = root_.get();
+    while(current != nullptr) {
+        if(current->getKey() < key) {
+            current = current->getRight().get();
+        }
+        else {
+            it.stack_.push_back(current);
+            current = current->getLeft().get();
+        }
+    }
+    if(it.stack_.empty()) {
+        it.root_.reset();
+    }
+    return it;
+}
+
+/**
+* Allocates a node together with its reference count.
+*/
+template<class Key, class Value>
+typename PersistentAVLTree<Key, Value>::NodePtr
+PersistentAVLTree<Key, Value>::makeNode(const std::pair<const Key, Value>& item, const NodePtr& left, const NodePtr& right)
+{
+    return std::make_shared<NodeType>(item, left, right);
+}
+
+/**
+* Builds a node over left and right, whose heights differ by at most two,
+* doing the single or double rotation that brings them back within one.
+* Rotations build new nodes too, leaving the old ones untouched.
+*/
+template<class Key, class Value>
+typename PersistentAVLTree<Key, Value>::NodePtr
+PersistentAVLTree<Key, Value>::balanced(const std::pair<const Key, Value>& item, const NodePtr& left, const NodePtr& right)
+{
+    int leftHeight = NodeType::heightOf(left);
+    int rightHeight = NodeType::heightOf(right);
+
+    if(leftHeight > rightHeight + 1) {
+        if(NodeType::heightOf(left->getLeft()) >= NodeType::heightOf(left->getRight())) {
+            // left left
+            return makeNode(left->getItem(), left->getLeft(), makeNode(item, left->getRight(), right));
+        }
+        // left right
+        const NodePtr& middle = left->getRight();
+        return makeNode(middle->getItem(),
+                        makeNode(left->getItem(), left->getLeft(), middle->getLeft()),
+                        makeNode(item, middle->getRight(), right));
+    }
+    if(rightHeight > leftHeight + 1) {
+        if(NodeType::heightOf(right->getRight()) >= NodeType::heightOf(right->getLeft())) {
+            // right right
+            return makeNode(right->getItem(), makeNode(item, left, right->getLeft()), right->getRight());
+        }
+        // right left
+        const NodePtr& middle = right->getLeft();
+        return makeNode(middle->getItem(),
+                        makeNode(item, left, middle->getLeft()),
+                        makeNode(right->getItem(), middle->getRight(), right->getRight()));
+    }
+    return makeNode(item, left, right);
+}
+
+/**
+* Returns a copy of the subtree at node with item inserted (or its value
+* replaced), sharing every subtree off the search path.
+*/
+template<class Key, class Value>
+typename PersistentAVLTree<Key, Value>::NodePtr
+PersistentAVLTree<Key, Value>::insertInto(const NodePtr& node, const std::pair<const Key, Value>& item, bool& added)
+{
+    if(!node) {
+        added = true;
+        return makeNode(item, NodePtr(), NodePtr());
+    }
+    if(item.first < node->getKey()) {
+        return balanced(node->getItem(), insertInto(node->getLeft(), item, added), node->getRight());
+    }
+    if(node->getKey() < item.first) {
+        return balanced(node->getItem(), node->getLeft(), insertInto(node->getRight(), item, added));
+    }
+    return makeNode(item, node->getLeft(), node->getRight());
+}
+
+/**
+* Returns a copy of the subtree at node without key. When key is missing
+* nothing is copied and node itself comes back.
+*/
+template<class Key, class Value>
+typename PersistentAVLTree<Key, Value>::NodePtr
+PersistentAVLTree<Key, Value>::removeFrom(const NodePtr& node, const Key& key, bool& removed)
+{
+    if(!node) {
+        return node;
+    }
+    if(key < node->getKey()) {
+        NodePtr left = removeFrom(node->getLeft(), key, removed);
+        return removed ? balanced(node->getItem(), left, node->getRight()) : node;
+    }
+    if(node->getKey() < key) {
+        NodePtr right = removeFrom(node->getRight(), key, removed);
+        return removed ? balanced(node->getItem(), node->getLeft(), right) : node;
+    }
+
+    removed = true;
+    if(!node->getLeft()) {
+        return node->getRight();
+    }
+    if(!node->getRight()) {
+        return node->getLeft();
+    }
+    // the successor takes node's place
+    NodePtr successor;
+    NodePtr right = removeSmallest(node->getRight(), successor);
+    return balanced(successor->getItem(), node->getLeft(), right);
+}
+
+/**
+* Returns a copy of the subtree at node without its smallest item, which
+* is handed back in smallest.
+*/
+template<class Key, class Value>
+typename PersistentAVLTree<Key, Value>::NodePtr
+PersistentAVLTree<Key, Value>::removeSmallest(const NodePtr& node, NodePtr& smallest)
+{
+    if(!node->getLeft()) {
+        smallest = node;
+        return node->getRight();
+    }
+    return balanced(node->getItem(), removeSmallest(node->getLeft(), smallest), node->getRight());
+}
+
+/*
+  ----------------------------------------------------
+  End implementations for the PersistentAVLTree class.
+  ----------------------------------------------------
+*/
+
+#endif
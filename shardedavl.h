@@ -0,0 +1,458 @@
+#ifndef SHARDEDAVL_H
+#define SHARDEDAVL_H
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+#include "avlbst.h"
+
+/*
+ * Partition policies for ShardedAVLMap. A policy provides:
+ *   ordered                     true if shard i only holds keys below
+ *                               those of shard i + 1
+ *   shardCount()                the number of shards
+ *   shardOf(key)                the shard that holds key
+ *   overlapping(low, high,      the shards [first, last) that can hold
+ *               first, last)    keys in [low, high)
+ * The choice is made at compile time, so a policy only puts its own
+ * requirements on Key.
+ */
+
+/**
+* Spreads keys over shardCount shards by hash, which evens out any
+* workload but makes every range query visit every shard.
+*/
+template <typename Key, typename Hash = std::hash<Key> >
+class HashPartition
+{
+public:
+    static const bool ordered = false;
+
+    explicit HashPartition(size_t shardCount = 16) :
+        shardCount_(shardCount)
+    {
+        if(shardCount == 0) throw std::invalid_argument("ShardedAVLMap needs at least one shard");
+    }
+
+    size_t shardCount() const { return shardCount_; }
+    size_t shardOf(const Key& key) const { return Hash()(key) % shardCount_; }
+    void overlapping(const Key&, const Key&, size_t& first, size_t& last) const
+    {
+        first = 0;
+        last = shardCount_;
+    }
+
+private:
+    size_t shardCount_;
+};
+
+template<class Key, class Hash>
+const bool HashPartition<Key, Hash>::ordered;
+
+/**
+* Cuts the key space at sorted split points into splitPoints.size() + 1
+* shards: shard i holds the keys in [splitPoints[i-1], splitPoints[i]).
+* Each shard is a contiguous slice, so range queries only touch the shards
+* they overlap. Only needs Key to have operator<.
+*/
+template <typename Key>
+class RangePartition
+{
+public:
+    static const bool ordered = true;
+
+    explicit RangePartition(const std::vector<Key>& splitPoints) :
+        splitPoints_(splitPoints)
+    {
+        for(size_t i = 1; i < splitPoints_.size(); ++i) {
+            if(!(splitPoints_[i - 1] < splitPoints_[i])) {
+                throw std::invalid_argument("split points must be strictly increasing");
+            }
+        }
+    }
+
+    size_t shardCount() const { return splitPoints_.size() + 1; }
+    size_t shardOf(const Key& key) const
+    {
+        return std::upper_bound(splitPoints_.begin(), splitPoints_.end(), key) - splitPoints_.begin();
+    }
+    void overlapping(const Key& low, const Key& high, size_t& first, size_t& last) const
+    {
+        // the shard of the largest key below high is shardOf(high), unless
+        // high is exactly a split point
+        first = shardOf(low);
+        last = std::lower_bound(splitPoints_.begin(), splitPoints_.end(), high) - splitPoints_.begin() + 1;
+    }
+
+private:
+    std::vector<Key> splitPoints_;
+};
+
+template<class Key>
+const bool RangePartition<Key>::ordered;
+
+/**
+* An ordered map spread over several AVLTrees, each behind its own mutex,
+* so that threads working on different shards do not wait for each other.
+*
+* Partition decides which shard holds a key: HashPartition by default, or
+* RangePartition for sorted split points. Ordered traversal k-way merges
+* the shards it needs (for ordered partitions the shards simply follow
+* each other).
+*
+* Every shard counts how often its lock was taken and how often that had
+* to wait, to help pick the shard count.
+*/
+template <typename Key, typename Value, typename Partition = HashPartition<Key> >
+class ShardedAVLMap
+{
+public:
+    /**
+    * Per-shard numbers returned by shardStats().
+    */
+    struct ShardStats
+    {
+        size_t items;
+        size_t acquisitions;
+        size_t contended;
+    };
+
+    explicit ShardedAVLMap(size_t shardCount = 16);
+    explicit ShardedAVLMap(const std::vector<Key>& splitPoints);
+    explicit ShardedAVLMap(const Partition& partition);
+
+    void insert(const std::pair<const Key, Value>& keyValuePair);
+    void remove(const Key& key);
+    void clear();
+    bool find(const Key& key, Value& value) const;
+    bool contains(const Key& key) const;
+    size_t size() const;
+
+    template<typename Function>
+    void forEach(Function fn) const;
+    template<typename Function>
+    void forEachInRange(const Key& low, const Key& high, Function fn) const;
+
+    size_t shardCount() const;
+    size_t shardOf(const Key& key) const;
+    std::vector<ShardStats> shardStats() const;
+    void resetStats();
+
+protected:
+    typedef typename AVLTree<Key, Value>::iterator TreeIterator;
+
+    struct Shard
+    {
+        Shard() : acquisitions(0), contended(0) { }
+
+        AVLTree<Key, Value> tree;
+        mutable std::mutex lock;
+        mutable std::atomic<size_t> acquisitions;
+        mutable std::atomic<size_t> contended;
+    };
+
+    /**
+    * One shard's remaining run during a k-way merge.
+    */
+    struct Run
+    {
+        TreeIterator current;
+        TreeIterator end;
+    };
+
+    /**
+    * Orders runs so that the one with the smallest next key is on top.
+    */
+    struct RunGreater
+    {
+        bool operator()(const Run& a, const Run& b) const
+        {
+            return b.current->first < a.current->first;
+        }
+    };
+
+    std::unique_lock<std::mutex> lockShard(size_t index) const;
+    template<typename Function>
+    void visit(size_t first, size_t last, const Key* low, const Key* high, Function& fn) const;
+
+    void createShards();
+
+    Partition partition_;
+    std::vector<std::unique_ptr<Shard> > shards_;
+};
+
+/*
+  ---------------------------------------------------
+  Begin implementations for the ShardedAVLMap class.
+  ---------------------------------------------------
+*/
+
+/**
+* Map with shardCount shards, for a HashPartition.
+*/
+template<class Key, class Value, class Partition>
+ShardedAVLMap<Key, Value, Partition>::ShardedAVLMap(size_t shardCount) :
+    partition_(shardCount)
+{
+    createShards();
+}
+
+/**
+* Map with splitPoints.size() + 1 shards, for a RangePartition.
+* splitPoints must be strictly increasing.
+*/
+template<class Key, class Value, class Partition>
+ShardedAVLMap<Key, Value, Partition>::ShardedAVLMap(const std::vector<Key>& splitPoints) :
+    partition_(splitPoints)
+{
+    createShards();
+}
+
+/**
+* Map with the shards of partition.
+*/
+template<class Key, class Value, class Partition>
+ShardedAVLMap<Key, Value, Partition>::ShardedAVLMap(const Partition& partition) :
+    partition_(partition)
+{
+    createShards();
+}
+
+/**
+* Inserts keyValuePair into its shard, overwriting the value if the key
+* is already there.
+*/
+template<class Key, class Value, class Partition>
+void ShardedAVLMap<Key, Value, Partition>::insert(const std::pair<const Key, Value>& keyValuePair)
+{
+    size_t index = shardOf(keyValuePair.first);
+    std::unique_lock<std::mutex> guard = lockShard(index);
+    shards_[index]->tree.insert(keyValuePair);
+}
+
+/**
+* Removes key if it is in the map.
+*/
+template<class Key, class Value, class Partition>
+void ShardedAVLMap<Key, Value, Partition>::remove(const Key& key)
+{
+    size_t index = shardOf(key);
+    std::unique_lock<std::mutex> guard = lockShard(index);
+    shards_[index]->tree.remove(key);
+}
+
+/**
+* Empties every shard, one at a time.
+*/
+template<class Key, class Value, class Partition>
+void ShardedAVLMap<Key, Value, Partition>::clear()
+{
+    for(size_t i = 0; i < shards_.size(); ++i) {
+        std::unique_lock<std::mutex> guard = lockShard(i);
+        shards_[i]->tree.clear();
+    }
+}
+
+/**
+* Copies the value stored under key into value and returns true, or
+* returns false if key is missing.
+*/
+template<class Key, class Value, class Partition>
+bool ShardedAVLMap<Key, Value, Partition>::find(const Key& key, Value& value) const
+{
+    size_t index = shardOf(key);
+    std::unique_lock<std::mutex> guard = lockShard(index);
+    TreeIterator it = shards_[index]->tree.find(key);
+    if(it == shards_[index]->tree.end()) {
+        return false;
+    }
+    value = it->second;
+    return true;
+}
+
+/**
+* Returns true if key is in the map.
+*/
+template<class Key, class Value, class Partition>
+bool ShardedAVLMap<Key, Value, Partition>::contains(const Key& key) const
+{
+    size_t index = shardOf(key);
+    std::unique_lock<std::mutex> guard = lockShard(index);
+    return shards_[index]->tree.find(key) != shards_[index]->tree.end();
+}
+
+/**
+* Returns the total number of items. Shards are counted one at a time, so
+* under concurrent writes this is not an atomic snapshot.
+*/
+template<class Key, class Value, class Partition>
+size_t ShardedAVLMap<Key, Value, Partition>::size() const
+{
+    size_t total = 0;
+    for(size_t i = 0; i < shards_.size(); ++i) {
+        std::unique_lock<std::mutex> guard = lockShard(i);
+        total += shards_[i]->tree.size();
+    }
+    return total;
+}
+
+/**
+* Calls fn(item) on every item in key order. All shards stay locked for
+* the whole traversal, so fn must not call back into the map.
+*/
+template<class Key, class Value, class Partition>
+template<typename Function>
+void ShardedAVLMap<Key, Value, Partition>::forEach(Function fn) const
+{
+    visit(0, shards_.size(), nullptr, nullptr, fn);
+}
+
+/**
+* Calls fn(item) in key order on every item with low <= key < high.
+* Under range partitioning only the shards overlapping [low, high) are
+* locked and read. The same rules as forEach() apply to fn.
+*/
+template<class Key, class Value, class Partition>
+template<typename Function>
+void ShardedAVLMap<Key, Value, Partition>::forEachInRange(const Key& low, const Key& high, Function fn) const
+{
+    if(!(low < high)) {
+        return;
+    }
+    size_t first, last;
+    partition_.overlapping(low, high, first, last);
+    visit(first, last, &low, &high, fn);
+}
+
+/**
+* Returns the number of shards.
+*/
+template<class Key, class Value, class Partition>
+size_t ShardedAVLMap<Key, Value, Partition>::shardCount() const
+{
+    return shards_.size();
+}
+
+/**
+* Returns the index of the shard that holds key.
+*/
+template<class Key, class Value, class Partition>
+size_t ShardedAVLMap<Key, Value, Partition>::shardOf(const Key& key) const
+{
+    return partition_.shardOf(key);
+}
+
+/**
+* Returns the item count and lock counters of every shard. The counters
+* do not include the acquisitions made to read them.
+*/
+template<class Key, class Value, class Partition>
+std::vector<typename ShardedAVLMap<Key, Value, Partition>::ShardStats> ShardedAVLMap<Key, Value, Partition>::shardStats() const
+{
+    std::vector<ShardStats> stats(shards_.size());
+    for(size_t i = 0; i < shards_.size(); ++i) {
+        std::lock_guard<std::mutex> guard(shards_[i]->lock);
+        stats[i].items = shards_[i]->tree.size();
+        stats[i].acquisitions = shards_[i]->acquisitions;
+        stats[i].contended = shards_[i]->contended;
+    }
+    return stats;
+}
+
+/**
+* Zeroes the lock counters of every shard.
+*/
+template<class Key, class Value, class Partition>
+void ShardedAVLMap<Key, Value, Partition>::resetStats()
+{
+    for(size_t i = 0; i < shards_.size(); ++i) {
+        shards_[i]->acquisitions = 0;
+        shards_[i]->contended = 0;
+    }
+}
+
+/**
+* Locks shard index, counting the acquisition and whether it had to wait.
+*/
+template<class Key, class Value, class Partition>
+std::unique_lock<std::mutex> ShardedAVLMap<Key, Value, Partition>::lockShard(size_t index) const
+{
+    Shard& shard = *shards_[index];
+    std::unique_lock<std::mutex> guard(shard.lock, std::try_to_lock);
+    if(!guard.owns_lock()) {
+        shard.contended.fetch_add(1, std::memory_order_relaxed);
+        guard.lock();
+    }
+    shard.acquisitions.fetch_add(1, std::memory_order_relaxed);
+    return guard;
+}
+
+/**
+* Locks shards [first, last) in index order, so concurrent traversals
+* cannot deadlock, and feeds fn their items in [*low, *high) (or all of
+* them when low is NULL) in key order. Range-partitioned shards are read
+* one after another; hashed ones are merged through a min-heap of runs.
+*/
+template<class Key, class Value, class Partition>
+template<typename Function>
+void ShardedAVLMap<Key, Value, Partition>::visit(size_t first, size_t last, const Key* low, const Key* high, Function& fn) const
+{
+    std::vector<std::unique_lock<std::mutex> > guards;
+    std::vector<Run> runs;
+    for(size_t i = first; i < last; ++i) {
+        guards.push_back(lockShard(i));
+        const AVLTree<Key, Value>& tree = shards_[i]->tree;
+        Run run;
+        run.current = low ? tree.lower_bound(*low) : tree.begin();
+        run.end = high ? tree.lower_bound(*high) : tree.end();
+        if(run.current != run.end) {
+            runs.push_back(run);
+        }
+    }
+
+    if(Partition::ordered) {
+        for(size_t i = 0; i < runs.size(); ++i) {
+            for(TreeIterator it = runs[i].current; it != runs[i].end; ++it) {
+                fn(*it);
+            }
+        }
+        return;
+    }
+
+    std::priority_queue<Run, std::vector<Run>, RunGreater> heap(RunGreater(), runs);
+    while(!heap.empty()) {
+        Run run = heap.top();
+        heap.pop();
+        fn(*run.current);
+        ++run.current;
+        if(run.current != run.end) {
+            heap.push(run);
+        }
+    }
+}
+
+/**
+* Creates the shards the partition asks for.
+*/
+template<class Key, class Value, class Partition>
+void ShardedAVLMap<Key, Value, Partition>::createShards()
+{
+    for(size_t i = 0; i < partition_.shardCount(); ++i) {
+        shards_.push_back(std::unique_ptr<Shard>(new Shard));
+    }
+}
+
+/*
+  -------------------------------------------------
+  End implementations for the ShardedAVLMap class.
+  -------------------------------------------------
+*/
+
+#endif
@@ -0,0 +1,1101 @@
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <limits>
+#include <map>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+#include <unistd.h>
+#include "bst.h"
+#include "avlbst.h"
+#include "augmentedavl.h"
+#include "concurrentavl.h"
+#include "bplustree.h"
+#include "compactavl.h"
+#include "avlimage.h"
+#include "durableavl.h"
+#include "keysearch.h"
+#include "nodereclaimer.h"
+#include "persistentavl.h"
+#include "shardedavl.h"
+
+using namespace std;
+
+// Behaviour checks for the search trees: every tree is driven with random
+// operations alongside a std::map and compared with it as it goes.
+// Usage: ./tree-tests [seed]
+
+static int failures = 0;
+
+#define CHECK(condition) \
+    do { \
+        if(!(condition)) { \
+            ++failures; \
+            cerr << __FILE__ << ":" << __LINE__ << ": CHECK(" #condition ") failed" << endl; \
+        } \
+    } while(0)
+
+// the same items, in the same order
+template<class Tree>
+bool sameItems(const Tree& tree, const map<int, int>& expected)
+{
+    typename map<int, int>::const_iterator want = expected.begin();
+    for(typename Tree::iterator it = tree.begin(); it != tree.end(); ++it, ++want) {
+        if(want == expected.end() || it->first != want->first || it->second != want->second) {
+            return false;
+        }
+    }
+    return want == expected.end() && tree.size() == expected.size();
+}
+
+// the iterator points at the map item, or both are at the end
+template<class Tree>
+bool sameSpot(const Tree& tree, typename Tree::iterator it, const map<int, int>& expected, map<int, int>::const_iterator want)
+{
+    if(want == expected.end()) {
+        return it == tree.end();
+    }
+    return it != tree.end() && it->first == want->first && it->second == want->second;
+}
+
+// random inserts, removals and lookups, checked against std::map after
+// every step
+template<class Tree>
+void fuzzMap(Tree& tree, mt19937& rng, size_t steps, int keyRange)
+{
+    map<int, int> expected;
+    for(size_t step = 0; step < steps; ++step) {
+        int key = static_cast<int>(rng() % keyRange);
+        int value = static_cast<int>(rng());
+        switch(rng() % 8) {
+        case 0: {
+            bool added = tree.insert(make_pair(key, value)).second;
+            CHECK(added == (expected.find(key) == expected.end()));
+            expected[key] = value;
+            break;
+        }
+        case 1: {
+            // unlike std::map, emplace() follows insert() and overwrites
+            bool added = tree.emplace(key, value).second;
+            CHECK(added == (expected.find(key) == expected.end()));
+            expected[key] = value;
+            break;
+        }
+        case 2: {
+            bool added = tree.try_emplace(key, value).second;
+            CHECK(added == expected.emplace(key, value).second);
+            break;
+        }
+        case 3: {
+            bool added = tree.insert_or_assign(key, value).second;
+            CHECK(added == (expected.find(key) == expected.end()));
+            expected[key] = value;
+            break;
+        }
+        case 4: {
+            typename Tree::iterator hint = rng() % 2 ? tree.lower_bound(key) : tree.end();
+            // like insert(), a hinted insert overwrites an existing value
+            typename Tree::iterator it = tree.insert(hint, make_pair(key, value));
+            expected[key] = value;
+            CHECK(it != tree.end() && it->first == key && it->second == value);
+            break;
+        }
+        case 5:
+        case 6:
+            tree.remove(key);
+            expected.erase(key);
+            break;
+        default:
+            CHECK(sameSpot(tree, tree.find(key), expected, expected.find(key)));
+            CHECK(sameSpot(tree, tree.lower_bound(key), expected, expected.lower_bound(key)));
+            CHECK(sameSpot(tree, tree.upper_bound(key), expected, expected.upper_bound(key)));
+            break;
+        }
+        CHECK(tree.size() == expected.size());
+    }
+    CHECK(sameItems(tree, expected));
+    TreeValidation report = tree.validate();
+    CHECK(report.valid());
+    CHECK(report.nodes == expected.size());
+}
+
+void testBinarySearchTree(mt19937& rng)
+{
+    BinarySearchTree<int, int> plain;
+    fuzzMap(plain, rng, 20000, 500);
+
+    BinarySearchTree<int, int> pooled;
+    pooled.enableNodePool(64);
+    fuzzMap(pooled, rng, 20000, 500);
+    pooled.clear();
+    CHECK(pooled.empty() && pooled.begin() == pooled.end());
+    fuzzMap(pooled, rng, 2000, 100);
+
+    // operator[] either throws or inserts, depending on the mode
+    BinarySearchTree<int, int> lookups;
+    lookups.insert(make_pair(1, 10));
+    CHECK(lookups[1] == 10);
+    bool threw = false;
+    try {
+        lookups[2];
+    }
+    catch(const out_of_range&) {
+        threw = true;
+    }
+    CHECK(threw);
+    lookups.setInsertOnMissing(true);
+    CHECK(lookups[2] == 0 && lookups.size() == 2);
+
+    // a degenerate chain is torn down without recursion
+    BinarySearchTree<int, int> chain;
+    for(int i = 0; i < 200000; ++i) {
+        chain.insert(chain.end(), make_pair(i, i));
+    }
+    // and checked without recursion too
+    TreeValidation report = chain.validate();
+    CHECK(report.valid() && !report.balanced && report.height == 200000);
+    CHECK(!chain.isBalanced());
+    chain.clear();
+    CHECK(chain.empty());
+}
+
+void testAVLTree(mt19937& rng)
+{
+    AVLTree<int, int> plain;
+    fuzzMap(plain, rng, 20000, 500);
+    CHECK(plain.isBalanced());
+
+    AVLTree<int, int> pooled;
+    pooled.enableNodePool(64);
+    fuzzMap(pooled, rng, 20000, 5000);
+    CHECK(pooled.isBalanced());
+
+    // removing keys from the middle of a full tree takes out nodes with
+    // two children, which are swapped with their predecessor first
+    AVLTree<int, int> full;
+    map<int, int> kept;
+    for(int i = 0; i < 1023; ++i) {
+        full.insert(make_pair(i, i));
+        kept[i] = i;
+    }
+    for(int offset = 0; offset < 256; ++offset) {
+        full.remove(511 - offset);
+        kept.erase(511 - offset);
+        full.remove(512 + offset);
+        kept.erase(512 + offset);
+    }
+    CHECK(sameItems(full, kept) && full.isBalanced());
+
+    // rank, select and random steps against the sorted keys
+    AVLTree<int, int> tree;
+    vector<int> keys;
+    for(int i = 0; i < 3000; ++i) {
+        int key = static_cast<int>(rng() % 100000);
+        if(tree.insert(make_pair(key, i)).second) {
+            keys.push_back(key);
+        }
+    }
+    sort(keys.begin(), keys.end());
+    for(size_t i = 0; i < keys.size(); i += 7) {
+        CHECK(tree.rank(keys[i]) == i);
+        CHECK(tree.rank(keys[i] + 1) == i + 1);
+        AVLTree<int, int>::iterator it = tree.select(i);
+        CHECK(it != tree.end() && it->first == keys[i]);
+        CHECK((tree.begin() + static_cast<ptrdiff_t>(i))->first == keys[i]);
+        if(i >= 5) {
+            CHECK((it - 5)->first == keys[i - 5]);
+        }
+    }
+    CHECK(tree.select(keys.size()) == tree.end());
+    CHECK(tree.begin() + static_cast<ptrdiff_t>(keys.size()) == tree.end());
+
+    // stepping back from end() counts from the largest key
+    ptrdiff_t count = static_cast<ptrdiff_t>(keys.size());
+    CHECK((tree.end() - 1)->first == keys.back());
+    CHECK(tree.end() - count == tree.begin());
+    CHECK(tree.end() - (count + 1) == tree.end());
+    CHECK(tree.end() + 1 == tree.end());
+    AVLTree<int, int>::iterator back = tree.end();
+    back -= 3;
+    CHECK(back->first == keys[keys.size() - 3]);
+    for(ptrdiff_t k = 1; k <= 10; ++k) {
+        CHECK((tree.end() - k)->first == keys[keys.size() - k]);
+    }
+    AVLTree<int, int> none;
+    CHECK(none.end() - 1 == none.end());
+
+    // O(n) construction from sorted input
+    vector<pair<int, int> > sorted;
+    for(int i = 0; i < 1000; ++i) {
+        sorted.push_back(make_pair(i * 3, i));
+    }
+    AVLTree<int, int> built(sorted.begin(), sorted.end());
+    CHECK(built.size() == 1000 && built.validate().valid() && built.isBalanced());
+    CHECK(built.find(297)->second == 99);
+}
+
+// random items with keys below keyRange, in a tree and a map
+void randomItems(AVLTree<int, int>& tree, map<int, int>& items, mt19937& rng, size_t count, int keyRange)
+{
+    for(size_t i = 0; i < count; ++i) {
+        int key = static_cast<int>(rng() % keyRange);
+        int value = static_cast<int>(rng());
+        tree.insert(make_pair(key, value));
+        items[key] = value;
+    }
+}
+
+void testSplitJoin(mt19937& rng)
+{
+    // the halves of a pooled tree are independent trees, down to their
+    // freelists, so each can be worked on from its own thread
+    AVLTree<int, int> lower;
+    lower.enableNodePool(64);
+    for(int i = 0; i < 20000; ++i) {
+        lower.insert(lower.end(), make_pair(i, i));
+    }
+    AVLTree<int, int> upper;
+    lower.split(10000, upper);
+    CHECK(lower.size() == 10000 && upper.size() == 10000);
+    CHECK(lower.validate().valid() && upper.validate().valid());
+    CHECK((lower.end() - 1)->first == 9999 && upper.begin()->first == 10000);
+
+    unsigned lowerSeed = static_cast<unsigned>(rng());
+    unsigned upperSeed = static_cast<unsigned>(rng());
+    thread worker([&lower, lowerSeed]() {
+        mt19937 local(lowerSeed);
+        for(int i = 0; i < 20000; ++i) {
+            int key = static_cast<int>(local() % 10000);
+            if(local() % 2) lower.remove(key);
+            else lower.insert(make_pair(key, key));
+        }
+    });
+    mt19937 local(upperSeed);
+    for(int i = 0; i < 20000; ++i) {
+        int key = 10000 + static_cast<int>(local() % 10000);
+        if(local() % 2) upper.remove(key);
+        else upper.insert(make_pair(key, key));
+    }
+    worker.join();
+    CHECK(lower.validate().valid() && upper.validate().valid());
+
+    // and they go back together, with either one cleared or gone first
+    size_t total = lower.size() + upper.size();
+    lower.join(upper);
+    CHECK(lower.size() == total && upper.empty() && lower.validate().valid());
+    {
+        AVLTree<int, int> rest;
+        lower.split(5000, rest);
+        rest.clear();
+        CHECK(rest.empty());
+    }
+    CHECK(lower.validate().valid() && (lower.end() - 1)->first < 5000);
+    lower.clear();
+    CHECK(lower.empty());
+
+    // random trees split at a random key and joined back
+    for(int round = 0; round < 20; ++round) {
+        int keyRange = 50 + static_cast<int>(rng() % 5000);
+        AVLTree<int, int> tree;
+        map<int, int> items;
+        randomItems(tree, items, rng, rng() % 3000, keyRange);
+        AVLTree<int, int> rest;
+        int cut = static_cast<int>(rng() % keyRange);
+        tree.split(cut, rest);
+        CHECK(tree.validate().valid() && rest.validate().valid());
+        CHECK(tree.empty() || (tree.end() - 1)->first < cut);
+        CHECK(rest.empty() || rest.begin()->first >= cut);
+        tree.join(rest);
+        CHECK(rest.empty() && sameItems(tree, items) && tree.validate().valid());
+    }
+}
+
+// keys [low, high) with value key * 10
+void fillRange(AVLTree<int, int>& tree, int low, int high)
+{
+    for(int key = low; key < high; ++key) {
+        tree.insert(tree.end(), make_pair(key, key * 10));
+    }
+}
+
+bool holdsRange(const AVLTree<int, int>& tree, int low, int high)
+{
+    if(tree.size() != static_cast<size_t>(high - low) || !tree.validate().valid()) {
+        return false;
+    }
+    int key = low;
+    for(AVLTree<int, int>::iterator it = tree.begin(); it != tree.end(); ++it, ++key) {
+        if(it->first != key || it->second != key * 10) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void testMixedAllocators()
+{
+    // pools over different slabs, and a pool against plain new/delete:
+    // the nodes of the right-hand tree are copied over, not refused
+    for(int mode = 0; mode < 3; ++mode) {
+        AVLTree<int, int> left;
+        AVLTree<int, int> right;
+        if(mode != 2) left.enableNodePool(32);
+        if(mode != 1) right.enableNodePool(32);
+
+        fillRange(left, 0, 1000);
+        fillRange(right, 1000, 2500);
+        left.join(right);
+        CHECK(right.empty() && holdsRange(left, 0, 2500));
+        right.clear();
+
+        fillRange(right, 2501, 3000);
+        left.join(2500, 25000, right);
+        CHECK(right.empty() && holdsRange(left, 0, 3000));
+
+        AVLTree<int, int> upper;
+        if(mode == 0) upper.enableNodePool(8);
+        left.split(2000, upper);
+        CHECK(holdsRange(left, 0, 2000) && holdsRange(upper, 2000, 3000));
+
+        AVLTree<int, int> other;
+        if(mode != 1) other.enableNodePool(16);
+        fillRange(other, 1500, 2200);
+        left.unionWith(other);
+        CHECK(other.empty() && holdsRange(left, 0, 2200));
+
+        fillRange(other, 100, 300);
+        left.difference(other);
+        CHECK(other.empty() && left.size() == 2000 && left.find(150) == left.end() && left.validate().valid());
+
+        fillRange(other, 1900, 2600);
+        upper.intersect(other);
+        CHECK(other.empty() && holdsRange(upper, 2000, 2600));
+
+        // the trees stay usable on whatever allocator they ended up with
+        fillRange(other, 5000, 5100);
+        other.remove(5050);
+        upper.clear();
+        left.clear();
+        other.clear();
+        CHECK(left.empty() && upper.empty() && other.empty());
+    }
+}
+
+void testSetOperations(mt19937& rng)
+{
+    for(unsigned threads = 1; threads <= 4; threads *= 4) {
+        for(int round = 0; round < 20; ++round) {
+            int keyRange = 50 + static_cast<int>(rng() % 5000);
+            AVLTree<int, int> a;
+            AVLTree<int, int> b;
+            map<int, int> itemsA;
+            map<int, int> itemsB;
+            randomItems(a, itemsA, rng, rng() % 3000, keyRange);
+            randomItems(b, itemsB, rng, rng() % 3000, keyRange);
+
+            map<int, int> expected = itemsA;
+            switch(round % 3) {
+            case 0:
+                // other's value wins for keys in both
+                for(map<int, int>::const_iterator it = itemsB.begin(); it != itemsB.end(); ++it) {
+                    expected[it->first] = it->second;
+                }
+                a.unionWith(b, threads);
+                break;
+            case 1:
+                for(map<int, int>::const_iterator it = itemsA.begin(); it != itemsA.end(); ++it) {
+                    if(itemsB.find(it->first) == itemsB.end()) {
+                        expected.erase(it->first);
+                    }
+                }
+                a.intersect(b, threads);
+                break;
+            default:
+                for(map<int, int>::const_iterator it = itemsB.begin(); it != itemsB.end(); ++it) {
+                    expected.erase(it->first);
+                }
+                a.difference(b, threads);
+                break;
+            }
+            CHECK(b.empty());
+            TreeValidation report = a.validate();
+            CHECK(report.valid() && report.balanced);
+            if(round % 3 == 1) {
+                // keys only: which side's value survives is not promised
+                bool sameKeys = a.size() == expected.size();
+                map<int, int>::const_iterator want = expected.begin();
+                for(AVLTree<int, int>::iterator it = a.begin(); sameKeys && it != a.end(); ++it, ++want) {
+                    sameKeys = it->first == want->first;
+                }
+                CHECK(sameKeys);
+            }
+            else {
+                CHECK(sameItems(a, expected));
+            }
+        }
+    }
+}
+
+void testBulkInsert(mt19937& rng)
+{
+    // unsorted, with repeats, where the last one wins
+    AVLTree<int, int> tree;
+    map<int, int> expected;
+    randomItems(tree, expected, rng, 1000, 20000);
+    vector<pair<int, int> > batch;
+    for(int i = 0; i < 20000; ++i) {
+        batch.push_back(make_pair(static_cast<int>(rng() % 20000), i));
+        expected[batch.back().first] = i;
+    }
+    tree.bulkInsert(batch.begin(), batch.end(), 4);
+    CHECK(sameItems(tree, expected) && tree.validate().valid() && tree.isBalanced());
+}
+
+void testAugmentedAVLTree(mt19937& rng)
+{
+    // every write goes through the tree, so the sums never go stale
+    AugmentedAVLTree<int, long long, SumSummary<long long> > tree;
+    map<int, long long> expected;
+    for(int step = 0; step < 20000; ++step) {
+        int key = static_cast<int>(rng() % 1000);
+        long long value = static_cast<long long>(rng() % 1000);
+        switch(rng() % 6) {
+        case 0:
+            tree.insert(make_pair(key, value));
+            expected[key] = value;
+            break;
+        case 1:
+            tree.insert_or_assign(key, value);
+            expected[key] = value;
+            break;
+        case 2:
+            if(tree.try_emplace(key, value).second) {
+                expected[key] = value;
+            }
+            break;
+        case 3:
+            tree.insert(tree.lower_bound(key), make_pair(key, value));
+            expected[key] = value;
+            break;
+        case 4:
+            tree.remove(key);
+            expected.erase(key);
+            break;
+        default: {
+            int high = key + static_cast<int>(rng() % 200);
+            long long want = 0;
+            for(map<int, long long>::const_iterator it = expected.lower_bound(key); it != expected.end() && it->first < high; ++it) {
+                want += it->second;
+            }
+            CHECK(tree.aggregate(key, high) == want);
+            break;
+        }
+        }
+    }
+    long long all = 0;
+    for(map<int, long long>::const_iterator it = expected.begin(); it != expected.end(); ++it) {
+        all += it->second;
+    }
+    CHECK(tree.total() == all);
+    CHECK(tree.validate().valid());
+
+    // reads hand out const items
+    if(!expected.empty()) {
+        int key = expected.begin()->first;
+        CHECK(tree[key] == expected.begin()->second);
+        CHECK(tree.begin()->first == key && (tree.end() - 1)->first == expected.rbegin()->first);
+    }
+    long long scanned = tree.parallel_reduce(0LL,
+        [](const pair<const int, long long>& item) { return item.second; },
+        [](long long a, long long b) { return a + b; }, 4);
+    CHECK(scanned == all);
+}
+
+// a value without a default constructor
+struct Label
+{
+    explicit Label(const string& text) : text(text) { }
+
+    string text;
+};
+
+void testConcurrentAVLTree()
+{
+    // readers run against a writer; every value they see must be one the
+    // writer stored, and every snapshot a whole version
+    ConcurrentAVLTree<int, int> tree;
+    const int keys = 512;
+    for(int key = 0; key < keys; key += 2) {
+        tree.insert(make_pair(key, key * 3));
+    }
+    vector<int> readerFailures(3, 0);
+    vector<thread> readers;
+    for(size_t r = 0; r < readerFailures.size(); ++r) {
+        readers.push_back(thread([&tree, &readerFailures, r]() {
+            mt19937 local(static_cast<unsigned>(r));
+            for(int i = 0; i < 20000; ++i) {
+                int key = static_cast<int>(local() % keys);
+                int value = 0;
+                if(tree.find(key, value) && value != key * 3) {
+                    ++readerFailures[r];
+                }
+                if(i % 1000 == 0) {
+                    ConcurrentAVLTree<int, int>::Version version = tree.snapshot();
+                    size_t seen = 0;
+                    for(ConcurrentAVLTree<int, int>::Version::iterator it = version.begin(); it != version.end(); ++it) {
+                        ++seen;
+                    }
+                    if(seen != version.size()) {
+                        ++readerFailures[r];
+                    }
+                }
+            }
+        }));
+    }
+    mt19937 local(99);
+    for(int i = 0; i < 3000; ++i) {
+        int key = static_cast<int>(local() % keys);
+        if(i % 3 == 0) {
+            tree.remove(key);
+        }
+        else if(i % 100 == 0) {
+            tree.apply([key](ConcurrentAVLTree<int, int>::Version& version) {
+                version.insert(make_pair(key, key * 3));
+                version.remove(key + 1);
+            });
+        }
+        else {
+            tree.insert(make_pair(key, key * 3));
+        }
+    }
+    for(size_t r = 0; r < readers.size(); ++r) {
+        readers[r].join();
+        CHECK(readerFailures[r] == 0);
+    }
+    size_t present = 0;
+    for(int key = 0; key < keys; ++key) {
+        present += tree.contains(key) ? 1 : 0;
+    }
+    CHECK(present == tree.size());
+    tree.clear();
+    CHECK(tree.size() == 0 && !tree.contains(0));
+
+    // contains() copies nothing out, so values need no default constructor
+    ConcurrentAVLTree<int, Label> labels;
+    labels.insert(make_pair(1, Label("one")));
+    CHECK(labels.contains(1) && !labels.contains(2));
+}
+
+// reaches into the nodes to check that isBalanced() notices damage
+class DamagedBPlusTree : public BPlusTree<int, int, 64>
+{
+public:
+    void cutLeafChain() { leftmost_->next = nullptr; }
+    void miscount() { ++count_; }
+};
+
+// insert, remove and the lookups of a B+ tree with small nodes, so that
+// splits, borrows and merges happen on every level
+template<class Tree>
+void fuzzBPlusTree(Tree& tree, mt19937& rng, size_t steps, int keyRange)
+{
+    map<int, int> expected;
+    for(size_t step = 0; step < steps; ++step) {
+        int key = static_cast<int>(rng() % keyRange);
+        int value = static_cast<int>(rng());
+        switch(rng() % 5) {
+        case 0:
+        case 1: {
+            bool added = tree.insert(make_pair(key, value)).second;
+            CHECK(added == (expected.find(key) == expected.end()));
+            expected[key] = value;
+            break;
+        }
+        case 2:
+        case 3:
+            tree.remove(key);
+            expected.erase(key);
+            break;
+        default:
+            CHECK(sameSpot(tree, tree.find(key), expected, expected.find(key)));
+            CHECK(sameSpot(tree, tree.lower_bound(key), expected, expected.lower_bound(key)));
+            break;
+        }
+        CHECK(tree.size() == expected.size());
+        if(step % 500 == 0) {
+            CHECK(tree.isBalanced());
+        }
+    }
+    CHECK(sameItems(tree, expected));
+    CHECK(tree.isBalanced());
+}
+
+void testBPlusTree(mt19937& rng)
+{
+    BPlusTree<int, int, 64> small;
+    fuzzBPlusTree(small, rng, 40000, 3000);
+    CHECK(small.height() > 2);
+    while(!small.empty()) {
+        small.remove(small.begin()->first);
+    }
+    CHECK(small.isBalanced() && small.height() == 0);
+
+    BPlusTree<int, int> wide;
+    fuzzBPlusTree(wide, rng, 40000, 20000);
+
+    DamagedBPlusTree chain;
+    DamagedBPlusTree count;
+    for(int i = 0; i < 500; ++i) {
+        chain.insert(make_pair(i, i));
+        count.insert(make_pair(i, i));
+    }
+    CHECK(chain.isBalanced() && count.isBalanced());
+    chain.cutLeafChain();
+    count.miscount();
+    CHECK(!chain.isBalanced() && !count.isBalanced());
+    chain.clear();
+}
+
+void testCompactAVLTree(mt19937& rng)
+{
+    CompactAVLTree<int, int> tree;
+    map<int, int> expected;
+    for(int step = 0; step < 40000; ++step) {
+        int key = static_cast<int>(rng() % 3000);
+        int value = static_cast<int>(rng());
+        switch(rng() % 5) {
+        case 0:
+        case 1: {
+            // the iterator from insert() has to find its path to move on
+            pair<CompactAVLTree<int, int>::iterator, bool> placed = tree.insert(make_pair(key, value));
+            CHECK(placed.second == (expected.find(key) == expected.end()));
+            expected[key] = value;
+            CHECK(placed.first->first == key && placed.first->second == value);
+            CHECK(placed.first == tree.find(key));
+            map<int, int>::const_iterator next = expected.upper_bound(key);
+            CHECK(sameSpot(tree, ++placed.first, expected, next));
+            break;
+        }
+        case 2:
+        case 3:
+            tree.remove(key);
+            expected.erase(key);
+            break;
+        default:
+            CHECK(sameSpot(tree, tree.find(key), expected, expected.find(key)));
+            CHECK(sameSpot(tree, tree.lower_bound(key), expected, expected.lower_bound(key)));
+            break;
+        }
+        CHECK(tree.size() == expected.size());
+    }
+    CHECK(sameItems(tree, expected));
+    CHECK(tree.isBalanced());
+    tree.clear();
+    CHECK(tree.empty() && tree.begin() == tree.end());
+}
+
+// true if opening path as an image of Key/Value throws
+template<class Key, class Value>
+bool imageRejected(const string& path, bool verify = true)
+{
+    try {
+        openMappedImage<Key, Value>(path, verify);
+    }
+    catch(const runtime_error&) {
+        return true;
+    }
+    return false;
+}
+
+// flips one byte of the file at path, offset bytes from the end
+void damageFile(const string& path, long offset)
+{
+    FILE* file = fopen(path.c_str(), "r+b");
+    fseek(file, -offset, SEEK_END);
+    int byte = fgetc(file);
+    fseek(file, -offset, SEEK_END);
+    fputc(byte ^ 0x5a, file);
+    fclose(file);
+}
+
+void testImages(mt19937& rng)
+{
+    const string path = "tree-tests-image.bin";
+    AVLTree<int, int> tree;
+    map<int, int> expected;
+    for(int i = 0; i < 5000; ++i) {
+        int key = static_cast<int>(rng() % 100000);
+        int value = static_cast<int>(rng());
+        tree.insert(make_pair(key, value));
+        expected[key] = value;
+    }
+
+    // freeze/thaw and save/load/map all hand back the same items
+    FrozenAVLTree<int, int> frozen = tree.freeze();
+    CHECK(sameItems(frozen, expected));
+    AVLTree<int, int> thawed;
+    thawed.thaw(frozen);
+    CHECK(sameItems(thawed, expected) && thawed.validate().valid());
+
+    saveImage(tree, path);
+    AVLTree<int, int> loaded;
+    loaded.insert(make_pair(-1, -1));
+    loadImage(loaded, path);
+    CHECK(sameItems(loaded, expected) && loaded.validate().valid() && loaded.isBalanced());
+    {
+        FrozenAVLTree<int, int> mapped = openMappedImage<int, int>(path);
+        CHECK(sameItems(mapped, expected));
+        for(map<int, int>::const_iterator it = expected.begin(); it != expected.end(); ++it) {
+            CHECK(mapped.contains(it->first) && mapped[it->first] == it->second);
+        }
+        CHECK(!mapped.contains(-1) && mapped.find(100000) == mapped.end());
+    }
+    saveImage(frozen, path);
+    CHECK((sameItems(openMappedImage<int, int>(path), expected)));
+
+    AVLTree<int, int> empty;
+    saveImage(empty, path);
+    loadImage(loaded, path);
+    CHECK((loaded.empty() && openMappedImage<int, int>(path).empty()));
+
+    // damaged, truncated, foreign and missing images are refused, and a
+    // failed load leaves the tree alone
+    saveImage(tree, path);
+    CHECK((imageRejected<long long, int>(path)));
+    CHECK((imageRejected<int, long long>(path)));
+    damageFile(path, 5);
+    CHECK((imageRejected<int, int>(path)));
+    CHECK((!imageRejected<int, int>(path, false)));
+    bool threw = false;
+    try {
+        loadImage(thawed, path);
+    }
+    catch(const runtime_error&) {
+        threw = true;
+    }
+    CHECK(threw && sameItems(thawed, expected));
+
+    FILE* file = fopen(path.c_str(), "wb");
+    fputs("AVLIMAGE but far too short", file);
+    fclose(file);
+    CHECK((imageRejected<int, int>(path)));
+    remove(path.c_str());
+    CHECK((imageRejected<int, int>(path)));
+}
+
+void testParallelScans(mt19937& rng)
+{
+    AVLTree<int, int> tree;
+    map<int, int> expected;
+    randomItems(tree, expected, rng, 50000, 1000000);
+    long long want = 0;
+    for(map<int, int>::const_iterator it = expected.begin(); it != expected.end(); ++it) {
+        want += it->second;
+    }
+    for(unsigned threads = 1; threads <= 8; threads *= 2) {
+        long long sum = tree.parallel_reduce(0LL,
+            [](const pair<const int, int>& item) { return static_cast<long long>(item.second); },
+            [](long long x, long long y) { return x + y; }, threads);
+        CHECK(sum == want);
+        atomic<size_t> visited(0);
+        tree.parallel_for_each([&visited](pair<const int, int>&) { ++visited; }, threads);
+        CHECK(visited.load() == expected.size());
+    }
+
+    // batched lookups land where single ones do
+    vector<int> probes;
+    for(int i = 0; i < 1000; ++i) {
+        probes.push_back(static_cast<int>(rng() % 1000000));
+    }
+    vector<AVLTree<int, int>::iterator> found(probes.size());
+    tree.findBatch(probes.data(), probes.size(), found.data());
+    for(size_t i = 0; i < probes.size(); ++i) {
+        CHECK(found[i] == tree.find(probes[i]));
+    }
+}
+
+// KeySearch against std::lower_bound/upper_bound on sorted arrays
+template<class Key>
+void checkKeySearch(mt19937& rng)
+{
+    for(int round = 0; round < 200; ++round) {
+        size_t count = rng() % 70;
+        vector<Key> keys;
+        for(size_t i = 0; i < count; ++i) {
+            // small ranges give repeats, the extremes test the sign handling
+            switch(rng() % 4) {
+            case 0: keys.push_back(numeric_limits<Key>::min()); break;
+            case 1: keys.push_back(numeric_limits<Key>::max()); break;
+            default: keys.push_back(static_cast<Key>(static_cast<long long>(rng() % 200) - 100)); break;
+            }
+        }
+        sort(keys.begin(), keys.end());
+        for(int probe = 0; probe < 40; ++probe) {
+            Key key = probe < 2 ? (probe == 0 ? numeric_limits<Key>::min() : numeric_limits<Key>::max())
+                                : static_cast<Key>(static_cast<long long>(rng() % 220) - 110);
+            size_t low = static_cast<size_t>(lower_bound(keys.begin(), keys.end(), key) - keys.begin());
+            size_t high = static_cast<size_t>(upper_bound(keys.begin(), keys.end(), key) - keys.begin());
+            CHECK(KeySearch<Key>::lowerBound(keys.data(), keys.size(), key) == low);
+            CHECK(KeySearch<Key>::upperBound(keys.data(), keys.size(), key) == high);
+        }
+    }
+}
+
+void testKeySearch(mt19937& rng)
+{
+    checkKeySearch<int32_t>(rng);
+    checkKeySearch<uint32_t>(rng);
+    checkKeySearch<int64_t>(rng);
+    checkKeySearch<uint64_t>(rng);
+    checkKeySearch<double>(rng);
+}
+
+void testPersistentAVLTree(mt19937& rng)
+{
+    // snapshots keep their items while the tree moves on
+    PersistentAVLTree<int, int> tree;
+    map<int, int> expected;
+    for(int i = 0; i < 5000; ++i) {
+        int key = static_cast<int>(rng() % 2000);
+        if(rng() % 3 == 0) {
+            tree.remove(key);
+            expected.erase(key);
+        }
+        else {
+            tree.insert(make_pair(key, i));
+            expected[key] = i;
+        }
+    }
+    PersistentAVLTree<int, int> before = tree.snapshot();
+    map<int, int> frozen = expected;
+    for(int i = 0; i < 2000; ++i) {
+        tree.remove(i);
+        tree.insert(make_pair(i + 5000, i));
+    }
+    CHECK(sameItems(before, frozen) && before.size() == frozen.size());
+    CHECK(tree.size() == 2000 && tree.begin()->first == 5000);
+}
+
+// a key with an order but no std::hash
+struct Point
+{
+    Point(int x, int y) : x(x), y(y) { }
+    bool operator<(const Point& other) const { return x < other.x || (x == other.x && y < other.y); }
+    bool operator==(const Point& other) const { return x == other.x && y == other.y; }
+
+    int x;
+    int y;
+};
+
+ostream& operator<<(ostream& out, const Point& point)
+{
+    return out << point.x << ',' << point.y;
+}
+
+void testShardedAVLMap()
+{
+    // shards filled from several threads, read back in key order
+    ShardedAVLMap<int, int> sharded(8);
+    vector<thread> writers;
+    for(int t = 0; t < 4; ++t) {
+        writers.push_back(thread([&sharded, t]() {
+            for(int i = t; i < 20000; i += 4) {
+                sharded.insert(make_pair(i, i * 2));
+                if(i % 5 == 0) {
+                    sharded.remove(i);
+                }
+            }
+        }));
+    }
+    for(size_t t = 0; t < writers.size(); ++t) {
+        writers[t].join();
+    }
+    CHECK(sharded.size() == 16000);
+    int last = -1;
+    bool ordered = true;
+    sharded.forEach([&last, &ordered](const pair<const int, int>& item) {
+        ordered = ordered && item.first > last && item.second == item.first * 2 && item.first % 5 != 0;
+        last = item.first;
+    });
+    CHECK(ordered && last == 19999);
+
+    // range partitioning hashes nothing, so Point needs no std::hash
+    vector<Point> splitPoints;
+    splitPoints.push_back(Point(10, 0));
+    splitPoints.push_back(Point(20, 0));
+    ShardedAVLMap<Point, int, RangePartition<Point> > ranged(splitPoints);
+    for(int x = 0; x < 30; ++x) {
+        for(int y = 0; y < 3; ++y) {
+            ranged.insert(make_pair(Point(x, y), x * 3 + y));
+        }
+    }
+    CHECK(ranged.shardCount() == 3 && ranged.size() == 90);
+    CHECK(ranged.shardOf(Point(9, 2)) == 0 && ranged.shardOf(Point(10, 0)) == 1 && ranged.shardOf(Point(25, 1)) == 2);
+    vector<int> slice;
+    ranged.forEachInRange(Point(9, 1), Point(20, 1), [&slice](const pair<const Point, int>& item) {
+        slice.push_back(item.second);
+    });
+    bool contiguous = slice.size() == 33;
+    for(size_t i = 0; contiguous && i < slice.size(); ++i) {
+        contiguous = slice[i] == 28 + static_cast<int>(i);
+    }
+    CHECK(contiguous);
+}
+
+void testDeferredClear(mt19937& rng)
+{
+    // nodes with real destructors freed on the reclaimer thread while
+    // this one keeps using the trees
+    for(int pooled = 0; pooled < 2; ++pooled) {
+        BinarySearchTree<int, string> plain;
+        AVLTree<int, string> avl;
+        if(pooled) {
+            plain.enableNodePool(128);
+            avl.enableNodePool(128);
+        }
+        plain.setDeferredClear(true);
+        avl.setDeferredClear(true);
+        for(int round = 0; round < 5; ++round) {
+            for(int i = 0; i < 5000; ++i) {
+                int key = static_cast<int>(rng() % 100000);
+                plain.insert(plain.end(), make_pair(i, to_string(key) + " a value too long for the short string buffer"));
+                avl.insert(make_pair(key, to_string(i) + " a value too long for the short string buffer"));
+            }
+            plain.clear();
+            avl.clear();
+            CHECK(plain.empty() && avl.empty() && avl.validate().valid());
+        }
+        AVLTree<int, string>* dropped = new AVLTree<int, string>;
+        dropped->setDeferredClear(true);
+        for(int i = 0; i < 1000; ++i) {
+            dropped->insert(make_pair(i, string(40, 'x')));
+        }
+        delete dropped;
+    }
+    NodeReclaimer::instance().drain();
+}
+
+// the contents of the durable tree at path, read back by reopening it
+map<int, int> reopened(const string& path)
+{
+    DurableAVLTree<int, int> tree(path, DURABILITY_BUFFERED);
+    map<int, int> items;
+    for(int key = 0; key < 1000; ++key) {
+        int value = 0;
+        if(tree.find(key, value)) {
+            items[key] = value;
+        }
+    }
+    CHECK(tree.size() == items.size());
+    return items;
+}
+
+void testDurableAVLTree(mt19937& rng)
+{
+    char directory[] = "/tmp/tree-tests-XXXXXX";
+    if(mkdtemp(directory) == NULL) {
+        CHECK(!"mkdtemp failed");
+        return;
+    }
+    const string path = directory;
+    const string log = path + "/wal.log";
+    map<int, int> expected;
+    {
+        DurableAVLTree<int, int> tree(path, DURABILITY_BUFFERED, 4096);
+        for(int i = 0; i < 3000; ++i) {
+            int key = static_cast<int>(rng() % 1000);
+            if(i % 4 == 0) {
+                tree.remove(key);
+                expected.erase(key);
+            }
+            else {
+                tree.insert(make_pair(key, i));
+                expected[key] = i;
+            }
+        }
+        CHECK(tree.size() == expected.size());
+    }
+    CHECK(reopened(path) == expected);
+
+    // a record torn in half by a crash is dropped, the ones before it kept
+    map<int, int> beforeLast;
+    {
+        DurableAVLTree<int, int> tree(path, DURABILITY_SYNC, 1 << 20);
+        tree.checkpoint();
+        tree.insert(make_pair(5, 50));
+        expected[5] = 50;
+        beforeLast = expected;
+        tree.insert(make_pair(6, 60));
+        CHECK(tree.logBytes() > 0);
+    }
+    {
+        FILE* file = fopen(log.c_str(), "r+b");
+        fseek(file, 0, SEEK_END);
+        long bytes = ftell(file);
+        fclose(file);
+        CHECK(truncate(log.c_str(), bytes - 3) == 0);
+    }
+    CHECK(reopened(path) == beforeLast);
+
+    // garbage after the last good record is cut off and new records
+    // land after the good ones
+    {
+        FILE* file = fopen(log.c_str(), "ab");
+        fputs("not a record at all", file);
+        fclose(file);
+    }
+    {
+        DurableAVLTree<int, int> tree(path, DURABILITY_GROUP, 1 << 20);
+        tree.insert(make_pair(7, 70));
+        beforeLast[7] = 70;
+    }
+    CHECK(reopened(path) == beforeLast);
+
+    // a crash right after a record header leaves nothing of the payload
+    {
+        DurableAVLTree<int, int> tree(path, DURABILITY_SYNC, 1 << 20);
+        tree.checkpoint();
+        tree.insert(make_pair(8, 80));
+    }
+    CHECK(truncate(log.c_str(), 8) == 0);
+    CHECK(reopened(path) == beforeLast);
+
+    remove((path + "/checkpoint.img").c_str());
+    remove(log.c_str());
+    rmdir(path.c_str());
+}
+
+int main(int argc, char *argv[])
+{
+    unsigned seed = argc > 1 ? static_cast<unsigned>(strtoul(argv[1], NULL, 10)) : 2024;
+    mt19937 rng(seed);
+
+    testBinarySearchTree(rng);
+    testAVLTree(rng);
+    testSplitJoin(rng);
+    testMixedAllocators();
+    testSetOperations(rng);
+    testBulkInsert(rng);
+    testAugmentedAVLTree(rng);
+    testConcurrentAVLTree();
+    testBPlusTree(rng);
+    testCompactAVLTree(rng);
+    testImages(rng);
+    testPersistentAVLTree(rng);
+    testShardedAVLMap();
+    testParallelScans(rng);
+    testKeySearch(rng);
+    testDurableAVLTree(rng);
+    testDeferredClear(rng);
+
+    if(failures != 0) {
+        cout << failures << " check(s) failed, seed " << seed << endl;
+        return 1;
+    }
+    cout << "All checks passed, seed " << seed << endl;
+    return 0;
+}